@@ -204,12 +204,12 @@ void SimulatedGrainfather::OnTimerDone() {
 
 bool SimulatedGrainfather::Update() {
   // we heat super fast, 1 degree per second
-  int64_t now = GetTimeMsec();
-  int64_t seconds_past = (now - current_state_.read_time) / 1000;
+  int64_t now = MonotonicNs();
+  int64_t seconds_past = (now - current_state_.read_time) / kNsPerSec;
   if (seconds_past < 1) {
     return false;
   }
-  current_state_.read_time += 1000 * seconds_past;
+  current_state_.read_time += kNsPerSec * seconds_past;
 
   // Heater raises temp
   if (current_state_.heater_on) {
@@ -6,6 +6,7 @@
 
 #include "gpio.h"
 #include "brew_types.h"
+#include "monotonic_clock.h"
 #include <vector>
 
 class SimulatedGrainfather {
@@ -38,15 +38,19 @@ int BrewSession::InitSession(const char *spreadsheet_id) {
   }
 
   // Log the weight every 10 seconds
-  scale_.SetPeriodicWeightCallback(10*1000*1000,
+  scale_.SetPeriodicWeightCallback(10*1000,
                                    std::bind(&BrewLogger::LogWeight, &brew_logger_, _1, _2));
+  // And whenever something is added or taken away
+  scale_.SetWeightStepCallback(std::bind(&BrewSession::OnWeightStep, this, _1));
 
   // Set the function that the winch controller uses to see if it should abort movement
   winch_controller_.SetAbortCheck(std::bind(&ScaleFilter::HasKettleLifted, &scale_));
   // ------------------------------------------------------------------
   // Initialize the Grainfather serial interface
   // Make sure things are working
-  if (grainfather_serial_.Init(std::bind(&BrewLogger::LogBrewState, &brew_logger_, _1)) < 0) {
+  grainfather_serial_.AddLinkHealthCallback(
+      std::bind(&BrewSession::OnGrainfatherLink, this, _1));
+  if (grainfather_serial_.Init(std::bind(&BrewSession::OnBrewState, this, _1)) < 0) {
     printf("Grainfather connection did not initialize correctly\n");
     return -1;
   }
@@ -156,11 +160,20 @@ int BrewSession::Drain() {
   // Raise the rest of the way
   std::cout << "RaiseStep2" << std::endl;
   if (winch_controller_.RaiseToDrain_2()) return -1;
-  SleepMinutes(1);
   // After weight has settled from lifting the mash out
-  brew_logger_.LogWeightEvent(WeightEvent::AfterLift, scale_.GetWeightStartingNow());
-  // Drain for 45 minutes // TODO: detect drain stopping
-  SleepMinutes(drain_duration_s_);
+  LogSettledWeight(WeightEvent::AfterLift);
+  // Drain until the drip stops, or for drain_duration_s_ at most.
+  drain_complete_ = false;
+  scale_.NotifyWhenDrainComplete(std::bind(&BrewSession::OnDrainComplete, this));
+  for (int64_t i = 0; i < drain_duration_s_ && !drain_complete_; ++i) {
+    SleepSeconds(1);
+    if (i % 60 == 0 && scale_.PredictedDrainDoneTime()) {
+      std::cout << "Draining should be done in "
+                << (scale_.PredictedDrainDoneTime() - MonotonicNs()) / kNsPerSec
+                << " seconds" << std::endl;
+    }
+  }
+  scale_.NotifyWhenDrainComplete(nullptr);
   std::cout << "Draining is complete" << std::endl;
   brew_logger_.LogWeightEvent(WeightEvent::AfterDrain, scale_.GetWeightStartingNow());
   if (winch_controller_.MoveToSink()) return -1;
@@ -194,8 +207,8 @@ int BrewSession::Boil() {
   // Wait one minute before raising hops for lines to drain
   SleepMinutes(1);
   if (winch_controller_.RaiseHops()) return -1;
-  SleepMinutes(1);  // sleep for 1 minute to drain
-  brew_logger_.LogWeightEvent(WeightEvent::AfterBoil, scale_.GetWeightStartingNow());
+  // Let the hops drain
+  LogSettledWeight(WeightEvent::AfterBoil);
   return 0;
 }
 
@@ -211,6 +224,23 @@ int BrewSession::Decant() {
   return 0;
 }
 
+void BrewSession::LogSettledWeight(WeightEvent event) {
+  double grams;
+  if (!scale_.WaitForPlateau(kMaxSettleSeconds * 1000 / zippy_time_divider_, &grams)) {
+    std::cout << "Weight did not settle" << std::endl;
+    grams = scale_.GetWeightStartingNow();
+  }
+  brew_logger_.LogWeightEvent(event, grams);
+}
+
+void BrewSession::OnWeightStep(const WeightStep &step) {
+  char message[100];
+  snprintf(message, sizeof(message), "Weight changed by %.0f g, to %.0f g",
+           step.Change(), step.after_grams);
+  std::cout << message << std::endl;
+  brew_logger_.Log(1, message);
+}
+
 // TODO: make a function that handles the pump serial, valve status
 // and scale callbacks
 int BrewSession::TurnPumpOff() {
@@ -12,6 +12,7 @@
 #include "winch.h"
 #include "valves.h"
 #include "logger.h"
+#include <atomic>
 #include <utility>
 #include <deque>
 #include <mutex>
@@ -142,6 +143,34 @@ class BrewSession {
     GlobalPause();
   }
 
+  // Logs the weight once it settles, waiting kMaxSettleSeconds at most.
+  static constexpr int kMaxSettleSeconds = 60;
+  void LogSettledWeight(WeightEvent event);
+
+  // The Grainfather is running the heater and pump on its own, so we should
+  // know right away if we stop hearing from it.
+  void OnGrainfatherLink(LinkHealth health) {
+    if (health != LinkHealth::kHealthy) {
+      std::cout << "Error! Grainfather link is " << LinkHealthName(health) << std::endl;
+    }
+  }
+
+  // Logs the Grainfather's state, and tells the scale when the pump is on.
+  void OnBrewState(const BrewState &state) {
+    scale_.SetPumpOn(state.pump_on);
+    brew_logger_.LogBrewState(state);
+  }
+
+  // Logs unplanned additions and losses, as well as planned ones.
+  void OnWeightStep(const WeightStep &step);
+
+  // When the wort has stopped dripping out of the mash
+  std::atomic<bool> drain_complete_{false};
+  void OnDrainComplete() {
+    std::cout << "Drip has stopped" << std::endl;
+    drain_complete_ = true;
+  }
+
   // Not to be used for precise timing!
   void SleepMinutes(int minutes) {
     SleepSeconds(minutes * 60);
@@ -4,6 +4,7 @@
 
 #include "brew_types.h"
 #include "gpio.h"
+#include "monotonic_clock.h"
 
 #include <deque>
 #include <iostream>
@@ -172,7 +173,7 @@ int BrewState::Load(std::string in) {
     return -1;
   }
   timer_paused = (_timer_paused == 1);
-  read_time = GetTimeMsec();
+  read_time = MonotonicNs();
   valid = true;
   return 0;
 }
@@ -40,7 +40,7 @@ struct BrewRecipe {
 
 
 struct BrewState {
-  int64_t read_time = 0;
+  int64_t read_time = 0;  // MonotonicNs
   bool timer_on = false, timer_paused = false;
   uint32_t timer_seconds_left = 0;
   uint32_t timer_total_seconds = 0;
@@ -88,6 +88,7 @@ struct Weights {
   uint32_t latest;
 };
 
+// MonotonicNs times.
 struct Times {
   int64_t brew_start_time = 0, mash_start_time = 0;
   int64_t mash_end_time = 0, boil_start_time = 0;
@@ -0,0 +1,104 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "callback_dispatcher.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include "monotonic_clock.h"
+
+CallbackDispatcher::CallbackDispatcher() {
+  sem_init(&events_ready_, 0, 0);
+  dispatch_thread_ = std::thread(&CallbackDispatcher::DispatchThread, this);
+}
+
+CallbackDispatcher::~CallbackDispatcher() {
+  // Run whatever is left, then stop.
+  running_ = false;
+  sem_post(&events_ready_);
+  if (dispatch_thread_.joinable())
+    dispatch_thread_.join();
+  sem_destroy(&events_ready_);
+}
+
+int CallbackDispatcher::Subscribe(Priority priority, int64_t min_interval) {
+  std::lock_guard<std::mutex> lock(subscribe_lock_);
+  int id = num_subscriptions_;
+  if (id == kMaxSubscriptions) {
+    printf("CallbackDispatcher: too many subscriptions\n");
+    return -1;
+  }
+  subscriptions_[id].priority = priority;
+  subscriptions_[id].min_interval = min_interval;
+  num_subscriptions_ = id + 1;
+  return id;
+}
+
+bool CallbackDispatcher::Post(int subscription, std::function<void()> callback) {
+  if (subscription < 0 || subscription >= num_subscriptions_) {
+    return false;
+  }
+  int64_t tnow = MonotonicNs();
+  Subscription *sub = &subscriptions_[subscription];
+  if (sub->min_interval && sub->last_post &&
+      tnow - sub->last_post < sub->min_interval) {
+    rate_limited_++;
+    return false;
+  }
+  Event event;
+  event.callback = std::move(callback);
+  event.post_time = tnow;
+  if (!queues_[sub->priority].Push(event)) {
+    return false;
+  }
+  sub->last_post = tnow;
+  posted_++;
+  sem_post(&events_ready_);
+  return true;
+}
+
+void CallbackDispatcher::DispatchThread() {
+  Event event;
+  while (true) {
+    if (sem_wait(&events_ready_) && errno == EINTR) {
+      continue;
+    }
+    // Highest priority first.  Each post has a sem_post, so there is at
+    // most one event to run per wakeup, but after a shutdown post there
+    // might be none.
+    bool found = false;
+    for (int p = 0; p < kNumPriorities && !found; ++p) {
+      found = queues_[p].Pop(&event);
+    }
+    if (found) {
+      int64_t latency = MonotonicNs() - event.post_time;
+      event.callback();
+      event.callback = nullptr;
+      std::lock_guard<std::mutex> lock(status_lock_);
+      delivered_++;
+      latency_us_.Add(latency / kNsPerUs);
+      continue;
+    }
+    if (!running_) {
+      return;
+    }
+  }
+}
+
+CallbackDispatcher::Status CallbackDispatcher::GetStatus() {
+  Status status;
+  status.posted = posted_;
+  status.rate_limited = rate_limited_;
+  for (const auto &queue : queues_) {
+    status.dropped += queue.Overflows();
+    status.queue_depth += queue.Size();
+    if (queue.MaxDepth() > status.queue_max_depth) {
+      status.queue_max_depth = queue.MaxDepth();
+    }
+  }
+  std::lock_guard<std::mutex> lock(status_lock_);
+  status.delivered = delivered_;
+  status.latency_us = latency_us_;
+  return status;
+}
@@ -0,0 +1,78 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <semaphore.h>
+#include <thread>
+#include "histogram.h"
+#include "spsc_ring.h"
+
+// Runs callbacks on a thread of its own, so whoever posts them never waits
+// on user code.  Callbacks are posted to subscriptions, each of which has
+// a priority and can be rate limited.  Each priority has a bounded, lock
+// free queue: when it's full, the callback is dropped (and counted), and
+// higher priority callbacks (alarms) always run first.
+// Callbacks must all be posted from one thread.
+class CallbackDispatcher {
+ public:
+  enum Priority { kAlarm = 0, kNormal = 1, kLow = 2, kNumPriorities = 3 };
+
+  struct Status {
+    int64_t posted = 0, delivered = 0;
+    int64_t dropped = 0;        // the queue was full
+    int64_t rate_limited = 0;   // too soon after the last one
+    // Waiting now (in all the queues), and the most that have waited
+    // in one queue.
+    size_t queue_depth = 0, queue_max_depth = 0;
+    // From posting to the start of the callback.
+    Log2Histogram latency_us;
+  };
+
+  CallbackDispatcher();
+  ~CallbackDispatcher();
+
+  // Callbacks posted to the subscription are run at |priority|, and at
+  // most one every |min_interval| ns (0 for no limit).  Returns the
+  // subscription to post to, or -1 if there are too many.
+  int Subscribe(Priority priority, int64_t min_interval = 0);
+
+  // Queues |callback|.  Never blocks.  Returns false if it was dropped.
+  bool Post(int subscription, std::function<void()> callback);
+
+  Status GetStatus();
+
+ private:
+  struct Event {
+    std::function<void()> callback;
+    int64_t post_time;
+  };
+  struct Subscription {
+    Priority priority;
+    int64_t min_interval;
+    int64_t last_post = 0;  // only touched by the posting thread
+  };
+  static constexpr int kMaxSubscriptions = 16;
+  static constexpr size_t kQueueSize = 64;
+
+  void DispatchThread();
+
+  // Fixed, so posting doesn't need a lock to find its subscription.
+  std::mutex subscribe_lock_;
+  Subscription subscriptions_[kMaxSubscriptions];
+  std::atomic<int> num_subscriptions_{0};
+  SpscRing<Event, kQueueSize> queues_[kNumPriorities];
+  std::atomic<int64_t> posted_{0}, rate_limited_{0};
+  // Posted for each event queued.
+  sem_t events_ready_;
+  std::atomic<bool> running_{true};
+  std::thread dispatch_thread_;
+
+  std::mutex status_lock_;
+  int64_t delivered_ = 0;
+  Log2Histogram latency_us_;
+};
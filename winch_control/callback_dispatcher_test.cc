@@ -0,0 +1,99 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "callback_dispatcher.h"
+#include "monotonic_clock.h"
+#include "gtest/gtest.h"
+
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+// Waits up to a second for everything posted to run.
+void WaitForCallbacks(CallbackDispatcher *dispatcher) {
+  for (int i = 0; i < 1000; ++i) {
+    CallbackDispatcher::Status status = dispatcher->GetStatus();
+    if (status.delivered == status.posted) return;
+    usleep(1000);
+  }
+}
+
+TEST(CallbackDispatcher, RunsCallbacksOnItsOwnThread) {
+  CallbackDispatcher dispatcher;
+  int sub = dispatcher.Subscribe(CallbackDispatcher::kNormal);
+  std::thread::id caller;
+  std::atomic<int> calls(0);
+  EXPECT_TRUE(dispatcher.Post(sub, [&]() {
+        caller = std::this_thread::get_id();
+        calls++;
+      }));
+  WaitForCallbacks(&dispatcher);
+  EXPECT_EQ(calls, 1);
+  EXPECT_NE(caller, std::this_thread::get_id());
+  CallbackDispatcher::Status status = dispatcher.GetStatus();
+  EXPECT_EQ(status.posted, 1);
+  EXPECT_EQ(status.delivered, 1);
+  EXPECT_EQ(status.latency_us.total, 1);
+  EXPECT_EQ(dispatcher.Post(sub + 1, []() {}), false);  // no such subscription
+}
+
+// A slow callback holds up the dispatcher, but not the poster.  The alarm
+// posted last runs before the rest.
+TEST(CallbackDispatcher, SlowCallbackDoesNotBlockAndAlarmsGoFirst) {
+  CallbackDispatcher dispatcher;
+  int alarm = dispatcher.Subscribe(CallbackDispatcher::kAlarm);
+  int normal = dispatcher.Subscribe(CallbackDispatcher::kNormal);
+  std::mutex lock;
+  std::vector<int> order;
+  std::atomic<bool> release(false);
+  dispatcher.Post(normal, [&]() {
+        while (!release) usleep(1000);
+      });
+  usleep(10000);  // let the slow one start
+  int64_t tstart = MonotonicNs();
+  for (int i = 1; i <= 5; ++i) {
+    dispatcher.Post(normal, [&, i]() {
+          std::lock_guard<std::mutex> l(lock);
+          order.push_back(i);
+        });
+  }
+  dispatcher.Post(alarm, [&]() {
+        std::lock_guard<std::mutex> l(lock);
+        order.push_back(0);
+      });
+  EXPECT_LT(MonotonicNs() - tstart, 10 * kNsPerMs);
+  EXPECT_EQ(dispatcher.GetStatus().queue_depth, 6u);
+  release = true;
+  WaitForCallbacks(&dispatcher);
+  std::lock_guard<std::mutex> l(lock);
+  EXPECT_EQ(order, std::vector<int>({0, 1, 2, 3, 4, 5}));
+}
+
+TEST(CallbackDispatcher, DropsWhenFullOrTooSoon) {
+  CallbackDispatcher dispatcher;
+  int limited = dispatcher.Subscribe(CallbackDispatcher::kNormal, kNsPerSec);
+  int low = dispatcher.Subscribe(CallbackDispatcher::kLow);
+  EXPECT_TRUE(dispatcher.Post(limited, []() {}));
+  EXPECT_FALSE(dispatcher.Post(limited, []() {}));
+  std::atomic<bool> release(false);
+  dispatcher.Post(low, [&]() {
+        while (!release) usleep(1000);
+      });
+  usleep(10000);
+  int accepted = 0;
+  for (int i = 0; i < 100; ++i) {
+    accepted += dispatcher.Post(low, []() {});
+  }
+  release = true;
+  WaitForCallbacks(&dispatcher);
+  CallbackDispatcher::Status status = dispatcher.GetStatus();
+  EXPECT_EQ(accepted, 64);
+  EXPECT_EQ(status.dropped, 36);
+  EXPECT_EQ(status.rate_limited, 1);
+  EXPECT_EQ(status.queue_max_depth, 64u);
+  EXPECT_EQ(status.delivered, 66);
+}
+
+}  // namespace
@@ -0,0 +1,52 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "data_ready_predictor.h"
+
+#include <math.h>
+
+void DataReadyPredictor::Observe(int64_t edge_ns) {
+  int64_t dt = edge_ns - last_edge_;
+  bool first = last_edge_ == 0;
+  last_edge_ = edge_ns;
+  if (first || dt <= 0) {
+    return;
+  }
+  if (period_ns_ == 0) {
+    period_ns_ = dt;
+    return;
+  }
+  // If a reading was dropped, the interval covers several periods.
+  int64_t periods = llround(dt / period_ns_);
+  if (periods < 1) periods = 1;
+  double error = dt - periods * period_ns_;
+  double max_error = kMaxErrorFraction * period_ns_;
+  if (max_error < kMinMaxErrorNs) max_error = kMinMaxErrorNs;
+  if (fabs(error) > max_error) {
+    // Lost track.  Start learning again from this interval.
+    if (locked_) {
+      misses_++;
+    }
+    locked_ = false;
+    consistent_intervals_ = 0;
+    period_ns_ = dt;
+    return;
+  }
+  period_ns_ += kPeriodGain * error / periods;
+  if (++consistent_intervals_ >= kIntervalsToLock) {
+    locked_ = true;
+  }
+}
+
+int64_t DataReadyPredictor::Predict(int64_t now_ns) const {
+  if (!locked_) {
+    return 0;
+  }
+  int64_t periods = 1;
+  if (now_ns > last_edge_) {
+    periods = ceil((now_ns - last_edge_) / period_ns_);
+    if (periods < 1) periods = 1;
+  }
+  return last_edge_ + periods * period_ns_;
+}
@@ -0,0 +1,44 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+
+// The HX711 finishes a conversion on a steady period (set by its oscillator),
+// so once we have seen a few data ready edges, we know when the next one is
+// coming.  The reader can then sleep until just before it, instead of
+// polling the whole time.
+// If an edge turns up far from where we expected, we stop predicting until
+// the period has been learned again.
+class DataReadyPredictor {
+ public:
+  // Records the time (MonotonicNs) that DATA went low.
+  void Observe(int64_t edge_ns);
+
+  // The expected time of the next edge after |now_ns|, or 0 if we don't
+  // have a good enough estimate yet.
+  int64_t Predict(int64_t now_ns) const;
+
+  bool Locked() const { return locked_; }
+  int64_t PeriodNs() const { return locked_ ? period_ns_ : 0; }
+  // The number of times we lost track of the edges after locking on.
+  int64_t Misses() const { return misses_; }
+
+ private:
+  // Consistent periods needed before we start predicting.
+  static constexpr int kIntervalsToLock = 5;
+  // How much each new interval moves the period estimate.
+  static constexpr double kPeriodGain = 0.1;
+  // An edge further than this from the estimate means the estimate is bad.
+  // Edges polled from sysfs are only good to about a millisecond.
+  static constexpr double kMaxErrorFraction = 0.05;
+  static constexpr int64_t kMinMaxErrorNs = 2000000;  // 2 ms
+
+  int64_t last_edge_ = 0;
+  double period_ns_ = 0;
+  int consistent_intervals_ = 0;
+  bool locked_ = false;
+  int64_t misses_ = 0;
+};
@@ -0,0 +1,80 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "data_ready_predictor.h"
+#include "monotonic_clock.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+constexpr int64_t kPeriod = 100 * kNsPerMs;  // 10 SPS
+
+TEST(DataReadyPredictor, LocksOnSteadyPeriod) {
+  DataReadyPredictor predictor;
+  int64_t t = 5 * kNsPerSec;
+  EXPECT_EQ(predictor.Predict(t), 0);
+  for (int i = 0; i < 10; ++i) {
+    predictor.Observe(t);
+    t += kPeriod;
+  }
+  ASSERT_TRUE(predictor.Locked());
+  EXPECT_EQ(predictor.PeriodNs(), kPeriod);
+  int64_t last = t - kPeriod;
+  // Just after the last edge, the next one is a period later.
+  EXPECT_EQ(predictor.Predict(last + kNsPerMs), last + kPeriod);
+  // If we are running late, predict the one after that.
+  EXPECT_EQ(predictor.Predict(last + kPeriod + kNsPerMs), last + 2 * kPeriod);
+}
+
+TEST(DataReadyPredictor, TracksSlowDrift) {
+  DataReadyPredictor predictor;
+  int64_t t = kNsPerSec;
+  int64_t period = kPeriod;
+  for (int i = 0; i < 200; ++i) {
+    predictor.Observe(t);
+    t += period;
+    period += 10000;  // 10 us per conversion
+  }
+  EXPECT_TRUE(predictor.Locked());
+  EXPECT_NEAR(predictor.PeriodNs(), period, kNsPerMs);
+  EXPECT_EQ(predictor.Misses(), 0);
+}
+
+TEST(DataReadyPredictor, SkippedConversionsKeepLock) {
+  DataReadyPredictor predictor;
+  int64_t t = kNsPerSec;
+  for (int i = 0; i < 10; ++i) {
+    predictor.Observe(t);
+    t += kPeriod;
+  }
+  // A reading was dropped:
+  t += kPeriod;
+  predictor.Observe(t);
+  EXPECT_TRUE(predictor.Locked());
+  EXPECT_EQ(predictor.PeriodNs(), kPeriod);
+}
+
+TEST(DataReadyPredictor, UnlocksWhenOffTrack) {
+  DataReadyPredictor predictor;
+  int64_t t = kNsPerSec;
+  for (int i = 0; i < 10; ++i) {
+    predictor.Observe(t);
+    t += kPeriod;
+  }
+  ASSERT_TRUE(predictor.Locked());
+  // The RATE pin changed to 80 SPS:
+  predictor.Observe(t - kPeriod + kPeriod / 8);
+  EXPECT_FALSE(predictor.Locked());
+  EXPECT_EQ(predictor.Predict(t), 0);
+  EXPECT_EQ(predictor.Misses(), 1);
+  t = t - kPeriod + kPeriod / 8;
+  for (int i = 0; i < 10; ++i) {
+    t += kPeriod / 8;
+    predictor.Observe(t);
+  }
+  EXPECT_TRUE(predictor.Locked());
+  EXPECT_EQ(predictor.PeriodNs(), kPeriod / 8);
+}
+
+}  // namespace
@@ -0,0 +1,93 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "drain_monitor.h"
+
+#include <math.h>
+
+void DrainMonitor::Reset(double done_grams_per_sec) {
+  Config config = config_;
+  config.done_grams_per_sec = done_grams_per_sec;
+  *this = DrainMonitor(config);
+}
+
+void DrainMonitor::Add(int64_t time, double grams) {
+  if (start_time_ == 0) {
+    start_time_ = time;
+  }
+  if (bucket_count_ && time - bucket_start_ >= config_.bucket_ns) {
+    FinishBucket();
+  }
+  if (bucket_count_ == 0) {
+    bucket_start_ = time;
+    bucket_time_sum_ = bucket_weight_sum_ = 0;
+  }
+  bucket_time_sum_ += time - bucket_start_;
+  bucket_weight_sum_ += grams;
+  bucket_count_++;
+}
+
+void DrainMonitor::FinishBucket() {
+  int64_t time = bucket_start_ + bucket_time_sum_ / bucket_count_;
+  double weight = bucket_weight_sum_ / bucket_count_;
+  bucket_count_ = 0;
+  bool had_last = have_last_;
+  int64_t dt = time - last_time_;
+  double dw = weight - last_weight_;
+  have_last_ = true;
+  last_time_ = time;
+  last_weight_ = weight;
+  if (!had_last || dt <= 0) return;
+
+  flow_rate_ = dw * kNsPerSec / dt;
+  double flow = fabs(flow_rate_);
+  if (flow < config_.done_grams_per_sec) {
+    buckets_below_++;
+  } else {
+    buckets_below_ = 0;
+  }
+  // Keep the log finite when the flow is lost in the noise.
+  double floor = config_.done_grams_per_sec / 10;
+  double mid_time = (time - dt / 2 - start_time_) / (double)kNsPerSec;
+  log_flows_.emplace_back(mid_time, log(flow > floor ? flow : floor));
+  if (log_flows_.size() > config_.fit_buckets) {
+    log_flows_.pop_front();
+  }
+  Fit();
+
+  int64_t now = time + config_.bucket_ns / 2;
+  bool predicted = predicted_done_time_ && now >= predicted_done_time_;
+  if ((predicted && buckets_below_ > 0) ||
+      buckets_below_ >= config_.buckets_to_confirm) {
+    done_ = true;
+  }
+}
+
+// Least squares fit of log(flow) = a + b * t.  The flow decays with time
+// constant -1/b, and drops below the done rate at t = (log(done) - a) / b.
+void DrainMonitor::Fit() {
+  predicted_done_time_ = 0;
+  decay_seconds_ = 0;
+  size_t n = log_flows_.size();
+  if (n < config_.min_fit_buckets) return;
+  double st = 0, sy = 0;
+  for (const auto &p : log_flows_) {
+    st += p.first;
+    sy += p.second;
+  }
+  double tmean = st / n, ymean = sy / n;
+  double stt = 0, sty = 0;
+  for (const auto &p : log_flows_) {
+    stt += (p.first - tmean) * (p.first - tmean);
+    sty += (p.first - tmean) * (p.second - ymean);
+  }
+  if (stt <= 0) return;
+  double b = sty / stt;
+  if (b >= 0) return;  // not slowing down
+  double a = ymean - b * tmean;
+  decay_seconds_ = -1 / b;
+  double done_time = (log(config_.done_grams_per_sec) - a) / b;
+  if (done_time > kMaxPredictionSeconds) return;
+  predicted_done_time_ = start_time_ + done_time * kNsPerSec;
+}
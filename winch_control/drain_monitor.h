@@ -0,0 +1,80 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <deque>
+#include <stddef.h>
+#include <stdint.h>
+#include "monotonic_clock.h"
+
+// Watches wort dripping out of the raised mash tun, to tell when it has
+// (nearly) stopped.  The flow is measured as the change in weight between
+// buckets of several seconds, which averages out the scale noise.  The drip
+// slows down roughly exponentially, so a line is fit to log(flow) over
+// time, which predicts when the flow will drop below the done rate.
+// The drain is done when we get there, and the flow really has dropped.
+// Works the same whether the weight is going up or down.
+// Not thread safe.
+class DrainMonitor {
+ public:
+  struct Config {
+    int64_t bucket_ns = 10 * kNsPerSec;
+    double done_grams_per_sec = 0.5;  //TODO: check value
+    // Flow measurements to fit the decay over.
+    size_t fit_buckets = 30;
+    // Need this many flow measurements to trust the fit.
+    size_t min_fit_buckets = 6;
+    // Without a fit, the flow must be below the done rate this many times
+    // in a row.
+    int buckets_to_confirm = 3;
+  };
+
+  DrainMonitor() : DrainMonitor(Config()) {}
+  explicit DrainMonitor(const Config &config) : config_(config) {}
+
+  // Starts watching again, stopping when the flow is below
+  // |done_grams_per_sec|.
+  void Reset(double done_grams_per_sec);
+
+  // |time| is MonotonicNs.
+  void Add(int64_t time, double grams);
+
+  bool Done() const { return done_; }
+  // The latest flow measurement, in g/s.
+  double FlowRate() const { return flow_rate_; }
+  // When the fit says the flow will drop below the done rate (MonotonicNs),
+  // or 0 if we can't tell yet.
+  int64_t PredictedDoneTime() const { return predicted_done_time_; }
+  // The time for the flow to drop by a factor of e, in seconds,
+  // or 0 if we can't tell yet.
+  double DecaySeconds() const { return decay_seconds_; }
+
+ private:
+  // Predictions further out than a day are just noise.
+  static constexpr double kMaxPredictionSeconds = 24 * 3600;
+
+  void FinishBucket();
+  void Fit();
+
+  Config config_;
+  // The bucket being filled, with times relative to its start.
+  int64_t bucket_start_ = 0;
+  double bucket_time_sum_ = 0, bucket_weight_sum_ = 0;
+  int bucket_count_ = 0;
+  // The mean time and weight of the last full bucket.
+  bool have_last_ = false;
+  int64_t last_time_ = 0;
+  double last_weight_ = 0;
+  // (time, log(flow)) of recent flow measurements, time in seconds
+  // from start_time_.
+  int64_t start_time_ = 0;
+  std::deque<std::pair<double, double>> log_flows_;
+
+  double flow_rate_ = 0;
+  int buckets_below_ = 0;
+  int64_t predicted_done_time_ = 0;
+  double decay_seconds_ = 0;
+  bool done_ = false;
+};
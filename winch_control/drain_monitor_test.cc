@@ -0,0 +1,75 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "drain_monitor.h"
+#include "gtest/gtest.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+namespace {
+
+constexpr int64_t kStartTime = 1000 * kNsPerSec;
+constexpr int64_t kPeriod = 100 * kNsPerMs;  // 10 SPS
+
+// Wort dripping into the kettle: the flow starts at 20 g/s, and decays
+// with a 10 minute time constant, so it drops below 0.5 g/s after
+// 600 * ln(40) = 2213 seconds.
+double DripWeight(double t) {
+  return 20000 + 20.0 * 600 * (1 - exp(-t / 600)) + (rand() % 1000) / 100.0 - 5.0;
+}
+
+TEST(DrainMonitor, PredictsAndDetectsEndOfDrip) {
+  srand(5);
+  DrainMonitor monitor;
+  monitor.Reset(0.5);
+  int64_t predicted_at_15_min = 0;
+  double done_seconds = 0;
+  for (int i = 0; i < 3600 * 10; ++i) {
+    double t = i / 10.0;
+    monitor.Add(kStartTime + i * kPeriod, DripWeight(t));
+    if (i == 900 * 10) {
+      predicted_at_15_min = monitor.PredictedDoneTime();
+      EXPECT_NEAR(monitor.DecaySeconds(), 600, 60);
+      EXPECT_GT(monitor.FlowRate(), 0);
+    }
+    if (monitor.Done()) {
+      done_seconds = t;
+      break;
+    }
+  }
+  EXPECT_NEAR((predicted_at_15_min - kStartTime) / (double)kNsPerSec, 2213, 200);
+  EXPECT_GT(done_seconds, 2000);
+  EXPECT_LT(done_seconds, 2400);
+}
+
+TEST(DrainMonitor, SteadyWeightIsDone) {
+  srand(6);
+  DrainMonitor monitor;
+  monitor.Reset(0.5);
+  int i = 0;
+  for (; i < 1000 && !monitor.Done(); ++i) {
+    monitor.Add(kStartTime + i * kPeriod, 15000 + (rand() % 100) / 10.0);
+  }
+  EXPECT_TRUE(monitor.Done());
+  // One bucket to start, then 3 flow measurements below the done rate.
+  EXPECT_LT(i, 500);
+  monitor.Reset(0.5);
+  EXPECT_FALSE(monitor.Done());
+  EXPECT_EQ(monitor.PredictedDoneTime(), 0);
+}
+
+TEST(DrainMonitor, FastFlowIsNotDone) {
+  DrainMonitor monitor;
+  monitor.Reset(0.5);
+  for (int i = 0; i < 3000; ++i) {
+    monitor.Add(kStartTime + i * kPeriod, 20000 - 5.0 * i / 10);
+  }
+  EXPECT_FALSE(monitor.Done());
+  EXPECT_NEAR(monitor.FlowRate(), -5.0, 0.01);
+  // Not slowing down, so no prediction.
+  EXPECT_EQ(monitor.PredictedDoneTime(), 0);
+}
+
+}  // namespace
@@ -1,15 +1,17 @@
-echo 10 > /sys/class/gpio/export
-echo 9 > /sys/class/gpio/export
-echo 11 > /sys/class/gpio/export
-echo 8 > /sys/class/gpio/export
 echo 14 > /sys/class/gpio/export
 echo 25 > /sys/class/gpio/export
 echo 24 > /sys/class/gpio/export
 echo 22 > /sys/class/gpio/export
-echo 2 > /sys/class/gpio/export
-echo 3 > /sys/class/gpio/export
-echo 4 > /sys/class/gpio/export
-echo 27 > /sys/class/gpio/export
-echo 21 > /sys/class/gpio/export
-echo 20 > /sys/class/gpio/export
-echo 12 > /sys/class/gpio/export
+# The winches (10, 9, 11, 8), the relays (2, 3, 4, 27, 21) and the scale
+# (12, 20) are requested through the GPIO character device, which fails
+# with EBUSY on pins exported through sysfs.  Only export them if there is
+# no character device.
+for pin in 10 9 11 8 2 3 4 27 21 20 12; do
+  if [ -e /dev/gpiochip0 ]; then
+    if [ -e /sys/class/gpio/gpio$pin ]; then
+      echo $pin > /sys/class/gpio/unexport
+    fi
+  else
+    echo $pin > /sys/class/gpio/export
+  fi
+done
@@ -8,33 +8,30 @@
 #include <vector>
 #include <thread>
 #include <functional>
-
+#include "raw_scale.h"
+#include "simulated_hx711.h"
 
 
 class FakeScale : public RawScale {
   double current_weight_ = 12000;
   double dgrams_per_sec_ = 0;
   int64_t last_time_ = 0;
+  int64_t sample_period_us_ = 100000;  // 10 SPS, like the HX711 default
 
 public:
-  int InitLoop(std::function<void(double, int64_t)> callback,
-                       std::function<void()> error_callback) {
-  weight_callback_ = callback;
-  error_callback_ = error_callback;
-  reading_thread_enabled_ = true;
-  reading_thread_ = std::thread(&FakeScale::ReadingThread, this);
-  return 0;
-  }
+  // The fake scale generates weights directly, but sits on a simulated chip
+  // so the shared RawScale setup never touches the real GPIOs.
+  FakeScale() : RawScale(std::unique_ptr<Hx711Lines>(new SimulatedHx711())) {}
 
   bool ReadOne() {
-    usleep(100000);
-    int64_t tdiff, tnow = GetTimeMsec();
+    usleep(sample_period_us_);
+    int64_t tdiff, tnow = MonotonicNs();
     if (last_time_ == 0) {
       last_time_ = tnow;
       return false;
     }
     tdiff = tnow - last_time_;
-    current_weight_ += (tdiff * dgrams_per_sec_) / 1000;
+    current_weight_ += (tdiff * dgrams_per_sec_) / kNsPerSec;
     last_time_ = tnow;
 
     std::lock_guard<std::mutex> lock(status_lock_);
@@ -57,6 +54,9 @@ public:
     }
   }
 
+  // 10 or 80, like the HX711 RATE pin.
+  void SetSampleRate(double hz) { sample_period_us_ = 1000000 / hz; }
+
   void DrainOut() { dgrams_per_sec_ = -50; }
   void Evaporate() { dgrams_per_sec_ = -.5; }
   void Stabalize() { dgrams_per_sec_ = 0; }
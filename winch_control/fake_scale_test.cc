@@ -1,4 +1,6 @@
 #include "scale_filter.h"
+#include <math.h>
+#include <random>
 #include "gtest/gtest.h"
 
 namespace {
@@ -38,15 +40,24 @@ class FakeScaleTest : public ::testing::Test {
      drain_callbacks_++;
   }
 
+  // Callbacks are run on another thread.  Waits for them to finish.
+  void WaitForCallbacks() {
+    for (int i = 0; i < 1000; ++i) {
+      CallbackDispatcher::Status status = scale_.GetDispatchStatus();
+      if (status.delivered == status.posted) return;
+      usleep(1000);
+    }
+  }
+
   void ErrorCallback() {
      err_callbacks_++;
   }
 
-  int err_callbacks_ = 0;
-  int drain_callbacks_ = 0;
+  std::atomic<int> err_callbacks_{0};
+  std::atomic<int> drain_callbacks_{0};
 
   // Objects declared here can be used by all tests in the test case for Foo.
-  ScaleFilter scale_;
+  TestScaleFilter scale_;
   FakeScale *fake_scale_ptr_;
 };
 
@@ -63,36 +74,204 @@ TEST_F(FakeScaleTest, StartWithZero) {
 }
 
 TEST_F(FakeScaleTest, DrainCheck) {
-   int64_t faketime = 10;
-   int64_t interval = 100;
+   int64_t faketime = 10 * kNsPerMs;
+   int64_t interval = 100 * kNsPerMs;
    // no calibration for the filter means that data from the raw data
    // will be treated as grams.
   EXPECT_EQ(drain_callbacks_, 0);
   for (int i=0; i < 50; ++i) {
     fake_scale_ptr_->InputData(1000.0, faketime); faketime+=interval;
+    WaitForCallbacks();
     EXPECT_EQ(drain_callbacks_, 0);
   }
-  usleep(500000);  // wait interval to trigger a check
-  fake_scale_ptr_->InputData(1000.0, faketime); faketime+=interval;
-  EXPECT_EQ(drain_callbacks_, 0);
 
   // Now simulate draining:
   double fakeweight = 1000.0;
-  double diff = 15;  // 50 ml per second
+  double diff = 15;  // 150 ml per second
+  int first_alarm = -1;
   for (int i=0; i < 50; ++i) {
     fake_scale_ptr_->InputData(fakeweight, faketime);
     faketime += interval;
     fakeweight -= diff;
-    EXPECT_EQ(drain_callbacks_, 0);
+    WaitForCallbacks();
+    if (drain_callbacks_ && first_alarm < 0) first_alarm = i;
   }
-  usleep(600000);  // wait interval to trigger a check
-  fake_scale_ptr_->InputData(fakeweight, faketime);
-  faketime += interval;
-  fakeweight -= diff;
+  // Every sample is checked, so the alarm goes off as soon as the
+  // 30 point window shows the drain, and only once.
+  EXPECT_GE(first_alarm, 0);
+  EXPECT_LT(first_alarm, 30);
   EXPECT_EQ(drain_callbacks_, 1);
 
 }
 
+// With the RATE pin high, each reading is noisier and the same number of
+// points covers an eighth of the time, so a steady weight must not look
+// like a drain.
+TEST_F(FakeScaleTest, NoDrainAlarmAt80Sps) {
+  std::mt19937 rng(80);
+  std::normal_distribution<double> noise(0.0, 2.0);
+  int64_t faketime = 10 * kNsPerMs;
+  int64_t interval = 12500 * kNsPerUs;
+  int armings = 0;
+  // Ten minutes, re-armed every two seconds.
+  for (int i = 0; i < 80 * 600; ++i) {
+    if (i % 160 == 0) {
+      WaitForCallbacks();
+      scale_.EnableDrainingAlarm([this]() { DrainCallback(); });
+      armings++;
+    }
+    fake_scale_ptr_->InputData(12000.0 + noise(rng), faketime);
+    faketime += interval;
+  }
+  WaitForCallbacks();
+  EXPECT_EQ(armings, 300);
+  EXPECT_EQ(drain_callbacks_, 0);
+  EXPECT_NEAR(scale_.GetSamplePeriodMs(), 12.5, 0.5);
+
+  // A real drain still sets it off.
+  double fakeweight = 12000.0;
+  for (int i = 0; i < 80 * 10 && drain_callbacks_ == 0; ++i) {
+    fake_scale_ptr_->InputData(fakeweight + noise(rng), faketime);
+    faketime += interval;
+    fakeweight -= 150.0 / 80;  // 150 ml per second
+    WaitForCallbacks();
+  }
+  EXPECT_EQ(drain_callbacks_, 1);
+}
+
+// The windows are sized once the first few intervals are in, rather than
+// emptied again and again as the measured period settles, so a drain at
+// start up is caught one drain window (3 s) later.
+TEST_F(FakeScaleTest, DrainAlarmSoonAfterStartAt80Sps) {
+  int64_t faketime = 10 * kNsPerMs;
+  double fakeweight = 12000.0;
+  int first_alarm = -1;
+  for (int i = 0; i < 80 * 5 && first_alarm < 0; ++i) {
+    fake_scale_ptr_->InputData(fakeweight, faketime);
+    faketime += 12500 * kNsPerUs;
+    fakeweight -= 150.0 / 80;  // 150 ml per second
+    WaitForCallbacks();
+    if (drain_callbacks_) first_alarm = i;
+  }
+  EXPECT_GE(first_alarm, 0);
+  EXPECT_LT(first_alarm, 80 * 3 + 20);
+}
+
+// A ripple that is there whether the pump runs or not isn't the pump, so
+// it mustn't become a notch.  A notch this low rings when the weight starts
+// to drain, which would hold off the alarm.
+TEST_F(FakeScaleTest, RippleUnderDrainDoesNotDelayAlarm) {
+  int64_t faketime = 10 * kNsPerMs;
+  int64_t interval = 100 * kNsPerMs;
+  double fakeweight = 12000.0;
+  int i = 0;
+  auto ripple = [&i]() { return 3 * sin(2 * M_PI * 0.16 * i / 10.0); };
+  for (; i < 400; ++i) {
+    fake_scale_ptr_->InputData(fakeweight + ripple(), faketime);
+    faketime += interval;
+  }
+  scale_.SetPumpOn(true);
+  for (; i < 1000; ++i) {
+    fake_scale_ptr_->InputData(fakeweight + ripple(), faketime);
+    faketime += interval;
+  }
+  WaitForCallbacks();
+  EXPECT_EQ(drain_callbacks_, 0);
+  int first_alarm = -1;
+  for (int j = 0; j < 100 && first_alarm < 0; ++i, ++j) {
+    fake_scale_ptr_->InputData(fakeweight + ripple(), faketime);
+    faketime += interval;
+    fakeweight -= 6;  // 60 ml per second, just over the threshold
+    WaitForCallbacks();
+    if (drain_callbacks_) first_alarm = j;
+  }
+  EXPECT_GE(first_alarm, 0);
+  EXPECT_LT(first_alarm, 30);
+}
+
+// The pump's vibration should be filtered out after seconds of pump, not
+// minutes.
+TEST_F(FakeScaleTest, FiltersPumpVibrationSoonAfterStart) {
+  std::mt19937 rng(19);
+  std::normal_distribution<double> noise(0.0, 2.0);
+  int64_t faketime = 10 * kNsPerMs;
+  int64_t interval = 100 * kNsPerMs;
+  for (int i = 0; i < 100; ++i) {
+    fake_scale_ptr_->InputData(12000.0 + noise(rng), faketime);
+    faketime += interval;
+  }
+  scale_.SetPumpOn(true);
+  for (int i = 0; i < 120; ++i) {
+    double vibration = 30 * sin(2 * M_PI * 3.3 * i / 10.0);
+    fake_scale_ptr_->InputData(12000.0 + vibration + noise(rng), faketime);
+    faketime += interval;
+  }
+  EXPECT_TRUE(scale_.IsVibrationFiltered());
+  EXPECT_NEAR(scale_.GetWeight(), 12000.0, 5.0);
+}
+
+// Steps that come close together (here, faster than real time) are all
+// reported.
+TEST_F(FakeScaleTest, ReportsQuickSteps) {
+  std::vector<double> steps;
+  scale_.SetWeightStepCallback([&steps](const WeightStep &step) {
+      steps.push_back(step.Change());
+    });
+  int64_t faketime = 10 * kNsPerMs;
+  for (double grams : {1000.0, 1500.0, 2000.0}) {
+    for (int i = 0; i < 40; ++i) {
+      fake_scale_ptr_->InputData(grams, faketime);
+      faketime += 100 * kNsPerMs;
+    }
+  }
+  WaitForCallbacks();
+  ASSERT_EQ(steps.size(), 2u);
+  EXPECT_NEAR(steps[0], 500.0, 1.0);
+  EXPECT_NEAR(steps[1], 500.0, 1.0);
+}
+
+// Feeds readings alternating +/- |noise| around |grams|, every 10 ms,
+// until |stop| is set.
+void FeedReadings(FakeScale *scale, double grams, double noise,
+                  std::atomic<bool> *stop) {
+  for (int i = 0; !*stop; ++i) {
+    scale->InputData(grams + (i % 2 ? noise : -noise), MonotonicNs());
+    usleep(10000);
+  }
+}
+
+TEST_F(FakeScaleTest, MeasureWeightSettlesEarly) {
+  std::atomic<bool> stop(false);
+  std::thread feeder(FeedReadings, fake_scale_ptr_, 5000.0, 1.0, &stop);
+  TestScaleFilter::WeightReading reading = scale_.MeasureWeight(2.0, 30, 2000);
+  stop = true;
+  feeder.join();
+  EXPECT_TRUE(reading.settled);
+  EXPECT_LT(reading.num_points, 10u);
+  EXPECT_NEAR(reading.grams, 5000.0, 1.0);
+  EXPECT_LE(reading.std_error, 2.0);
+}
+
+TEST_F(FakeScaleTest, MeasureWeightStopsAtMaxPoints) {
+  std::atomic<bool> stop(false);
+  std::thread feeder(FeedReadings, fake_scale_ptr_, 5000.0, 50.0, &stop);
+  TestScaleFilter::WeightReading reading = scale_.MeasureWeight(2.0, 30, 2000);
+  stop = true;
+  feeder.join();
+  EXPECT_FALSE(reading.settled);
+  EXPECT_EQ(reading.num_points, 30u);
+  EXPECT_NEAR(reading.grams, 5000.0, 10.0);
+  EXPECT_GT(reading.std_error, 2.0);
+}
+
+TEST_F(FakeScaleTest, MeasureWeightTimesOut) {
+  int64_t tstart = MonotonicNs();
+  TestScaleFilter::WeightReading reading = scale_.MeasureWeight(2.0, 30, 100);
+  EXPECT_EQ(reading.num_points, 0u);
+  EXPECT_GE(MonotonicNs() - tstart, 100 * kNsPerMs);
+  EXPECT_LT(MonotonicNs() - tstart, 1000 * kNsPerMs);
+}
+
 TEST_F(FakeScaleTest, EmptyCheck) {
   EXPECT_FALSE(scale_.CheckEmpty());
   fake_scale_ptr_->InputData(12000.0, 100);
@@ -101,6 +280,23 @@ TEST_F(FakeScaleTest, EmptyCheck) {
   EXPECT_TRUE(scale_.CheckEmpty());
 }
 
+// The runtime rig can be retuned without recompiling.
+TEST(RuntimeRigTest, ChangesThresholds) {
+  RuntimeRig::kKettleLiftedThresholdGrams = 500;
+  BasicScaleFilter<RuntimeRig> scale("");
+  scale.DisableForTest();
+  scale.InitLoop(nullptr);
+  FakeScale *fake_scale = scale.GetFakeScale();
+  fake_scale->StopLoop();
+  fake_scale->InputData(1000.0, 100);
+  // Below the usual 2 kg, but above ours.
+  EXPECT_FALSE(scale.HasKettleLifted());
+  fake_scale->InputData(400.0, 200);
+  EXPECT_TRUE(scale.HasKettleLifted());
+  RuntimeRig::Set<Rig10Sps>();
+  EXPECT_EQ(RuntimeRig::kKettleLiftedThresholdGrams, 2000);
+}
+
 }  // namespace
 
 // int main(int argc, char **argv) {
@@ -0,0 +1,58 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "flow_estimator.h"
+
+#include "monotonic_clock.h"
+
+void FlowEstimator::Start(int64_t time, double grams) {
+  estimate_.time = time;
+  estimate_.grams = grams;
+  estimate_.grams_per_sec = 0;
+  estimate_.grams_variance = config_.reading_sigma * config_.reading_sigma;
+  estimate_.rate_variance = config_.initial_rate_sigma * config_.initial_rate_sigma;
+  covariance_ = 0;
+  outliers_ = 0;
+}
+
+void FlowEstimator::Update(int64_t time, double grams) {
+  FlowEstimate &x = estimate_;
+  if (x.time == 0) {
+    Start(time, grams);
+    return;
+  }
+  // Predict forward to |time|: the weight moves by the rate, and the rate
+  // drifts (white noise acceleration).
+  double dt = (time - x.time) / (double)kNsPerSec;
+  if (dt < 0) dt = 0;
+  double q = config_.rate_drift_sigma * config_.rate_drift_sigma;
+  double p00 = x.grams_variance + 2 * dt * covariance_ + dt * dt * x.rate_variance +
+               q * dt * dt * dt / 3;
+  double p01 = covariance_ + dt * x.rate_variance + q * dt * dt / 2;
+  double p11 = x.rate_variance + q * dt;
+  x.grams += dt * x.grams_per_sec;
+  x.time = time;
+
+  // Then correct with the reading.
+  double r = config_.reading_sigma * config_.reading_sigma;
+  double innovation = grams - x.grams;
+  double s = p00 + r;
+  if (innovation * innovation > config_.outlier_sigmas * config_.outlier_sigmas * s) {
+    if (++outliers_ >= config_.outliers_to_reset) {
+      Start(time, grams);
+      return;
+    }
+    x.grams_variance = p00;
+    covariance_ = p01;
+    x.rate_variance = p11;
+    return;
+  }
+  outliers_ = 0;
+  double k0 = p00 / s, k1 = p01 / s;
+  x.grams += k0 * innovation;
+  x.grams_per_sec += k1 * innovation;
+  x.grams_variance = (1 - k0) * p00;
+  covariance_ = (1 - k0) * p01;
+  x.rate_variance = p11 - k1 * p01;
+}
@@ -0,0 +1,54 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+
+// The filtered weight, and how fast it is changing.
+struct FlowEstimate {
+  int64_t time = 0;  // MonotonicNs of the latest reading, 0 if none yet
+  double grams = 0, grams_per_sec = 0;
+  double grams_variance = 0, rate_variance = 0;
+};
+
+// A Kalman filter tracking the weight and the flow rate (the rate of change
+// of the weight), assuming the flow rate drifts slowly.  Each reading
+// updates the estimate in O(1), so it is as cheap as it gets, and it
+// doesn't lag like an average over a window does.
+// A reading far from the estimate is ignored, unless it is followed by
+// more like it, in which case the weight has stepped (the kettle was lifted,
+// or grain added), and the filter starts again from the new weight.
+// Not thread safe.
+class FlowEstimator {
+ public:
+  struct Config {
+    double reading_sigma = 5.0;    // grams of noise on each reading
+    // How fast the flow rate can change, in g/s per sqrt(second).
+    double rate_drift_sigma = 5.0;
+    // The flow rate we could be starting at, in g/s.
+    double initial_rate_sigma = 100.0;
+    // Readings more than this many sigmas off are outliers.
+    double outlier_sigmas = 6.0;
+    // This many outliers in a row mean the weight has stepped.
+    int outliers_to_reset = 3;
+  };
+
+  FlowEstimator() : FlowEstimator(Config()) {}
+  explicit FlowEstimator(const Config &config) : config_(config) {}
+
+  // |time| is MonotonicNs.
+  void Update(int64_t time, double grams);
+  void Reset() { estimate_ = FlowEstimate(); outliers_ = 0; }
+  const FlowEstimate &Estimate() const { return estimate_; }
+
+ private:
+  void Start(int64_t time, double grams);
+
+  Config config_;
+  FlowEstimate estimate_;
+  // Covariance between weight and rate.
+  double covariance_ = 0;
+  int outliers_ = 0;
+};
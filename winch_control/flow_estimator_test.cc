@@ -0,0 +1,78 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "flow_estimator.h"
+#include "monotonic_clock.h"
+#include "gtest/gtest.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+namespace {
+
+constexpr int64_t kStartTime = 1000 * kNsPerSec;
+constexpr int64_t kPeriod = 100 * kNsPerMs;  // 10 SPS
+
+// Noise of about +/- 5 grams.
+double Noise() { return (rand() % 1000) / 100.0 - 5.0; }
+
+TEST(FlowEstimator, TracksSteadyDrain) {
+  srand(3);
+  FlowEstimator flow;
+  EXPECT_EQ(flow.Estimate().time, 0);
+  for (int i = 0; i < 300; ++i) {
+    flow.Update(kStartTime + i * kPeriod, 10000 - 20.0 * i / 10 + Noise());
+  }
+  const FlowEstimate &x = flow.Estimate();
+  EXPECT_EQ(x.time, kStartTime + 299 * kPeriod);
+  EXPECT_NEAR(x.grams, 10000 - 20.0 * 29.9, 5.0);
+  EXPECT_NEAR(x.grams_per_sec, -20.0, 3.0);
+  EXPECT_LT(sqrt(x.rate_variance), 5.0);
+  EXPECT_LT(sqrt(x.grams_variance), 5.0);
+}
+
+TEST(FlowEstimator, FollowsRateChange) {
+  srand(4);
+  FlowEstimator flow;
+  for (int i = 0; i < 100; ++i) {
+    flow.Update(kStartTime + i * kPeriod, 10000 + Noise());
+  }
+  EXPECT_NEAR(flow.Estimate().grams_per_sec, 0, 3.0);
+  // Start draining at 100 g/s.  Within 2 seconds we should know.
+  for (int i = 0; i < 20; ++i) {
+    flow.Update(kStartTime + (100 + i) * kPeriod, 10000 - 10.0 * i + Noise());
+  }
+  EXPECT_LT(flow.Estimate().grams_per_sec, -50.0);
+  // A 3 second average would still be 2/3 of the drain behind.
+  EXPECT_NEAR(flow.Estimate().grams, 10000 - 190, 30.0);
+}
+
+TEST(FlowEstimator, IgnoresOneOutlier) {
+  FlowEstimator flow;
+  for (int i = 0; i < 50; ++i) {
+    flow.Update(kStartTime + i * kPeriod, 5000);
+  }
+  flow.Update(kStartTime + 50 * kPeriod, 7000);
+  EXPECT_NEAR(flow.Estimate().grams, 5000, 1.0);
+  EXPECT_NEAR(flow.Estimate().grams_per_sec, 0, 1.0);
+  flow.Update(kStartTime + 51 * kPeriod, 5000);
+  EXPECT_NEAR(flow.Estimate().grams, 5000, 1.0);
+}
+
+TEST(FlowEstimator, RestartsOnStep) {
+  FlowEstimator flow;
+  for (int i = 0; i < 50; ++i) {
+    flow.Update(kStartTime + i * kPeriod, 5000);
+  }
+  // Kettle lifted:
+  for (int i = 50; i < 53; ++i) {
+    flow.Update(kStartTime + i * kPeriod, 500);
+  }
+  EXPECT_EQ(flow.Estimate().grams, 500);
+  EXPECT_EQ(flow.Estimate().grams_per_sec, 0);
+  // We don't know the rate any more.
+  EXPECT_GT(sqrt(flow.Estimate().rate_variance), 50.0);
+}
+
+}  // namespace
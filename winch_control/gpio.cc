@@ -6,16 +6,12 @@
 // The numbers represent the (linux) gpio pin
 
 #include "gpio.h"
+#include "gpio_bank.h"
+#include "valves.h"
 
-#include <sys/time.h>   // gettimeofday
-
-int64_t GetTimeMsec() {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return tv.tv_sec * 1000 + tv.tv_usec / 1000;
-}
-
-char path_buffer[50];
+#include <sys/ioctl.h>
+#include <dirent.h>
+#include <linux/gpio.h>
 
 std::string gpio_val_path(uint8_t pin) {
    char path_buffer[50];
@@ -23,94 +19,100 @@ std::string gpio_val_path(uint8_t pin) {
    return path_buffer;
 }
 
-char *gpio_val(uint8_t pin) {
-   sprintf(path_buffer, "/sys/class/gpio/gpio%u/value", pin);
-   return path_buffer;
-}
-
-char *gpio_dir(uint8_t pin) {
-   sprintf(path_buffer, "/sys/class/gpio/gpio%u/direction", pin);
-   return path_buffer;
-}
-
 int SetOutput(uint8_t pin, uint8_t value) {
-   int fd = open(gpio_val(pin), O_RDWR);
-   if (!fd) {
-     printf("Failed to open %s\n", gpio_val(pin));
-     return -1;
-   }
-   write(fd, value ? "1" : "0", 1);
-   close(fd);
-   return 0;
+  return GpioBank::Instance().Line(pin)->Set(value);
 }
 
-
 int SetOpenDrain(uint8_t pin, uint8_t value) {
-   int fd = open(gpio_dir(pin), O_RDWR);
-   if (!fd) {
-     printf("Failed to open %s\n", gpio_val(pin));
-     return -1;
-   }
-   write(fd, value ? "low" : "in", 2 + value);
-   close(fd);
-   return 0;
+  return GpioBank::Instance().Line(pin)->SetOpenDrain(value);
 }
 
 int SetDirection(uint8_t pin, uint8_t direction, uint8_t value) {
-   int fd = open(gpio_dir(pin), O_RDWR);
-   if (!fd) {
-     printf("Failed to open %s\n", gpio_val(pin));
-     return -1;
-   }
-   if (direction > 0) { // output
-     if (value > 0) {
-       write(fd, "high", 4);
-     } else {
-       write(fd, "low", 3);
-     }
-   } else {
-     write(fd, "in", 2);
-   }
-   close(fd);
-   return 0;
+  return GpioBank::Instance().Line(pin)->SetDirection(direction, value);
 }
 
 int ReadInput(uint8_t pin) {
-   int fd = open(gpio_val(pin), O_RDWR);
-   if (!fd) {
-     printf("ReadInput: Failed to open %s\n", gpio_val(pin));
-     return -1;
-   }
-   char buffer;
-   int bytes = read(fd, &buffer, 1);
-   if (bytes == 0) {
-     printf("ReadInput: Failed to read %s\n", gpio_val(pin));
-     close(fd);
-     return -1;
-   }
-   close(fd);
-   if (buffer == '0') {
-     return 0;
-   }
-   return 1;
+  return GpioBank::Instance().Line(pin)->Get();
 }
 
 
 int InitIO() {
-  if (SetDirection(LEFT_WINCH_ENABLE, 1, 0)) return -1;
-  if (SetDirection(RIGHT_WINCH_ENABLE, 1, 0)) return -1;
-  if (SetDirection(LEFT_WINCH_DIRECTION, 1, 0)) return -1;
-  if (SetDirection(RIGHT_WINCH_DIRECTION, 1, 0)) return -1;
-  if (SetDirection(CHILLER_PUMP, 1, 1)) return -1;
-  if (SetDirection(VALVE_ENABLE, 1, 1)) return -1;
-  if (SetDirection(CARBOY_VALVE, 1, 1)) return -1;
-  if (SetDirection(CHILLER_VALVE, 1, 1)) return -1;
-  if (SetDirection(KETTLE_VALVE, 1, 1)) return -1;
+  // The relays and the winches are output groups, which use the character
+  // device when there is one, so their pins aren't exported.  The winch
+  // outputs are set up (off) by WinchController.
+  if (InitValves()) return -1;
   if (SetDirection(RIGHT_SLIDE_SWITCH, 0)) return -1;
   if (SetDirection(LEFT_SLIDE_SWITCH, 0)) return -1;
   if (SetDirection(TOP_SWITCH, 0)) return -1;
-  if (SetDirection(SCALE_DATA, 0)) return -1;
-  if (SetDirection(SCALE_SCLK, 1, 0)) return -1;
+  // The scale pins are set up by OpenHx711Lines, through the character
+  // device when there is one.
   // SetFlow(NO_PATH);
   return 0;
 }
+
+// Reads a single line from a small sysfs attribute file.
+static std::string ReadSysfsAttribute(const std::string &path) {
+  char buffer[64];
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return "";
+  }
+  int bytes = read(fd, buffer, sizeof(buffer) - 1);
+  close(fd);
+  if (bytes <= 0) {
+    return "";
+  }
+  buffer[bytes] = '\0';
+  std::string ret(buffer);
+  size_t pos = ret.find_last_not_of("\n");
+  ret.erase(pos == std::string::npos ? 0 : pos + 1);
+  return ret;
+}
+
+// The sysfs gpiochip directories are named after the base pin number, not
+// the /dev/gpiochipN index, so we match the two up by the chip label.
+int LocateGpioLine(uint8_t pin, std::string *chip_path, uint32_t *offset,
+                   const std::string &sysfs_root) {
+  DIR *dir = opendir(sysfs_root.c_str());
+  if (!dir) {
+    printf("LocateGpioLine: Failed to open %s\n", sysfs_root.c_str());
+    return -1;
+  }
+  std::string label;
+  int base = -1;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (strncmp(entry->d_name, "gpiochip", 8) != 0) continue;
+    std::string chip_dir = sysfs_root + "/" + entry->d_name;
+    int chip_base = atoi(ReadSysfsAttribute(chip_dir + "/base").c_str());
+    int ngpio = atoi(ReadSysfsAttribute(chip_dir + "/ngpio").c_str());
+    if (pin >= chip_base && pin < chip_base + ngpio) {
+      label = ReadSysfsAttribute(chip_dir + "/label");
+      base = chip_base;
+      break;
+    }
+  }
+  closedir(dir);
+  if (base < 0) {
+    printf("LocateGpioLine: No gpiochip found for pin %u\n", pin);
+    return -1;
+  }
+  for (int i = 0; i < 16; ++i) {
+    char dev_path[32];
+    snprintf(dev_path, sizeof(dev_path), "/dev/gpiochip%d", i);
+    int fd = open(dev_path, O_RDONLY);
+    if (fd < 0) continue;
+    struct gpiochip_info info;
+    memset(&info, 0, sizeof(info));
+    int ret = ioctl(fd, GPIO_GET_CHIPINFO_IOCTL, &info);
+    close(fd);
+    if (ret < 0) continue;
+    if (label == info.label) {
+      *chip_path = dev_path;
+      *offset = pin - base;
+      return 0;
+    }
+  }
+  printf("LocateGpioLine: No character device for chip '%s'\n", label.c_str());
+  return -1;
+}
@@ -40,6 +40,10 @@
 
 std::string gpio_val_path(uint8_t pin);
 
+// These functions operate on the lines of GpioBank::Instance(), so each
+// pin is only opened once.  Code that checks a pin often should hold on to
+// the GpioLine instead.
+
 // Set an output pin to high (1) or low (0)
 // Returns -1 if the operation could not be accomplished.
 // Usually this is because of permissions.
@@ -66,4 +70,10 @@ int ReadInput(uint8_t pin);
 
 int InitIO();
 
-int64_t GetTimeMsec();
+// Finds the GPIO character device and line offset that correspond to
+// a (sysfs numbered) pin, so the same pin defines can be used with
+// /dev/gpiochipN.  The chips are looked up under |sysfs_root|.  Fills
+// |chip_path| and |offset|.
+// Returns -1 if no chip claims the pin.
+int LocateGpioLine(uint8_t pin, std::string *chip_path, uint32_t *offset,
+                   const std::string &sysfs_root = "/sys/class/gpio");
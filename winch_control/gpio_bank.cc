@@ -0,0 +1,237 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "gpio_bank.h"
+#include "gpio.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+GpioLine::~GpioLine() {
+  if (value_fd_ >= 0) close(value_fd_);
+  if (direction_fd_ >= 0) close(direction_fd_);
+}
+
+int GpioLine::Open() {
+  if (value_fd_.load(std::memory_order_acquire) >= 0) return 0;
+  std::lock_guard<std::mutex> lock(open_lock_);
+  if (value_fd_.load(std::memory_order_relaxed) >= 0) return 0;
+  std::string value_path = pin_dir_ + "/value";
+  int value_fd = open(value_path.c_str(), O_RDWR);
+  if (value_fd < 0) {
+    printf("Failed to open %s\n", value_path.c_str());
+    return -1;
+  }
+  std::string direction_path = pin_dir_ + "/direction";
+  int direction_fd = open(direction_path.c_str(), O_RDWR);
+  if (direction_fd < 0) {
+    printf("Failed to open %s\n", direction_path.c_str());
+    close(value_fd);
+    return -1;
+  }
+  direction_fd_ = direction_fd;
+  value_fd_.store(value_fd, std::memory_order_release);
+  return 0;
+}
+
+int GpioLine::Set(uint8_t value) {
+  if (Open()) return -1;
+  if (pwrite(value_fd_, value ? "1" : "0", 1, 0) != 1) {
+    printf("Failed to set gpio%u: %s\n", pin_, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+int GpioLine::Get() {
+  char buffer;
+  if (Open() || pread(value_fd_, &buffer, 1, 0) != 1) {
+    printf("ReadInput: Failed to read gpio%u\n", pin_);
+    return -1;
+  }
+  return buffer == '0' ? 0 : 1;
+}
+
+int GpioLine::WriteDirection(const char *direction) {
+  if (Open()) return -1;
+  int length = strlen(direction);
+  if (pwrite(direction_fd_, direction, length, 0) != length) {
+    printf("Failed to set direction of gpio%u: %s\n", pin_, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+int GpioLine::SetDirection(uint8_t direction, uint8_t value) {
+  if (direction > 0) { // output
+    return WriteDirection(value > 0 ? "high" : "low");
+  }
+  return WriteDirection("in");
+}
+
+int GpioLine::SetOpenDrain(uint8_t value) {
+  return WriteDirection(value ? "low" : "in");
+}
+
+GpioBank::GpioBank(const char *sysfs_root) : root_(sysfs_root) {
+  for (int i = 0; i < kMaxPins; ++i) {
+    lines_[i] = nullptr;
+  }
+}
+
+GpioBank::~GpioBank() {
+  for (int i = 0; i < kMaxPins; ++i) {
+    delete lines_[i].load();
+  }
+}
+
+GpioBank &GpioBank::Instance() {
+  static GpioBank bank;
+  return bank;
+}
+
+GpioLine *GpioBank::Line(uint8_t pin) {
+  GpioLine *line = lines_[pin].load(std::memory_order_acquire);
+  if (line) return line;
+  std::lock_guard<std::mutex> lock(open_lock_);
+  line = lines_[pin].load(std::memory_order_relaxed);
+  if (line) return line;
+  char pin_dir[64];
+  snprintf(pin_dir, sizeof(pin_dir), "%s/gpio%u", root_.c_str(), pin);
+  line = new GpioLine(pin_dir, pin);
+  line->Open();
+  lines_[pin].store(line, std::memory_order_release);
+  return line;
+}
+
+GpioOutputGroup::Transaction &GpioOutputGroup::Transaction::Set(uint8_t pin, uint8_t value) {
+  for (size_t i = 0; i < group_->pins_.size(); ++i) {
+    if (group_->pins_[i] == pin) {
+      values_[i] = value ? 1 : 0;
+      for (int j = 0; j < num_set_; ++j) {
+        if (order_[j] == (int)i) return *this;
+      }
+      order_[num_set_++] = i;
+      return *this;
+    }
+  }
+  printf("GpioOutputGroup: pin %u is not in the group\n", pin);
+  bad_pin_ = true;
+  return *this;
+}
+
+int GpioOutputGroup::Transaction::Commit() {
+  if (bad_pin_) return -1;
+  return group_->Apply(*this);
+}
+
+GpioOutputGroup::GpioOutputGroup(std::initializer_list<uint8_t> pins,
+                                 uint8_t initial_value, GpioBank *bank)
+  : pins_(pins), bank_(bank) {
+  if (pins_.size() > kMaxLines) {
+    printf("GpioOutputGroup: too many pins (%zu)\n", pins_.size());
+    pins_.resize(kMaxLines);
+  }
+  for (int i = 0; i < kMaxLines; ++i) {
+    current_[i] = initial_value ? 1 : 0;
+  }
+}
+
+GpioOutputGroup::~GpioOutputGroup() {
+  if (handle_fd_ >= 0) close(handle_fd_);
+}
+
+int GpioOutputGroup::OpenCharacterDevice() {
+  std::string chip_path;
+  struct gpiohandle_request req;
+  memset(&req, 0, sizeof(req));
+  for (size_t i = 0; i < pins_.size(); ++i) {
+    std::string line_chip;
+    // Through the bank's root, so a test bank never finds the real chips.
+    if (LocateGpioLine(pins_[i], &line_chip, &req.lineoffsets[i], bank_->root())) {
+      return -1;
+    }
+    if (i == 0) chip_path = line_chip;
+    // A handle can only hold lines from one chip
+    if (line_chip != chip_path) return -1;
+    req.default_values[i] = current_[i];
+  }
+  req.lines = pins_.size();
+  req.flags = GPIOHANDLE_REQUEST_OUTPUT;
+  strncpy(req.consumer_label, "brewhouse", sizeof(req.consumer_label) - 1);
+  int chip_fd = open(chip_path.c_str(), O_RDONLY);
+  if (chip_fd < 0) return -1;
+  int ret = ioctl(chip_fd, GPIO_GET_LINEHANDLE_IOCTL, &req);
+  close(chip_fd);
+  if (ret < 0) {
+    // Usually EBUSY, because the pins are exported through sysfs
+    printf("GpioOutputGroup: Failed to request lines from %s: %s\n",
+           chip_path.c_str(), strerror(errno));
+    return -1;
+  }
+  handle_fd_ = req.fd;
+  return 0;
+}
+
+int GpioOutputGroup::Open() {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (OpenCharacterDevice() == 0) {
+    return 0;
+  }
+  // Callers count on the pins changing together, so don't let this go
+  // unnoticed.
+  std::string pin_list;
+  for (uint8_t pin : pins_) pin_list += " " + std::to_string(pin);
+  printf("GpioOutputGroup: pins%s are not atomic; they will be set one at a "
+         "time through sysfs\n", pin_list.c_str());
+  lines_.clear();
+  for (size_t i = 0; i < pins_.size(); ++i) {
+    GpioLine *line = bank_->Line(pins_[i]);
+    if (line->SetDirection(1, current_[i])) {
+      printf("GpioOutputGroup: Failed to set GPIO direction\n");
+      return -1;
+    }
+    lines_.push_back(line);
+  }
+  return 0;
+}
+
+int GpioOutputGroup::Apply(const Transaction &transaction) {
+  std::lock_guard<std::mutex> lock(lock_);
+  uint8_t next[kMaxLines];
+  memcpy(next, current_, sizeof(next));
+  for (int i = 0; i < transaction.num_set_; ++i) {
+    int index = transaction.order_[i];
+    next[index] = transaction.values_[index];
+  }
+  if (handle_fd_ >= 0) {
+    struct gpiohandle_data data;
+    memset(&data, 0, sizeof(data));
+    memcpy(data.values, next, pins_.size());
+    if (ioctl(handle_fd_, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &data) < 0) {
+      printf("GpioOutputGroup: Failed to set lines: %s\n", strerror(errno));
+      return -1;
+    }
+    memcpy(current_, next, sizeof(current_));
+    return 0;
+  }
+  if (lines_.size() != pins_.size()) {
+    printf("GpioOutputGroup: lines were not opened\n");
+    return -1;
+  }
+  // Fallback: write the lines in the order they were set.  Lines are written
+  // even if we think they already have the value, since other code may
+  // have changed them through the bank.
+  for (int i = 0; i < transaction.num_set_; ++i) {
+    int index = transaction.order_[i];
+    if (lines_[index]->Set(next[index])) return -1;
+    current_[index] = next[index];
+  }
+  return 0;
+}
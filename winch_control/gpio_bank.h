@@ -0,0 +1,140 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <atomic>
+#include <initializer_list>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// A single sysfs gpio pin.  The value and direction files are opened once,
+// and then read with pread / written with pwrite at offset 0, so a check of
+// an input is one syscall, and there is no shared file position to fight
+// over.  All functions are safe to call from multiple threads.
+// Functions return -1 if the operation could not be accomplished.
+class GpioLine {
+ public:
+  GpioLine(const std::string &pin_dir, uint8_t pin)
+    : pin_dir_(pin_dir), pin_(pin) {}
+  ~GpioLine();
+
+  // Opens the value and direction files, if they aren't open.  The other
+  // functions call it, so a pin that is exported late still works.
+  int Open();
+
+  // Set an output to high (1) or low (0)
+  int Set(uint8_t value);
+
+  // Return the value (1 or 0) of the pin.
+  int Get();
+
+  // Set the direction (in/out) of the pin, and optionally the value.
+  // setting direction and value is done as one operation, to avoid
+  // undesireable states at startup.
+  int SetDirection(uint8_t direction, uint8_t value = 0);
+
+  // value=1: the pin is output, value 0
+  // value=0: the pin is input, with weak pullup
+  int SetOpenDrain(uint8_t value);
+
+  uint8_t pin() const { return pin_; }
+
+ private:
+  int WriteDirection(const char *direction);
+  std::string pin_dir_;
+  uint8_t pin_;
+  std::mutex open_lock_;
+  // direction_fd_ is set before value_fd_, so once value_fd_ is open,
+  // both are.
+  std::atomic<int> value_fd_{-1};
+  int direction_fd_ = -1;
+};
+
+// Owns the GpioLines for the whole board.  Lines are opened the first time
+// they are asked for, and stay open until the bank is destroyed.
+class GpioBank {
+ public:
+  static constexpr const char *kSysfsRoot = "/sys/class/gpio";
+
+  // |sysfs_root| can be pointed somewhere else for testing.
+  explicit GpioBank(const char *sysfs_root = kSysfsRoot);
+  ~GpioBank();
+
+  // The bank used by the rest of the brewhouse.
+  static GpioBank &Instance();
+
+  const std::string &root() const { return root_; }
+
+  // Returns the line for |pin|, opening it if needed.  Never returns null;
+  // if the pin could not be opened, operations on the line try again, and
+  // return -1 if it still can't be.
+  GpioLine *Line(uint8_t pin);
+
+ private:
+  static constexpr int kMaxPins = 256;
+  std::string root_;
+  std::mutex open_lock_;
+  std::atomic<GpioLine*> lines_[kMaxPins];
+};
+
+// A set of output pins that are changed together.  Where the kernel allows
+// it, the pins are requested as one multi-line handle on the GPIO character
+// device, and a transaction is a single ioctl, so the relays never see a
+// mix of old and new values.  Otherwise (pins on different chips, or
+// already exported through sysfs) it says so, and falls back to the
+// GpioBank lines, written one at a time in the order they were Set.
+//
+// usage:
+//   GpioOutputGroup valves({KETTLE_VALVE, VALVE_ENABLE}, 1);
+//   valves.Open();
+//   valves.Begin().Set(KETTLE_VALVE, 0).Set(VALVE_ENABLE, 0).Commit();
+class GpioOutputGroup {
+ public:
+  static constexpr int kMaxLines = 8;
+
+  class Transaction {
+   public:
+    // Queue |value| for |pin|.  Pins not Set keep their current value.
+    Transaction &Set(uint8_t pin, uint8_t value);
+    // Apply all the queued values. Returns -1 on failure.
+    int Commit();
+
+   private:
+    friend class GpioOutputGroup;
+    explicit Transaction(GpioOutputGroup *group) : group_(group) {}
+    GpioOutputGroup *group_;
+    uint8_t values_[kMaxLines] = {0};
+    // Indices of the lines that were Set, in order.
+    int order_[kMaxLines], num_set_ = 0;
+    bool bad_pin_ = false;
+  };
+
+  // All lines start out at |initial_value| when opened.
+  GpioOutputGroup(std::initializer_list<uint8_t> pins, uint8_t initial_value,
+                  GpioBank *bank = &GpioBank::Instance());
+  ~GpioOutputGroup();
+
+  // Requests the lines as outputs.  Returns -1 if neither the character
+  // device nor sysfs could be used.
+  int Open();
+
+  Transaction Begin() { return Transaction(this); }
+
+  // True if transactions are applied with a single kernel call.
+  bool IsAtomic() const { return handle_fd_ >= 0; }
+
+ private:
+  int OpenCharacterDevice();
+  int Apply(const Transaction &transaction);
+
+  std::vector<uint8_t> pins_;
+  std::vector<GpioLine*> lines_;  // only used for the sysfs fallback
+  GpioBank *bank_;
+  int handle_fd_ = -1;
+  std::mutex lock_;  // protects current_, and keeps commits in order
+  uint8_t current_[kMaxLines];
+};
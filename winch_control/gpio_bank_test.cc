@@ -0,0 +1,135 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "gpio_bank.h"
+#include "gpio.h"
+#include "gtest/gtest.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Builds a fake sysfs gpio tree in a temp directory, since the tests
+// can't count on having real gpios.
+class GpioBankTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    char root[] = "/tmp/gpio_bank_test_XXXXXX";
+    ASSERT_NE(mkdtemp(root), nullptr);
+    root_ = root;
+    for (int pin : {3, 22}) {
+      std::string pin_dir = root_ + "/gpio" + std::to_string(pin);
+      mkdir(pin_dir.c_str(), 0755);
+      WriteFile(pin_dir + "/value", "0\n");
+      WriteFile(pin_dir + "/direction", "in\n");
+    }
+  }
+
+  void TearDown() override {
+    std::string cmd = "rm -rf " + root_;
+    system(cmd.c_str());
+  }
+
+  void WriteFile(const std::string &path, const char *contents) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ASSERT_GE(fd, 0);
+    write(fd, contents, strlen(contents));
+    close(fd);
+  }
+
+  std::string root_;
+};
+
+TEST_F(GpioBankTest, LinesAreOpenedOnce) {
+  GpioBank bank(root_.c_str());
+  GpioLine *line = bank.Line(22);
+  EXPECT_EQ(line, bank.Line(22));
+  EXPECT_EQ(line->pin(), 22);
+  EXPECT_EQ(line->Get(), 0);
+  // Changing the file underneath is seen without reopening
+  WriteFile(root_ + "/gpio22/value", "1\n");
+  EXPECT_EQ(line->Get(), 1);
+}
+
+TEST_F(GpioBankTest, SetThenGet) {
+  GpioBank bank(root_.c_str());
+  GpioLine *line = bank.Line(3);
+  EXPECT_EQ(line->Set(1), 0);
+  EXPECT_EQ(line->Get(), 1);
+  EXPECT_EQ(line->Set(0), 0);
+  EXPECT_EQ(line->Get(), 0);
+}
+
+TEST_F(GpioBankTest, MissingPinFails) {
+  GpioBank bank(root_.c_str());
+  EXPECT_EQ(bank.Line(7)->Get(), -1);
+  EXPECT_EQ(bank.Line(7)->Set(1), -1);
+}
+
+// A pin that wasn't there when it was first asked for is opened once it
+// is, rather than being dead for good.
+TEST_F(GpioBankTest, MissingPinIsRetried) {
+  GpioBank bank(root_.c_str());
+  GpioLine *line = bank.Line(7);
+  EXPECT_EQ(line->Get(), -1);
+  std::string pin_dir = root_ + "/gpio7";
+  mkdir(pin_dir.c_str(), 0755);
+  WriteFile(pin_dir + "/value", "1\n");
+  WriteFile(pin_dir + "/direction", "in\n");
+  EXPECT_EQ(bank.Line(7), line);
+  EXPECT_EQ(line->Get(), 1);
+  EXPECT_EQ(line->SetDirection(1, 0), 0);
+}
+
+TEST_F(GpioBankTest, ConcurrentReaders) {
+  GpioBank bank(root_.c_str());
+  WriteFile(root_ + "/gpio22/value", "1\n");
+  std::vector<std::thread> threads;
+  std::atomic<int> bad_reads(0);
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&bank, &bad_reads]() {
+      for (int i = 0; i < 1000; ++i) {
+        if (bank.Line(22)->Get() != 1) bad_reads++;
+      }
+    });
+  }
+  for (auto &t : threads) t.join();
+  EXPECT_EQ(bad_reads, 0);
+}
+
+TEST_F(GpioBankTest, OutputGroupTransaction) {
+  GpioBank bank(root_.c_str());
+  // The group looks for the chips under the bank's root, so it can't
+  // claim the real pins 3 and 22 on a board that has them.
+  std::string chip;
+  uint32_t offset;
+  EXPECT_EQ(LocateGpioLine(3, &chip, &offset, root_), -1);
+  GpioOutputGroup group({3, 22}, 1, &bank);
+  ASSERT_EQ(group.Open(), 0);
+  // No gpio character device for our fake pins, so this is the fallback
+  EXPECT_FALSE(group.IsAtomic());
+  EXPECT_EQ(group.Begin().Set(3, 1).Set(22, 0).Commit(), 0);
+  EXPECT_EQ(bank.Line(3)->Get(), 1);
+  EXPECT_EQ(bank.Line(22)->Get(), 0);
+  // Lines that are not Set are left alone
+  EXPECT_EQ(group.Begin().Set(3, 0).Commit(), 0);
+  EXPECT_EQ(bank.Line(3)->Get(), 0);
+  EXPECT_EQ(bank.Line(22)->Get(), 0);
+}
+
+TEST_F(GpioBankTest, OutputGroupRejectsUnknownPin) {
+  GpioBank bank(root_.c_str());
+  GpioOutputGroup group({3}, 0, &bank);
+  ASSERT_EQ(group.Open(), 0);
+  EXPECT_EQ(group.Begin().Set(22, 1).Commit(), -1);
+  EXPECT_EQ(bank.Line(22)->Get(), 0);
+}
+
+}  // namespace
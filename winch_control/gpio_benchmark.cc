@@ -0,0 +1,124 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Compares the cost of a limit switch check the old way (open, read, close
+// for every check) against a GpioLine held open and read with pread.
+// The syscalls are counted with the raw_syscalls:sys_enter tracepoint,
+// which needs tracefs mounted and root.  Without it, only the times are
+// shown.
+//
+// usage: gpio_benchmark [sysfs_root] [pin]
+// sysfs_root defaults to /sys/class/gpio, pin to LEFT_SLIDE_SWITCH.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string>
+#include "gpio.h"
+#include "gpio_bank.h"
+#include "monotonic_clock.h"
+
+static constexpr int kIterations = 10000;
+
+// Counts the syscalls this thread makes, while enabled.  Returns -1 if
+// the tracepoint isn't available.
+static int OpenSyscallCounter() {
+  const char *id_paths[] = {
+    "/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+    "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id",
+  };
+  for (const char *id_path : id_paths) {
+    FILE *id_file = fopen(id_path, "r");
+    if (!id_file) continue;
+    unsigned long long id;
+    int found = fscanf(id_file, "%llu", &id);
+    fclose(id_file);
+    if (found != 1) continue;
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_TRACEPOINT;
+    attr.size = sizeof(attr);
+    attr.config = id;
+    attr.sample_period = 1;
+    attr.disabled = 1;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+  }
+  return -1;
+}
+
+// The syscalls made by kIterations calls to |check|, including the one
+// that turns the counter off.  -1 if |check| fails.
+template <class Check>
+static int64_t CountSyscalls(int counter_fd, Check check) {
+  ioctl(counter_fd, PERF_EVENT_IOC_RESET, 0);
+  ioctl(counter_fd, PERF_EVENT_IOC_ENABLE, 0);
+  for (int i = 0; i < kIterations; ++i) {
+    if (check() < 0) return -1;
+  }
+  ioctl(counter_fd, PERF_EVENT_IOC_DISABLE, 0);
+  uint64_t count;
+  if (read(counter_fd, &count, sizeof(count)) != sizeof(count)) return -1;
+  return count;
+}
+
+// Times kIterations calls to |check|, then, if we can, counts their
+// syscalls in a second run, since the counting slows the syscalls down.
+template <class Check>
+static int Measure(const char *name, int counter_fd, Check check) {
+  int64_t start = MonotonicNs();
+  for (int i = 0; i < kIterations; ++i) {
+    if (check() < 0) return -1;
+  }
+  int64_t ns = MonotonicNs() - start;
+  if (counter_fd < 0) {
+    printf("  %-16s %8.0f ns/check\n", name, (double)ns / kIterations);
+    return 0;
+  }
+  // What counting costs with nothing to count.
+  int64_t overhead = CountSyscalls(counter_fd, []() { return 0; });
+  int64_t syscalls = CountSyscalls(counter_fd, check);
+  if (syscalls < 0 || overhead < 0) return -1;
+  printf("  %-16s %6.2f syscalls/check %8.0f ns/check\n", name,
+         (double)(syscalls - overhead) / kIterations, (double)ns / kIterations);
+  return 0;
+}
+
+// The way ReadInput used to work.
+static int ReadInputOpenClose(const std::string &value_path) {
+  int fd = open(value_path.c_str(), O_RDWR);
+  if (fd < 0) return -1;
+  char buffer;
+  int bytes = read(fd, &buffer, 1);
+  close(fd);
+  if (bytes <= 0) return -1;
+  return buffer == '0' ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+  const char *root = argc > 1 ? argv[1] : GpioBank::kSysfsRoot;
+  int pin = argc > 2 ? atoi(argv[2]) : LEFT_SLIDE_SWITCH;
+  std::string value_path = std::string(root) + "/gpio" + std::to_string(pin) + "/value";
+
+  int counter_fd = OpenSyscallCounter();
+  if (counter_fd < 0) {
+    printf("Can't count syscalls (needs root and tracefs): %s\n", strerror(errno));
+  }
+  GpioBank bank(root);
+  GpioLine *line = bank.Line(pin);
+  printf("limit switch check on %s, %d iterations\n", value_path.c_str(), kIterations);
+  int ret = Measure("open/read/close:", counter_fd,
+                    [&]() { return ReadInputOpenClose(value_path); });
+  if (ret == 0) {
+    ret = Measure("GpioLine::Get:", counter_fd, [&]() { return line->Get(); });
+  }
+  if (ret) printf("Failed to read %s\n", value_path.c_str());
+  if (counter_fd >= 0) close(counter_fd);
+  return ret;
+}
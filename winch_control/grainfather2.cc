@@ -4,6 +4,7 @@
 
 #include "gpio.h"
 #include "grainfather2.h"
+#include "monotonic_clock.h"
 #include <utility>
 #include <stdio.h>      // standard input / output functions
 #include <stdlib.h>
@@ -12,45 +13,44 @@
 #include <fcntl.h>      // File control definitions
 #include <errno.h>      // Error number definitions
 #include <termios.h>    // POSIX terminal control definitions
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <mutex>
 
-
+constexpr int64_t GrainfatherSerial::kStateTimeoutNs;
 
 // Gets the latest state.  If |prev_read| == 0,
 // just pulls the value of latest_state_ in a protected fashion.
-// Otherwise, waits until a state is available
+// Otherwise, waits until a state is available, or the link is lost.
 BrewState GrainfatherSerial::GetLatestState(int64_t prev_read) {
-  BrewState current_state;
-  {
-    std::lock_guard<std::mutex> lock(state_mutex_);
-    current_state = latest_state_;
-  }
-  if (current_state.read_time > prev_read) {
+  std::unique_lock<std::mutex> lock(state_mutex_);
+  if (latest_state_.read_time > prev_read) {
     // if latest_state_ has a read time, then it is either what we want,
     // or we tried to read and failed.
-    return current_state;
+    return latest_state_;
     // Otherwise, wait until we get a new reading.
   }
   // Make sure we won't be waiting super long:
-  int64_t current_time = GetTimeMsec();
-  if (prev_read > current_time + 2000) {
+  int64_t current_time = MonotonicNs();
+  if (prev_read > current_time + kStateTimeoutNs) {
     printf("Error: requesting a read time too far in the future!\n");
     return BrewState();
   }
-  do {
-    if (GetTimeMsec() > current_time + 2000) {
-      printf("Not getting new readings!\n");
-      return BrewState();
-    }
-    usleep(5000);
-    {
-      std::lock_guard<std::mutex> lock(state_mutex_);
-      current_state = latest_state_;
-    }
-  } while (current_state.read_time <= prev_read);
+  // The reading thread says as soon as it gives up on the Grainfather, so
+  // we don't have to wait out the timeout once the link is lost.
+  bool got_state = state_cv_.wait_for(lock, std::chrono::nanoseconds(kStateTimeoutNs), [&]() {
+      return latest_state_.read_time > prev_read || link_lost_;
+    });
+  if (!got_state || latest_state_.read_time <= prev_read) {
+    printf("Not getting new readings!\n");
+    return BrewState();
+  }
   // Now, we should have a current reading, even if it is invalid.
-  return current_state;
+  return latest_state_;
 }
 
 // Runs a command, and ensures that is completes successfully.  Blocks until
@@ -74,8 +74,8 @@ int GrainfatherSerial::CommandAndVerify(const char *command, bool (*verify_condi
     printf("Failed to send command '%s'\n", command);
     return -1;
   }
-  int64_t command_time_ms = GetTimeMsec();
-  BrewState next = GetLatestState(command_time_ms);
+  int64_t command_time = MonotonicNs();
+  BrewState next = GetLatestState(command_time);
   // std::cout<<" CommandAndVerify: after state: "<< next.ToString() <<std::endl;
   if (!next.valid) {
     printf("Failed to get another reading from Grainfather.\n");
@@ -191,91 +191,157 @@ int GrainfatherSerial::Init(std::function<void(BrewState)> callback) {
       return ret;
     }
   }
+  wake_fd_ = eventfd(0, EFD_CLOEXEC);
+  timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  if (wake_fd_ < 0 || timer_fd_ < 0) {
+    printf("Failed to make the fds for the reading thread\n");
+    return -1;
+  }
   reading_thread_enabled_ = true;
   reading_thread_ = std::thread(&GrainfatherSerial::ReadStatusThread, this);
 
+  // Waits up to kStateTimeoutNs for the first state.
   BrewState bs = GetLatestState();
   int quit_counter = 0;
   while (!bs.valid) {
-    usleep(300000);
-    bs = GetLatestState();
     quit_counter++;
-    if (quit_counter >= 10) {
-      reading_thread_enabled_ = false;
+    if (bs.read_time == 0 || quit_counter >= 10) {
+      StopReading();
       return -1;
     }
+    usleep(300000);
+    bs = GetLatestState();
   }
   return 0;
 }
 
-GrainfatherSerial::~GrainfatherSerial() {
+void GrainfatherSerial::StopReading() {
   reading_thread_enabled_ = false;
+  if (wake_fd_ >= 0) {
+    uint64_t one = 1;
+    if (write(wake_fd_, &one, sizeof(one)) != sizeof(one)) {
+      printf("Failed to wake the reading thread\n");
+    }
+  }
   if (reading_thread_.joinable()) {
     reading_thread_.join();
   }
 }
 
-// Read status
+GrainfatherSerial::~GrainfatherSerial() {
+  StopReading();
+  if (wake_fd_ >= 0) close(wake_fd_);
+  if (timer_fd_ >= 0) close(timer_fd_);
+  if (fd_ >= 0) close(fd_);
+}
+
+void GrainfatherSerial::OnStatus(const BrewState &bs) {
+  {
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    latest_state_ = bs;
+  }
+  state_cv_.notify_all();
+  if (brew_state_callback_ && !testing_communications_) {
+    brew_state_callback_(bs);
+  }
+}
+
+void GrainfatherSerial::OnLinkHealthChange(bool changed) {
+  if (!changed) return;
+  LinkHealth health = link_health_monitor_.Health();
+  printf("Grainfather link is %s\n", LinkHealthName(health));
+  {
+    // So a GetLatestState() between checking the health and waiting
+    // doesn't miss it.
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    link_health_ = health;
+    link_lost_ = health == LinkHealth::kDisconnected;
+  }
+  state_cv_.notify_all();
+  for (auto &callback : link_health_callbacks_) {
+    callback(health);
+  }
+}
+
+void GrainfatherSerial::SetHealthTimer() {
+  int64_t deadline = link_health_monitor_.Deadline();
+  struct itimerspec spec = {};  // all zero disarms it
+  spec.it_value.tv_sec = deadline / kNsPerSec;
+  spec.it_value.tv_nsec = deadline % kNsPerSec;
+  if (timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr)) {
+    printf("Failed to set the link health timer\n");
+  }
+}
+
+// Read status.  Waits in poll() for bytes from the Grainfather, the link
+// health timer, or wake_fd_ to say we're done, so it never blocks in a
+// read, and stops as soon as it's asked.
 void GrainfatherSerial::ReadStatusThread() {
+  struct pollfd fds[3];
+  fds[0] = {wake_fd_, POLLIN, 0};
+  fds[1] = {timer_fd_, POLLIN, 0};
+  // poll() skips negative fds.  The simulated Grainfather has none.
+  fds[2] = {disable_for_test_ ? -1 : fd_, POLLIN, 0};
+  int64_t retry_time = 0;
+  int64_t timer_deadline = -1;
   while (reading_thread_enabled_) {
+    if (link_health_monitor_.Deadline() != timer_deadline) {
+      timer_deadline = link_health_monitor_.Deadline();
+      SetHealthTimer();
+    }
+    int timeout_ms = -1;
+    if (disable_for_test_) {
+      timeout_ms = kSimulatedPeriodMs;
+    } else if (fds[2].fd < 0) {
+      // Waiting to try reading again.
+      timeout_ms = std::max<int64_t>(0, (retry_time - MonotonicNs()) / kNsPerMs);
+    }
+    int ret = poll(fds, 3, timeout_ms);
+    if (ret < 0) {
+      if (errno == EINTR) continue;
+      printf("Grainfather poll failed: %s\n", strerror(errno));
+      break;
+    }
+    if (fds[0].revents) break;  // StopReading()
+    if (fds[1].revents) {
+      uint64_t expirations;
+      if (read(timer_fd_, &expirations, sizeof(expirations)) < 0) {
+        printf("Failed to read the link health timer\n");
+      }
+      OnLinkHealthChange(link_health_monitor_.Check(MonotonicNs()));
+    }
     if (disable_for_test_) {
-      usleep(300000);
+      if (ret > 0) continue;
       BrewState bs = simulated_grainfather_.ReadState();
       if (bs.valid) {
-        {
-          std::lock_guard<std::mutex> lock(state_mutex_);
-          latest_state_ = bs;
-        }
-        // std::cout<<bs.ToString()<<std::endl;
-        if (brew_state_callback_) {
-          brew_state_callback_(bs);
-        }
+        OnLinkHealthChange(link_health_monitor_.OnFrame(MonotonicNs()));
+        OnStatus(bs);
       }
       continue;
     }
-
-    // Read until we get to the start bit: 'T'
-    int first_byte = '\0';
-    int current_read;
-    do {
-      current_read = read(fd_, &first_byte, 1);
-      if (current_read < 0) {
-        printf("Failed to Read\n");
-        break;
-      }
-    } while (first_byte != (int)kStartChar);
-    if (current_read < 0) {
-      // If we are having read problems, raise flag and keep trying
-      read_error_ = true;
+    if (fds[2].fd < 0) {
+      if (MonotonicNs() >= retry_time) fds[2].fd = fd_;
       continue;
     }
-    char ret[kStatusLength];
-    ret[0] = kStartChar;
-    unsigned chars_read = 1;
-    do {
-      current_read = read(fd_, ret + chars_read, kStatusLength - chars_read);
-      if (current_read < 0) {
-        printf("Failed to Read\n");
-        break;
-      }
-      chars_read += current_read;
-    } while (chars_read < kStatusLength);
-    if (current_read < 0) {
-      // If we are having read problems, raise flag and keep trying
-      read_error_ = true;
+    if (!fds[2].revents) continue;
+    // A closed port is readable, but has nothing to read.
+    if (frames_.Fill(fd_) <= 0) {
+      printf("Failed to Read\n");
+      // If we are having read problems, say so, and keep trying, but not
+      // in a tight loop.
+      OnLinkHealthChange(link_health_monitor_.OnError());
+      fds[2].fd = -1;
+      retry_time = MonotonicNs() + kReadRetryMs * kNsPerMs;
       continue;
     }
-    // Now we have the correct number of chars, aligned correctly.
-    // See if it parses:
-    BrewState bs;
-    if (bs.Load(ret) == 0) {
-      read_error_ = false;
-      {
-      std::lock_guard<std::mutex> lock(state_mutex_);
-      latest_state_ = bs;
-      }
-      if (brew_state_callback_ && !testing_communications_) {
-        brew_state_callback_(bs);
+    // Parse any frames we have.
+    char frame[GrainfatherFrameReader::kFrameLength];
+    while (frames_.Next(frame)) {
+      OnLinkHealthChange(link_health_monitor_.OnFrame(MonotonicNs()));
+      // The segments are where they should be.  See if it parses:
+      BrewState bs;
+      if (bs.Load(std::string(frame, sizeof(frame))) == 0) {
+        OnStatus(bs);
       }
     }
   } // end while
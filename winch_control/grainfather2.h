@@ -6,10 +6,16 @@
 
 #include "gpio.h"
 #include "brew_types.h"
+#include "grainfather_frames.h"
+#include "link_health.h"
 #include "SimulatedGrainfather.h"
+#include "monotonic_clock.h"
+#include <atomic>
+#include <condition_variable>
 #include <utility>
 #include <mutex>
 #include <functional>
+#include <vector>
 
 
 class GrainfatherSerial {
@@ -23,14 +29,37 @@ class GrainfatherSerial {
   static constexpr const char *kQuitSessionString = "F                  ";
   static constexpr const char *kPauseTimerString = "G                  ";
   static constexpr const char *kResumeTimerString = "G                  ";
-  static constexpr char kStartChar = 'T';
-  static constexpr unsigned kStatusLength = 4 * 17;
+  // How long to wait for a new state from the Grainfather.
+  static constexpr int64_t kStateTimeoutNs = 2 * kNsPerSec;
+  // The Grainfather sends its status about this often.
+  static constexpr int64_t kStatusPeriodNs = kNsPerSec;  //TODO: check value
+  // The link is stale once a status is late by half a period, and
+  // disconnected after kStateTimeoutNs.
+  static constexpr int64_t kStaleNs = kStatusPeriodNs * 3 / 2;
+  // How long to wait before reading again after a read fails.
+  static constexpr int kReadRetryMs = 1000;
+  // How often the simulated Grainfather is read.
+  static constexpr int kSimulatedPeriodMs = 300;
   bool reading_thread_enabled_ = false;
   std::thread reading_thread_;
   std::function<void(BrewState)> brew_state_callback_;
   std::mutex state_mutex_;
-  bool read_error_ = false;
-  int fd_;
+  // Notified when latest_state_ or the link health changes.
+  std::condition_variable state_cv_;
+  int fd_ = -1;
+  // Written to stop the reading thread.
+  int wake_fd_ = -1;
+  // Goes off at link_health_monitor_'s deadline.
+  int timer_fd_ = -1;
+  GrainfatherFrameReader frames_;
+  // Only used by the reading thread.
+  LinkHealthMonitor link_health_monitor_{kStaleNs, kStateTimeoutNs};
+  std::atomic<LinkHealth> link_health_{LinkHealth::kDisconnected};
+  // Set when the link goes from up to disconnected, so waiting for a state
+  // can give up.  Before the first frame it hasn't been lost, just not
+  // come up yet.  Guarded by state_mutex_.
+  bool link_lost_ = false;
+  std::vector<std::function<void(LinkHealth)>> link_health_callbacks_;
   bool disable_for_test_ = false;
   bool testing_communications_ = false;  // active during startup check
   SimulatedGrainfather simulated_grainfather_;
@@ -38,6 +67,15 @@ class GrainfatherSerial {
   int Connect(const char *path);
   int SendSerial(std::string to_send);
 
+  // Stores a new state from the Grainfather, and tells everyone.
+  void OnStatus(const BrewState &bs);
+  // Tells everyone if |changed|.
+  void OnLinkHealthChange(bool changed);
+  // Sets timer_fd_ to go off at link_health_monitor_'s deadline.
+  void SetHealthTimer();
+  // Stops the reading thread.  Returns within one poll().
+  void StopReading();
+
   // Runs a command, and ensures that is completes successfully.  Blocks until
   // a reading is performed, so could block up to 2 seconds.
   // returns 0 if the brewstate is valid and the verify condition is true, either
@@ -49,7 +87,8 @@ class GrainfatherSerial {
  public:
   // Gets the latest state.  If |prev_read| == 0,
   // just pulls the value of latest_state_ in a protected fashion.
-  // Otherwise, waits until a state is available
+  // Otherwise, waits until a state read after |prev_read| (MonotonicNs)
+  // is available
   BrewState GetLatestState(int64_t prev_read = 0);
 
   int TurnPumpOn();
@@ -81,12 +120,25 @@ class GrainfatherSerial {
   // Test all the commands and register a callback for brewstate updates
   int Init(std::function<void(BrewState)> callback);
 
+  // |callback| is called on the reading thread when the link to the
+  // Grainfather becomes healthy, stale or disconnected.  A status that is
+  // half a period late makes it stale.  Call before Init().
+  void AddLinkHealthCallback(std::function<void(LinkHealth)> callback) {
+    link_health_callbacks_.push_back(callback);
+  }
+  LinkHealth GetLinkHealth() const { return link_health_; }
+
   // tests all the commands, to make sure they change the state.
   int TestCommands();
 
   // Read status
   void ReadStatusThread();
 
+  // How the status frames have been coming in.
+  int64_t StatusFrames() const { return frames_.Frames(); }
+  int64_t StatusResyncs() const { return frames_.Resyncs(); }
+  int64_t DroppedStatusBytes() const { return frames_.DroppedBytes(); }
+
   void DisableForTest() { disable_for_test_ = true; }
   ~GrainfatherSerial();
 };
@@ -0,0 +1,83 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "grainfather_frames.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+
+constexpr size_t GrainfatherFrameReader::kSegmentLength;
+constexpr size_t GrainfatherFrameReader::kFrameLength;
+constexpr size_t GrainfatherFrameReader::kRingSize;
+
+int GrainfatherFrameReader::Fill(int fd) {
+  if (Size() == kRingSize) {
+    // Full of junk with no frame in it.
+    Drop(kRingSize - kFrameLength);
+  }
+  // Up to the end of the free space, or of the array, whichever is first.
+  size_t start = head_ % kRingSize;
+  size_t space = std::min(kRingSize - Size(), kRingSize - start);
+  ssize_t bytes = read(fd, ring_ + start, space);
+  if (bytes < 0) return -1;
+  head_ += bytes;
+  return bytes;
+}
+
+void GrainfatherFrameReader::Append(const char *data, size_t size) {
+  while (size > 0) {
+    if (Size() == kRingSize) Drop(1);
+    size_t start = head_ % kRingSize;
+    size_t chunk = std::min(size, std::min(kRingSize - Size(), kRingSize - start));
+    memcpy(ring_ + start, data, chunk);
+    head_ += chunk;
+    data += chunk;
+    size -= chunk;
+  }
+}
+
+size_t GrainfatherFrameReader::Find(char c, size_t offset) const {
+  // The bytes after |offset| are in at most two runs in the array.
+  while (offset < Size()) {
+    size_t start = (tail_ + offset) % kRingSize;
+    size_t run = std::min(Size() - offset, kRingSize - start);
+    const char *found = static_cast<const char *>(memchr(ring_ + start, c, run));
+    if (found) return offset + (found - (ring_ + start));
+    offset += run;
+  }
+  return Size();
+}
+
+bool GrainfatherFrameReader::IsFrame(size_t offset) const {
+  return At(offset) == 'T' && At(offset + kSegmentLength) == 'X' &&
+         At(offset + 2 * kSegmentLength) == 'Y' && At(offset + 3 * kSegmentLength) == 'W';
+}
+
+void GrainfatherFrameReader::Drop(size_t count) {
+  if (count == 0) return;
+  tail_ += count;
+  dropped_bytes_ += count;
+  if (!resyncing_) resyncs_++;
+  resyncing_ = true;
+}
+
+bool GrainfatherFrameReader::Next(char frame[kFrameLength]) {
+  size_t start = Find('T', 0);
+  while (start + kFrameLength <= Size()) {
+    if (IsFrame(start)) {
+      Drop(start);
+      for (size_t i = 0; i < kFrameLength; ++i) frame[i] = At(i);
+      tail_ += kFrameLength;
+      resyncing_ = false;
+      frames_++;
+      return true;
+    }
+    // A T in the middle of a frame, or noise.
+    start = Find('T', start + 1);
+  }
+  // Nothing before the last T can start a frame.
+  Drop(std::min(start, Size()));
+  return false;
+}
@@ -0,0 +1,58 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Splits the Grainfather's serial stream into status frames.  A status is
+// four 17 character segments, starting with T, X, Y and W:
+//   T1,1,2,60,ZZZZZZZX19.0,19.1,ZZZZZZY1,1,1,0,0,0,1,0,W0,0,0,1,0,1,ZZZZ
+// Bytes are read in big chunks into a ring, and a frame is only given out
+// once all four segments start where they should, so after noise or a
+// dropped byte we find the next real frame instead of parsing garbage.
+// Only one thread may call Fill, Append and Next.  The counters can be
+// read from any thread.
+class GrainfatherFrameReader {
+ public:
+  static constexpr size_t kSegmentLength = 17;
+  static constexpr size_t kFrameLength = 4 * kSegmentLength;
+
+  // Reads whatever |fd| has, up to the free space in the ring.  Returns
+  // the number of bytes read, or -1 if the read failed.
+  int Fill(int fd);
+  // Adds bytes as if they had been read.  Drops the oldest bytes if they
+  // don't fit.
+  void Append(const char *data, size_t size);
+
+  // Copies the next valid frame to |frame| and returns true, or returns
+  // false if there isn't a whole one yet.  Bytes before it are dropped.
+  bool Next(char frame[kFrameLength]);
+
+  int64_t Frames() const { return frames_; }
+  // Times we had to skip bytes to find the start of a frame.
+  int64_t Resyncs() const { return resyncs_; }
+  int64_t DroppedBytes() const { return dropped_bytes_; }
+
+ private:
+  // Several frames, so a slow reader doesn't lose any.  A power of 2.
+  static constexpr size_t kRingSize = 1024;
+
+  size_t Size() const { return head_ - tail_; }
+  char At(size_t offset) const { return ring_[(tail_ + offset) % kRingSize]; }
+  // Offset of the first |c| at or after |offset|, or Size().
+  size_t Find(char c, size_t offset) const;
+  // If a whole frame starts at |offset|.
+  bool IsFrame(size_t offset) const;
+  void Drop(size_t count);
+
+  char ring_[kRingSize];
+  // Bytes ever added, and ever taken out.
+  size_t head_ = 0, tail_ = 0;
+  // Set when bytes are dropped, so one run of junk is one resync.
+  bool resyncing_ = false;
+  std::atomic<int64_t> frames_{0}, resyncs_{0}, dropped_bytes_{0};
+};
@@ -0,0 +1,99 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "grainfather_frames.h"
+#include "brew_types.h"
+#include "gtest/gtest.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <string>
+
+namespace {
+
+constexpr size_t kFrameLength = GrainfatherFrameReader::kFrameLength;
+
+std::string Frame(double current_temp) {
+  BrewState bs;
+  bs.current_temp = current_temp;
+  bs.target_temp = 66;
+  bs.pump_on = true;
+  return bs.ToString();
+}
+
+// The next frame from |reader| as a BrewState, or an invalid one.
+BrewState NextState(GrainfatherFrameReader *reader) {
+  char frame[kFrameLength];
+  BrewState bs;
+  if (reader->Next(frame)) bs.Load(std::string(frame, kFrameLength));
+  return bs;
+}
+
+TEST(GrainfatherFrameReader, SplitsFrames) {
+  GrainfatherFrameReader reader;
+  std::string stream = Frame(20) + Frame(21) + Frame(22);
+  // A byte at a time, then the rest at once.
+  for (size_t i = 0; i < kFrameLength - 1; ++i) {
+    reader.Append(&stream[i], 1);
+    EXPECT_FALSE(NextState(&reader).valid);
+  }
+  reader.Append(&stream[kFrameLength - 1], stream.size() - kFrameLength + 1);
+  for (double temp : {20.0, 21.0, 22.0}) {
+    BrewState bs = NextState(&reader);
+    ASSERT_TRUE(bs.valid);
+    EXPECT_EQ(bs.current_temp, temp);
+    EXPECT_TRUE(bs.pump_on);
+  }
+  EXPECT_FALSE(NextState(&reader).valid);
+  EXPECT_EQ(reader.Frames(), 3);
+  EXPECT_EQ(reader.Resyncs(), 0);
+  EXPECT_EQ(reader.DroppedBytes(), 0);
+}
+
+TEST(GrainfatherFrameReader, Resyncs) {
+  GrainfatherFrameReader reader;
+  std::string frame = Frame(20);
+  // Starts mid frame, then noise with T's in it, then a frame missing a
+  // byte.
+  std::string broken = frame;
+  broken.erase(20, 1);
+  std::string stream = frame.substr(30) + "\x01T\xffT" + Frame(21) + broken + Frame(22);
+  reader.Append(stream.data(), stream.size());
+  EXPECT_EQ(NextState(&reader).current_temp, 21);
+  EXPECT_EQ(NextState(&reader).current_temp, 22);
+  EXPECT_FALSE(NextState(&reader).valid);
+  EXPECT_EQ(reader.Frames(), 2);
+  EXPECT_EQ(reader.Resyncs(), 2);
+  EXPECT_EQ(reader.DroppedBytes(), (int64_t)(kFrameLength - 30 + 4 + kFrameLength - 1));
+}
+
+TEST(GrainfatherFrameReader, WrapsAround) {
+  GrainfatherFrameReader reader;
+  // More than the ring holds, a frame at a time, so the frames end up
+  // split across the end of the ring.
+  std::string frame = Frame(20);
+  for (int i = 0; i < 100; ++i) {
+    reader.Append(frame.data(), 3);
+    reader.Append(frame.data() + 3, frame.size() - 3);
+    ASSERT_EQ(NextState(&reader).current_temp, 20) << "frame " << i;
+  }
+  EXPECT_EQ(reader.Resyncs(), 0);
+}
+
+TEST(GrainfatherFrameReader, Fills) {
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  std::string stream = "junk" + Frame(20) + Frame(21);
+  ASSERT_EQ(write(fds[1], stream.data(), stream.size()), (ssize_t)stream.size());
+  GrainfatherFrameReader reader;
+  EXPECT_EQ(reader.Fill(fds[0]), (int)stream.size());
+  EXPECT_EQ(NextState(&reader).current_temp, 20);
+  EXPECT_EQ(NextState(&reader).current_temp, 21);
+  EXPECT_EQ(reader.DroppedBytes(), 4);
+  close(fds[0]);
+  close(fds[1]);
+  EXPECT_EQ(reader.Fill(fds[0]), -1);
+}
+
+}  // namespace
@@ -0,0 +1,41 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+// A cheap histogram for timing measurements.  Bucket i counts values in
+// [2^(i-1), 2^i), with bucket 0 holding values < 1, and the last bucket
+// holding everything too big for the others.
+struct Log2Histogram {
+  static constexpr int kBuckets = 20;
+  int64_t counts[kBuckets] = {0};
+  int64_t total = 0;
+  int64_t max = 0;
+
+  void Add(int64_t value) {
+    int bucket = 0;
+    while (bucket < kBuckets - 1 && value >= (1LL << bucket)) {
+      bucket++;
+    }
+    counts[bucket]++;
+    total++;
+    if (value > max) max = value;
+  }
+
+  // Prints the non-empty buckets, labeled by their upper bound.
+  void Print(const char *name, const char *units) const {
+    printf("%s (%ld samples, max %ld %s):\n", name, total, max, units);
+    for (int i = 0; i < kBuckets; ++i) {
+      if (counts[i] == 0) continue;
+      if (i == kBuckets - 1) {
+        printf("  >= %8lld %s: %ld\n", 1LL << (i - 1), units, counts[i]);
+      } else {
+        printf("  <  %8lld %s: %ld\n", 1LL << i, units, counts[i]);
+      }
+    }
+  }
+};
@@ -0,0 +1,467 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "hx711_lines.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include <string>
+#include "gpio.h"
+
+// ---------------------------------------------------------------------
+//  Sysfs
+// ---------------------------------------------------------------------
+
+int SysfsHx711Lines::Init() {
+  data_.clear();
+  for (uint8_t pin : data_pins_) {
+    data_.push_back(bank_->Line(pin));
+    if (data_.back()->SetDirection(0)) {
+      printf("Failed to set GPIO direction SysfsHx711Lines::Init\n");
+      return -1;
+    }
+  }
+  sclk_ = bank_->Line(sclk_pin_);
+  if (sclk_->SetDirection(1, 0)) {
+    printf("Failed to set GPIO direction SysfsHx711Lines::Init\n");
+    return -1;
+  }
+  // Try to read and write from the buffers:
+  if (ReadData() < 0) {
+    printf("Failed to read during SysfsHx711Lines::Init\n");
+    return -1;
+  }
+  if (SetClock(0) < 0) {
+    printf("Failed to write during SysfsHx711Lines::Init\n");
+    return -1;
+  }
+  return 0;
+}
+
+// Every chip has to be ready.  They all run off the same clock
+// frequency, but aren't synchronized, so this can take up to a
+// conversion period.
+int SysfsHx711Lines::ReadAllLow() {
+  int value = 0;
+  for (GpioLine *line : data_) {
+    int line_value = line->Get();
+    if (line_value < 0) {
+      return -1;
+    }
+    value |= line_value;
+  }
+  return value;
+}
+
+int SysfsHx711Lines::WaitForDataReady(int timeout_ms) {
+  // Nothing will happen before the expected time, so sleep until just
+  // before it, then poll as usual.
+  int64_t wake = expected_ready_ns_ - kWakeEarlyNs;
+  expected_ready_ns_ = 0;
+  int64_t now = MonotonicNs();
+  if (wake > now && wake < now + timeout_ms * kNsPerMs) {
+    timespec ts = {(time_t)(wake / kNsPerSec), (long)(wake % kNsPerSec)};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {
+    }
+    wakeups_++;
+  }
+  int valid_count = 0;
+  int num_reads = 0;
+  int64_t first_low = 0;
+  do {
+    // The time between conversions is 100ms (at 10 hz), and data won't come
+    // until we strobe the clock, so we can poll pretty infrequently...
+    usleep(1000);
+    wakeups_++;
+    num_reads++;
+    int value = ReadAllLow();
+    if (value < 0) {
+      return -1;
+    }
+    if (value == 0) {  // the signal is active low, so we count the # of 0 readings
+      if (valid_count == 0) {
+        first_low = MonotonicNs();
+      }
+      valid_count++;
+      num_reads = 0;
+    } else {
+      valid_count = 0;
+    }
+    if (num_reads > timeout_ms) {
+      return 0;
+    }
+  } while (valid_count < kReqNumLowReadings);
+  ready_time_ns_ = first_low;
+  return 1;
+}
+
+int SysfsHx711Lines::SetClock(uint8_t value) {
+  return sclk_->Set(value);
+}
+
+int SysfsHx711Lines::ReadData() {
+  return data_[0]->Get();
+}
+
+// Sysfs has a value file per line, so this is a read per cell for every
+// bit.  The character device can read them all at once.
+int SysfsHx711Lines::ReadDataLines(uint8_t *values) {
+  for (size_t i = 0; i < data_.size(); ++i) {
+    int value = data_[i]->Get();
+    if (value < 0) return -1;
+    values[i] = value;
+  }
+  return 0;
+}
+
+// ---------------------------------------------------------------------
+//  Character device
+// ---------------------------------------------------------------------
+
+ChardevHx711Lines::~ChardevHx711Lines() {
+  if (sclk_fd_ >= 0) close(sclk_fd_);
+  if (lines_fd_ >= 0) close(lines_fd_);
+  for (int fd : event_fds_) close(fd);
+}
+
+int ChardevHx711Lines::RequestDataLine(uint8_t pin, const std::string &chip,
+                                       uint32_t offset) {
+  int chip_fd = open(chip.c_str(), O_RDONLY);
+  if (chip_fd < 0) {
+    printf("Failed to open %s\n", chip.c_str());
+    return -1;
+  }
+  struct gpioevent_request event_req;
+  memset(&event_req, 0, sizeof(event_req));
+  event_req.lineoffset = offset;
+  event_req.handleflags = GPIOHANDLE_REQUEST_INPUT;
+  event_req.eventflags = GPIOEVENT_REQUEST_FALLING_EDGE;
+  strncpy(event_req.consumer_label, "hx711-data", sizeof(event_req.consumer_label) - 1);
+  int ret = ioctl(chip_fd, GPIO_GET_LINEEVENT_IOCTL, &event_req);
+  close(chip_fd);
+  if (ret < 0) {
+    printf("Failed to request events for pin %u: %s\n", pin, strerror(errno));
+    return -1;
+  }
+  event_fds_.push_back(event_req.fd);
+  return 0;
+}
+
+#ifdef GPIO_V2_GET_LINE_IOCTL
+int ChardevHx711Lines::RequestDataLines(const std::string &chip) {
+  if (data_offsets_.size() > GPIO_V2_LINES_MAX) {
+    return -1;
+  }
+  int chip_fd = open(chip.c_str(), O_RDONLY);
+  if (chip_fd < 0) {
+    return -1;
+  }
+  struct gpio_v2_line_request req;
+  memset(&req, 0, sizeof(req));
+  for (size_t i = 0; i < data_offsets_.size(); ++i) {
+    req.offsets[i] = data_offsets_[i];
+  }
+  req.num_lines = data_offsets_.size();
+  req.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_FALLING;
+  strncpy(req.consumer, "hx711-data", sizeof(req.consumer) - 1);
+  int ret = ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &req);
+  close(chip_fd);
+  if (ret < 0) {
+    return -1;
+  }
+  lines_fd_ = req.fd;
+  return 0;
+}
+
+int ChardevHx711Lines::ReadLineBits(uint64_t mask, uint64_t *bits) {
+  struct gpio_v2_line_values values;
+  memset(&values, 0, sizeof(values));
+  values.mask = mask;
+  if (ioctl(lines_fd_, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0) {
+    return -1;
+  }
+  *bits = values.bits;
+  return 0;
+}
+
+int ChardevHx711Lines::ReadEdges() {
+  struct pollfd pfd = {lines_fd_, POLLIN | POLLPRI, 0};
+  struct gpio_v2_line_event events[16];
+  while (poll(&pfd, 1, 0) > 0) {
+    ssize_t num_read = read(lines_fd_, events, sizeof(events));
+    if (num_read < (ssize_t)sizeof(events[0])) {
+      return -1;
+    }
+    for (size_t e = 0; e < num_read / sizeof(events[0]); ++e) {
+      for (size_t i = 0; i < data_offsets_.size(); ++i) {
+        if (data_offsets_[i] == events[e].offset) {
+          edge_ns_[i] = EventTime(events[e].timestamp_ns);
+        }
+      }
+    }
+  }
+  return 0;
+}
+#else
+// The kernel headers are too old for requesting several lines with events.
+int ChardevHx711Lines::RequestDataLines(const std::string &chip) {
+  return -1;
+}
+int ChardevHx711Lines::ReadLineBits(uint64_t mask, uint64_t *bits) {
+  return -1;
+}
+int ChardevHx711Lines::ReadEdges() {
+  return -1;
+}
+#endif
+
+int ChardevHx711Lines::Init() {
+  std::string sclk_chip;
+  uint32_t sclk_offset;
+  if (LocateGpioLine(sclk_pin_, &sclk_chip, &sclk_offset)) {
+    return -1;
+  }
+  std::vector<std::string> data_chips;
+  data_offsets_.clear();
+  for (uint8_t data_pin : data_pins_) {
+    std::string data_chip;
+    uint32_t data_offset;
+    if (LocateGpioLine(data_pin, &data_chip, &data_offset)) {
+      return -1;
+    }
+    data_chips.push_back(data_chip);
+    data_offsets_.push_back(data_offset);
+  }
+  bool one_chip = true;
+  for (const std::string &chip : data_chips) {
+    if (chip != data_chips[0]) one_chip = false;
+  }
+  // Older kernels can't put several lines with events in one request,
+  // so fall back to one request per line.
+  if (!one_chip || RequestDataLines(data_chips[0])) {
+    if (!one_chip) {
+      printf("The HX711 data pins are on different chips, reading them one at a time.\n");
+    }
+    for (size_t i = 0; i < data_pins_.size(); ++i) {
+      if (RequestDataLine(data_pins_[i], data_chips[i], data_offsets_[i])) {
+        return -1;
+      }
+    }
+  }
+  edge_ns_.assign(data_pins_.size(), 0);
+
+  int sclk_chip_fd = open(sclk_chip.c_str(), O_RDONLY);
+  if (sclk_chip_fd < 0) {
+    printf("Failed to open %s\n", sclk_chip.c_str());
+    return -1;
+  }
+  struct gpiohandle_request handle_req;
+  memset(&handle_req, 0, sizeof(handle_req));
+  handle_req.lineoffsets[0] = sclk_offset;
+  handle_req.lines = 1;
+  handle_req.flags = GPIOHANDLE_REQUEST_OUTPUT;
+  handle_req.default_values[0] = 0;
+  strncpy(handle_req.consumer_label, "hx711-sclk", sizeof(handle_req.consumer_label) - 1);
+  int ret = ioctl(sclk_chip_fd, GPIO_GET_LINEHANDLE_IOCTL, &handle_req);
+  close(sclk_chip_fd);
+  if (ret < 0) {
+    printf("Failed to request output for pin %u: %s\n", sclk_pin_, strerror(errno));
+    return -1;
+  }
+  sclk_fd_ = handle_req.fd;
+
+  if (ReadData() < 0) {
+    printf("Failed to read during ChardevHx711Lines::Init\n");
+    return -1;
+  }
+  return 0;
+}
+
+int64_t ChardevHx711Lines::EventTime(uint64_t timestamp_ns) {
+  int64_t now = MonotonicNs();
+  int64_t age = now - (int64_t)timestamp_ns;
+  if (age < 0 || age > kNsPerSec) {
+    return now;
+  }
+  return timestamp_ns;
+}
+
+// The falling edge may have happened before we started waiting (DATA stays
+// low until we clock the bits out), and clocking out the bits generates
+// falling edges of its own.  So the event only wakes us up - the level of
+// the line is what decides if data is ready.
+int ChardevHx711Lines::WaitForLineLow(int event_fd, int timeout_ms, int64_t *edge_ns) {
+  int value = ReadLine(event_fd);
+  if (value < 0) {
+    return -1;
+  }
+  struct gpioevent_data event;
+  if (value == 0) {
+    // Already low.  The last queued edge is the one that said so.
+    *edge_ns = MonotonicNs();
+    struct pollfd pfd = {event_fd, POLLIN | POLLPRI, 0};
+    while (poll(&pfd, 1, 0) > 0 &&
+           read(event_fd, &event, sizeof(event)) == sizeof(event)) {
+      *edge_ns = EventTime(event.timestamp);
+    }
+    return 1;
+  }
+  struct pollfd pfd;
+  pfd.fd = event_fd;
+  pfd.events = POLLIN | POLLPRI;
+  // Throw away the edges from clocking out the last reading, so they
+  // don't wake us up.
+  while (poll(&pfd, 1, 0) > 0 &&
+         read(event_fd, &event, sizeof(event)) == sizeof(event)) {
+  }
+  value = ReadLine(event_fd);
+  if (value <= 0) {
+    *edge_ns = MonotonicNs();
+    return value < 0 ? -1 : 1;
+  }
+  while (true) {
+    int ret = poll(&pfd, 1, timeout_ms);
+    wakeups_++;
+    if (ret < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    if (ret == 0) {
+      return 0;
+    }
+    if (read(event_fd, &event, sizeof(event)) != sizeof(event)) {
+      return -1;
+    }
+    value = ReadLine(event_fd);
+    if (value <= 0) {
+      *edge_ns = EventTime(event.timestamp);
+      return value < 0 ? -1 : 1;
+    }
+    // Stale edge from the last read, keep waiting.
+  }
+}
+
+// Like WaitForLineLow, the edges only wake us up, and the levels decide.
+// An edge on a line that has since gone high was from clocking out the
+// last reading, so it is forgotten.
+int ChardevHx711Lines::WaitForAllLow(int timeout_ms) {
+  int64_t deadline = MonotonicNs() + timeout_ms * kNsPerMs;
+  uint64_t mask = AllLinesMask();
+  struct pollfd pfd = {lines_fd_, POLLIN | POLLPRI, 0};
+  while (true) {
+    uint64_t bits;
+    if (ReadEdges() || ReadLineBits(mask, &bits)) {
+      return -1;
+    }
+    if ((bits & mask) == 0) {
+      // Stamped with the last chip to become ready.
+      int64_t last_edge = 0;
+      for (int64_t edge : edge_ns_) {
+        if (edge == 0) edge = MonotonicNs();  // went low before we saw it
+        if (edge > last_edge) last_edge = edge;
+      }
+      ready_time_ns_ = last_edge;
+      return 1;
+    }
+    for (size_t i = 0; i < edge_ns_.size(); ++i) {
+      if (bits & (1ULL << i)) edge_ns_[i] = 0;
+    }
+    int remaining = (deadline - MonotonicNs()) / kNsPerMs;
+    int ret = poll(&pfd, 1, remaining > 0 ? remaining : 0);
+    wakeups_++;
+    if (ret < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    if (ret == 0) {
+      return 0;
+    }
+  }
+}
+
+// The chips aren't synchronized, so wait for each in turn.  Once a chip is
+// ready, it holds DATA low until it is clocked out.
+// The reading is stamped with the last chip to become ready.
+int ChardevHx711Lines::WaitForDataReady(int timeout_ms) {
+  if (lines_fd_ >= 0) {
+    return WaitForAllLow(timeout_ms);
+  }
+  int64_t deadline = MonotonicNs() + timeout_ms * kNsPerMs;
+  int64_t last_edge = 0;
+  for (int fd : event_fds_) {
+    int remaining = (deadline - MonotonicNs()) / kNsPerMs;
+    int64_t edge = 0;
+    int ret = WaitForLineLow(fd, remaining > 0 ? remaining : 0, &edge);
+    if (ret <= 0) {
+      return ret;
+    }
+    if (edge > last_edge) last_edge = edge;
+  }
+  ready_time_ns_ = last_edge;
+  return 1;
+}
+
+int ChardevHx711Lines::SetClock(uint8_t value) {
+  struct gpiohandle_data data;
+  memset(&data, 0, sizeof(data));
+  data.values[0] = value ? 1 : 0;
+  return ioctl(sclk_fd_, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &data) < 0 ? -1 : 0;
+}
+
+int ChardevHx711Lines::ReadLine(int event_fd) {
+  struct gpiohandle_data data;
+  memset(&data, 0, sizeof(data));
+  if (ioctl(event_fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data) < 0) {
+    return -1;
+  }
+  return data.values[0] ? 1 : 0;
+}
+
+int ChardevHx711Lines::ReadData() {
+  if (lines_fd_ >= 0) {
+    uint64_t bits;
+    if (ReadLineBits(1, &bits)) return -1;
+    return bits & 1;
+  }
+  return ReadLine(event_fds_[0]);
+}
+
+int ChardevHx711Lines::ReadDataLines(uint8_t *values) {
+  if (lines_fd_ >= 0) {
+    uint64_t bits;
+    uint64_t mask = AllLinesMask();
+    if (ReadLineBits(mask, &bits)) return -1;
+    for (size_t i = 0; i < data_offsets_.size(); ++i) {
+      values[i] = (bits >> i) & 1;
+    }
+    return 0;
+  }
+  for (size_t i = 0; i < event_fds_.size(); ++i) {
+    int value = ReadLine(event_fds_[i]);
+    if (value < 0) return -1;
+    values[i] = value;
+  }
+  return 0;
+}
+
+std::unique_ptr<Hx711Lines> OpenHx711Lines(uint8_t data_pin, uint8_t sclk_pin) {
+  return OpenHx711Lines(std::vector<uint8_t>({data_pin}), sclk_pin);
+}
+
+std::unique_ptr<Hx711Lines> OpenHx711Lines(const std::vector<uint8_t> &data_pins,
+                                           uint8_t sclk_pin) {
+  std::unique_ptr<Hx711Lines> lines(new ChardevHx711Lines(data_pins, sclk_pin));
+  if (lines->Init() == 0) {
+    return lines;
+  }
+  printf("GPIO character device not available, falling back to sysfs.\n");
+  lines.reset(new SysfsHx711Lines(data_pins, sclk_pin));
+  if (lines->Init() == 0) {
+    return lines;
+  }
+  return nullptr;
+}
@@ -0,0 +1,172 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "gpio.h"
+#include "gpio_bank.h"
+#include "monotonic_clock.h"
+
+// The two wires of the HX711: a DATA line that the chip pulls low when a
+// conversion is ready, and a SCLK line we pulse to clock the bits out.
+// RawScale only talks to the chip through this interface, so the hardware
+// access can be swapped out (sysfs, character device, or simulated).
+// Several HX711s can share one SCLK line, each with its own DATA line, so
+// a platform of load cells is read in the same number of clock pulses as one.
+// All functions return -1 on error, with errno describing the problem.
+class Hx711Lines {
+ public:
+  virtual ~Hx711Lines() {}
+
+  // Configure the lines.  Must be called before anything else.
+  virtual int Init() = 0;
+
+  // Blocks until every HX711 signals a conversion is ready (DATA low).
+  // Returns 1 when data is ready, 0 if |timeout_ms| passed without it.
+  virtual int WaitForDataReady(int timeout_ms) = 0;
+
+  // When (MonotonicNs) the last WaitForDataReady saw DATA go low.  This is
+  // the edge time if the backend knows it, otherwise when we first noticed.
+  int64_t DataReadyTime() const { return ready_time_ns_; }
+
+  // Tells the next WaitForDataReady when (MonotonicNs) DATA is expected to
+  // go low, so a polling backend can sleep until just before then.
+  // 0 means we don't know.
+  virtual void ExpectDataReadyAt(int64_t time_ns) {}
+
+  // How many times the waiting thread has gone to sleep and woken up.
+  int64_t Wakeups() const { return wakeups_; }
+
+  // Drive the clock line high (1) or low (0).
+  virtual int SetClock(uint8_t value) = 0;
+
+  // Returns the value (1 or 0) of the (first) data line.
+  virtual int ReadData() = 0;
+
+  // The number of DATA lines sharing the clock.
+  virtual int NumDataLines() { return 1; }
+
+  // Reads all NumDataLines() data lines into |values|.
+  virtual int ReadDataLines(uint8_t *values) {
+    int value = ReadData();
+    if (value < 0) return -1;
+    values[0] = value;
+    return 0;
+  }
+
+ protected:
+  int64_t ready_time_ns_ = 0;
+  int64_t wakeups_ = 0;
+};
+
+// The original implementation: poll the sysfs value file every millisecond,
+// and require kReqNumLowReadings low readings in a row.
+// If we know when the data should be ready, sleep until just before then
+// before starting to poll, so a conversion takes a handful of wakeups
+// instead of one per millisecond.
+class SysfsHx711Lines : public Hx711Lines {
+ public:
+  SysfsHx711Lines(uint8_t data_pin, uint8_t sclk_pin,
+                  GpioBank *bank = &GpioBank::Instance())
+    : data_pins_({data_pin}), sclk_pin_(sclk_pin), bank_(bank) {}
+  SysfsHx711Lines(const std::vector<uint8_t> &data_pins, uint8_t sclk_pin,
+                  GpioBank *bank = &GpioBank::Instance())
+    : data_pins_(data_pins), sclk_pin_(sclk_pin), bank_(bank) {}
+
+  int Init() override;
+  int WaitForDataReady(int timeout_ms) override;
+  int SetClock(uint8_t value) override;
+  int ReadData() override;
+  int NumDataLines() override { return data_pins_.size(); }
+  int ReadDataLines(uint8_t *values) override;
+  void ExpectDataReadyAt(int64_t time_ns) override { expected_ready_ns_ = time_ns; }
+
+ private:
+  static constexpr int kReqNumLowReadings = 3;
+  // How early to wake up before the expected time.
+  static constexpr int64_t kWakeEarlyNs = 300 * kNsPerUs;
+  int64_t expected_ready_ns_ = 0;
+  std::vector<uint8_t> data_pins_;
+  uint8_t sclk_pin_;
+  GpioBank *bank_;
+  std::vector<GpioLine *> data_;
+  GpioLine *sclk_ = nullptr;
+
+  // Returns 0 if all the data lines are low, 1 if any are high.
+  int ReadAllLow();
+};
+
+// Uses the GPIO character device (/dev/gpiochipN).  The DATA lines are
+// requested with falling edge events, so waiting for a conversion is a
+// blocking poll() instead of a busy loop.  The SCLK line is held as an
+// output handle for the life of the object.
+// If the kernel supports it (5.10 and later), all the DATA lines are held
+// in one request, so each bit of every cell is read with one ioctl.
+// Otherwise each DATA line has its own event request, and costs an ioctl
+// per bit.
+class ChardevHx711Lines : public Hx711Lines {
+ public:
+  ChardevHx711Lines(uint8_t data_pin, uint8_t sclk_pin)
+    : data_pins_({data_pin}), sclk_pin_(sclk_pin) {}
+  ChardevHx711Lines(const std::vector<uint8_t> &data_pins, uint8_t sclk_pin)
+    : data_pins_(data_pins), sclk_pin_(sclk_pin) {}
+  ~ChardevHx711Lines();
+
+  int Init() override;
+  int WaitForDataReady(int timeout_ms) override;
+  int SetClock(uint8_t value) override;
+  int ReadData() override;
+  int NumDataLines() override { return data_pins_.size(); }
+  int ReadDataLines(uint8_t *values) override;
+
+ private:
+  std::vector<uint8_t> data_pins_;
+  uint8_t sclk_pin_;
+  // lines_fd_ is the request holding all the DATA lines, if we have one.
+  // If not, event_fds_ are the falling edge requests on each DATA line,
+  // which can also be used to read the line values.
+  // sclk_fd_ is the output handle for SCLK.
+  int lines_fd_ = -1;
+  std::vector<int> event_fds_;
+  int sclk_fd_ = -1;
+  // The offsets of the DATA lines on their chip, and when each last went
+  // low (0 if it has gone high since).  Only used with lines_fd_.
+  std::vector<uint32_t> data_offsets_;
+  std::vector<int64_t> edge_ns_;
+
+  // Requests one DATA line, with events, into event_fds_.
+  int RequestDataLine(uint8_t pin, const std::string &chip, uint32_t offset);
+  // Requests all the DATA lines on |chip| as lines_fd_.
+  int RequestDataLines(const std::string &chip);
+  // Reads the DATA lines in |mask| from lines_fd_ into |bits|, one bit
+  // per line.
+  int ReadLineBits(uint64_t mask, uint64_t *bits);
+  // The mask for all the DATA lines in lines_fd_.
+  uint64_t AllLinesMask() const {
+    return data_offsets_.size() < 64 ? (1ULL << data_offsets_.size()) - 1 : ~0ULL;
+  }
+  // Reads the queued edges from lines_fd_ into edge_ns_.
+  int ReadEdges();
+  // Waits for all the lines in lines_fd_ to go low.  Same returns as
+  // WaitForDataReady.
+  int WaitForAllLow(int timeout_ms);
+  // Waits for one DATA line to go low.  Same returns as WaitForDataReady.
+  // Sets |edge_ns| to the time DATA went low.
+  int WaitForLineLow(int event_fd, int timeout_ms, int64_t *edge_ns);
+  // The kernel timestamps edge events.  Older kernels use the wall clock
+  // for that, in which case we fall back to our own time.
+  static int64_t EventTime(uint64_t timestamp_ns);
+  int ReadLine(int event_fd);
+};
+
+// Picks the best available implementation for the given pins:
+// the character device if the kernel supports it, otherwise sysfs.
+// The returned lines are already initialized.  Returns nullptr on failure.
+std::unique_ptr<Hx711Lines> OpenHx711Lines(uint8_t data_pin, uint8_t sclk_pin);
+std::unique_ptr<Hx711Lines> OpenHx711Lines(const std::vector<uint8_t> &data_pins,
+                                           uint8_t sclk_pin);
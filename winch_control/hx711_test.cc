@@ -0,0 +1,276 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "raw_scale.h"
+#include "simulated_hx711.h"
+#include "gtest/gtest.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+class Hx711Test : public ::testing::Test {
+ protected:
+  Hx711Test() : chip_(new SimulatedHx711()),
+    scale_(std::unique_ptr<Hx711Lines>(chip_)) {}
+
+  void SetUp() override {
+    ASSERT_EQ(scale_.InitLoop(
+        [this](double raw, int64_t) {
+          std::lock_guard<std::mutex> lock(readings_lock_);
+          readings_.push_back(raw);
+        }, []() {}), 0);
+  }
+
+  // Waits up to a second for |count| readings to come through.
+  std::vector<double> WaitForReadings(size_t count) {
+    for (int i = 0; i < 100; ++i) {
+      {
+        std::lock_guard<std::mutex> lock(readings_lock_);
+        if (readings_.size() >= count) return readings_;
+      }
+      usleep(10000);
+    }
+    std::lock_guard<std::mutex> lock(readings_lock_);
+    return readings_;
+  }
+
+  SimulatedHx711 *chip_;  // owned by scale_
+  RawScale scale_;
+  std::mutex readings_lock_;
+  std::vector<double> readings_;
+};
+
+TEST(SimulatedHx711, TimesOutWithNoConversion) {
+  SimulatedHx711 chip;
+  EXPECT_EQ(chip.ReadData(), 1);
+  EXPECT_EQ(chip.WaitForDataReady(10), 0);
+  chip.PushConversion(0x800001);
+  EXPECT_EQ(chip.WaitForDataReady(10), 1);
+  EXPECT_EQ(chip.ReadData(), 0);
+  chip.SetClock(1);
+  chip.SetClock(0);
+  EXPECT_EQ(chip.ReadData(), 1);  // MSB
+}
+
+TEST_F(Hx711Test, ReadsConversion) {
+  chip_->PushConversion(0x123456);
+  chip_->PushConversion(0x00F0F0);
+  std::vector<double> readings = WaitForReadings(2);
+  ASSERT_EQ(readings.size(), 2u);
+  // 25 pulses: the last bit read is the data line going high again.
+  EXPECT_EQ(readings[0], (0x123456 << 1) | 1);
+  EXPECT_EQ(readings[1], (0x00F0F0 << 1) | 1);
+  EXPECT_EQ(chip_->LastPulseCount(), 25);
+  RawScale::Status status = scale_.GetStatus();
+  EXPECT_EQ(status.readings, 2);
+  EXPECT_EQ(status.errors, 0);
+  EXPECT_EQ(status.pulse_width_us.total, 50);
+  EXPECT_EQ(status.read_duration_us.total, 2);
+}
+
+// A slow callback shouldn't hold up reading the chip.
+TEST(Hx711Queue, SlowCallbackDoesNotBlockReads) {
+  SimulatedHx711 *chip = new SimulatedHx711();
+  RawScale scale((std::unique_ptr<Hx711Lines>(chip)));
+  std::atomic<int> delivered(0);
+  ASSERT_EQ(scale.InitLoop([&](double, int64_t) {
+        usleep(50000);
+        delivered++;
+      }, []() {}), 0);
+  for (uint32_t i = 1; i <= 10; ++i) {
+    chip->PushConversion(i << 12);
+  }
+  for (int i = 0; i < 100 && scale.GetStatus().readings < 10; ++i) {
+    usleep(1000);
+  }
+  RawScale::Status status = scale.GetStatus();
+  EXPECT_EQ(status.readings, 10);
+  EXPECT_LT(delivered, 10);
+  EXPECT_GT(status.queue_max_depth, 1u);
+  EXPECT_EQ(status.dropped_samples, 0);
+  for (int i = 0; i < 100 && delivered < 10; ++i) {
+    usleep(10000);
+  }
+  EXPECT_EQ(delivered, 10);
+}
+
+TEST_F(Hx711Test, DropsTrailingOnes) {
+  chip_->PushConversion(0x0003FF);
+  chip_->PushConversion(0x000400);
+  std::vector<double> readings = WaitForReadings(1);
+  ASSERT_EQ(readings.size(), 1u);
+  EXPECT_EQ(readings[0], (0x000400 << 1) | 1);
+  EXPECT_EQ(scale_.GetStatus().errors, 1);
+}
+
+TEST(Hx711Inputs, AlternatesChannels) {
+  SimulatedHx711 *chip = new SimulatedHx711();
+  RawScale scale((std::unique_ptr<Hx711Lines>(chip)));
+  std::mutex lock;
+  std::vector<double> weights, aux;
+  std::vector<Hx711Input> aux_inputs;
+  scale.SetInputSequence({Hx711Input::A128, Hx711Input::B32},
+      [&](Hx711Input input, double raw, int64_t) {
+        std::lock_guard<std::mutex> l(lock);
+        aux_inputs.push_back(input);
+        aux.push_back(raw);
+      });
+  ASSERT_EQ(scale.InitLoop([&](double raw, int64_t) {
+        std::lock_guard<std::mutex> l(lock);
+        weights.push_back(raw);
+      }, []() {}), 0);
+  for (uint32_t v : {0x100000, 0x200000, 0x300000, 0x400000}) {
+    chip->PushConversion(v);
+  }
+  for (int i = 0; i < 100; ++i) {
+    {
+      std::lock_guard<std::mutex> l(lock);
+      if (weights.size() + aux.size() >= 4) break;
+    }
+    usleep(10000);
+  }
+  std::lock_guard<std::mutex> l(lock);
+  ASSERT_EQ(weights.size(), 2u);
+  ASSERT_EQ(aux.size(), 2u);
+  EXPECT_EQ(weights[0], (0x100000 << 1) | 1);
+  EXPECT_EQ(weights[1], (0x300000 << 1) | 1);
+  EXPECT_EQ(aux[0], (0x200000 << 1) | 1);
+  EXPECT_EQ(aux[1], (0x400000 << 1) | 1);
+  EXPECT_EQ(aux_inputs[0], Hx711Input::B32);
+  EXPECT_EQ(aux_inputs[1], Hx711Input::B32);
+  // The last read selected channel A again.
+  EXPECT_EQ(chip->LastPulseCount(), 25);
+  EXPECT_EQ(scale.GetStatus().readings, 4);
+}
+
+TEST(Hx711Cells, ReadsAllCellsOnOneClock) {
+  SimulatedHx711Array *chips = new SimulatedHx711Array(4);
+  RawScale scale((std::unique_ptr<Hx711Lines>(chips)));
+  std::mutex lock;
+  std::vector<std::vector<uint32_t>> readings;
+  scale.SetCellCallback([&](const uint32_t *raw, int num_cells, int64_t) {
+        std::lock_guard<std::mutex> l(lock);
+        readings.emplace_back(raw, raw + num_cells);
+      });
+  ASSERT_EQ(scale.InitLoop([](double, int64_t) {}, []() {}), 0);
+  uint32_t values[] = {0x012345, 0x054321, 0x0ABCDE, 0x000800};
+  for (int i = 0; i < 4; ++i) {
+    chips->cell(i)->PushConversion(values[i]);
+  }
+  for (int i = 0; i < 100; ++i) {
+    {
+      std::lock_guard<std::mutex> l(lock);
+      if (readings.size()) break;
+    }
+    usleep(10000);
+  }
+  std::lock_guard<std::mutex> l(lock);
+  ASSERT_EQ(readings.size(), 1u);
+  ASSERT_EQ(readings[0].size(), 4u);
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_EQ(readings[0][i], (values[i] << 1) | 1);
+    EXPECT_EQ(chips->cell(i)->LastPulseCount(), 25);
+  }
+  RawScale::Status status = scale.GetStatus();
+  EXPECT_EQ(status.num_cells, 4);
+  // Four cells take the same 25 pulses as one.
+  EXPECT_EQ(status.pulse_width_us.total, 25);
+}
+
+// Drives the sysfs backend from a fake sysfs gpio tree.
+class SysfsHx711Test : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    char root[] = "/tmp/hx711_test_XXXXXX";
+    ASSERT_NE(mkdtemp(root), nullptr);
+    root_ = root;
+    for (int pin : {kDataPin, kSclkPin}) {
+      std::string pin_dir = root_ + "/gpio" + std::to_string(pin);
+      mkdir(pin_dir.c_str(), 0755);
+      WriteFile(pin_dir + "/direction", "in\n");
+    }
+    SetData(1);
+    WriteFile(root_ + "/gpio" + std::to_string(kSclkPin) + "/value", "0\n");
+    bank_.reset(new GpioBank(root_.c_str()));
+    lines_.reset(new SysfsHx711Lines(kDataPin, kSclkPin, bank_.get()));
+    ASSERT_EQ(lines_->Init(), 0);
+  }
+
+  void TearDown() override {
+    std::string cmd = "rm -rf " + root_;
+    system(cmd.c_str());
+  }
+
+  void WriteFile(const std::string &path, const char *contents) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ASSERT_GE(fd, 0);
+    write(fd, contents, strlen(contents));
+    close(fd);
+  }
+
+  // Overwritten in place, so a read never sees an empty file.
+  void SetData(int value) {
+    std::string path = root_ + "/gpio" + std::to_string(kDataPin) + "/value";
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+    ASSERT_GE(fd, 0);
+    pwrite(fd, value ? "1\n" : "0\n", 2, 0);
+    close(fd);
+  }
+
+  static constexpr int kDataPin = 5, kSclkPin = 6;
+  std::string root_;
+  std::unique_ptr<GpioBank> bank_;
+  std::unique_ptr<SysfsHx711Lines> lines_;
+};
+
+// Knowing when the data is due, we sleep until then instead of polling
+// every millisecond of the conversion.
+TEST_F(SysfsHx711Test, SleepsUntilDataIsDue) {
+  const int kConversions = 10;
+  for (int i = 0; i < kConversions; ++i) {
+    SetData(1);
+    int64_t due = MonotonicNs() + 50 * kNsPerMs;
+    lines_->ExpectDataReadyAt(due);
+    int64_t low_at = 0;
+    std::thread chip([this, due, &low_at]() {
+        usleep((due - MonotonicNs()) / kNsPerUs);
+        SetData(0);
+        low_at = MonotonicNs();
+      });
+    EXPECT_EQ(lines_->WaitForDataReady(200), 1);
+    chip.join();
+    EXPECT_GE(lines_->DataReadyTime(), due);
+    EXPECT_LT(lines_->DataReadyTime(), low_at + 10 * kNsPerMs);
+  }
+  double per_conversion = (double)lines_->Wakeups() / kConversions;
+  printf("%.1f wakeups per conversion\n", per_conversion);
+  // Polling the whole 50ms would be 50.
+  EXPECT_LT(per_conversion, 10);
+}
+
+// DATA has to stay low for a few polls, so a glitch isn't taken as data.
+TEST_F(SysfsHx711Test, IgnoresGlitch) {
+  int64_t start = MonotonicNs();
+  lines_->ExpectDataReadyAt(start + 5 * kNsPerMs);
+  std::thread chip([this]() {
+      usleep(5000);
+      SetData(0);
+      usleep(300);
+      SetData(1);
+      usleep(20000);
+      SetData(0);
+    });
+  EXPECT_EQ(lines_->WaitForDataReady(200), 1);
+  chip.join();
+  EXPECT_GE(lines_->DataReadyTime(), start + 25 * kNsPerMs);
+}
+
+}  // namespace
@@ -0,0 +1,44 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "link_health.h"
+
+const char *LinkHealthName(LinkHealth health) {
+  switch (health) {
+    case LinkHealth::kHealthy: return "healthy";
+    case LinkHealth::kStale: return "stale";
+    case LinkHealth::kDisconnected: return "disconnected";
+  }
+  return "unknown";
+}
+
+bool LinkHealthMonitor::SetHealth(LinkHealth health) {
+  if (health == health_) return false;
+  health_ = health;
+  return true;
+}
+
+bool LinkHealthMonitor::OnFrame(int64_t now) {
+  last_frame_ = now;
+  return SetHealth(LinkHealth::kHealthy);
+}
+
+bool LinkHealthMonitor::OnError() {
+  return SetHealth(LinkHealth::kDisconnected);
+}
+
+bool LinkHealthMonitor::Check(int64_t now) {
+  if (health_ == LinkHealth::kDisconnected) return false;
+  if (now >= last_frame_ + disconnected_ns_) return SetHealth(LinkHealth::kDisconnected);
+  if (now >= last_frame_ + stale_ns_) return SetHealth(LinkHealth::kStale);
+  return false;
+}
+
+int64_t LinkHealthMonitor::Deadline() const {
+  switch (health_) {
+    case LinkHealth::kHealthy: return last_frame_ + stale_ns_;
+    case LinkHealth::kStale: return last_frame_ + disconnected_ns_;
+    default: return 0;
+  }
+}
@@ -0,0 +1,46 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+
+// How a device that should keep sending us frames is doing.
+enum class LinkHealth {
+  kHealthy,       // frames are coming in
+  kStale,         // we missed a frame
+  kDisconnected,  // no frames for a long time, or the reads are failing
+};
+
+// "healthy", "stale" or "disconnected".
+const char *LinkHealthName(LinkHealth health);
+
+// Decides the LinkHealth from when the frames come in.  Before the first
+// frame, the link is disconnected.  Each call returns true if it changed
+// the health.  Not thread safe.
+class LinkHealthMonitor {
+ public:
+  // Stale after |stale_ns| without a frame, and disconnected after
+  // |disconnected_ns|.
+  LinkHealthMonitor(int64_t stale_ns, int64_t disconnected_ns)
+    : stale_ns_(stale_ns), disconnected_ns_(disconnected_ns) {}
+
+  // |now| is MonotonicNs.
+  bool OnFrame(int64_t now);
+  // The device went away, or reading from it failed.
+  bool OnError();
+  // Catches up with the time.  Call it at Deadline().
+  bool Check(int64_t now);
+
+  LinkHealth Health() const { return health_; }
+  // When the health next changes if no frames come, or 0 if it won't.
+  int64_t Deadline() const;
+
+ private:
+  bool SetHealth(LinkHealth health);
+
+  int64_t stale_ns_, disconnected_ns_;
+  int64_t last_frame_ = 0;
+  LinkHealth health_ = LinkHealth::kDisconnected;
+};
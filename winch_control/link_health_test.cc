@@ -0,0 +1,78 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "link_health.h"
+#include "grainfather2.h"
+#include "monotonic_clock.h"
+#include "gtest/gtest.h"
+
+#include <memory>
+
+namespace {
+
+constexpr int64_t kStaleNs = 1500 * kNsPerMs;
+constexpr int64_t kDisconnectedNs = 2 * kNsPerSec;
+
+TEST(LinkHealthMonitor, GoesStaleThenDisconnected) {
+  LinkHealthMonitor monitor(kStaleNs, kDisconnectedNs);
+  EXPECT_EQ(monitor.Health(), LinkHealth::kDisconnected);
+  EXPECT_EQ(monitor.Deadline(), 0);
+  EXPECT_TRUE(monitor.OnFrame(kNsPerSec));
+  EXPECT_EQ(monitor.Health(), LinkHealth::kHealthy);
+  EXPECT_EQ(monitor.Deadline(), kNsPerSec + kStaleNs);
+  // Frames on time keep it healthy.
+  EXPECT_FALSE(monitor.OnFrame(2 * kNsPerSec));
+  EXPECT_FALSE(monitor.Check(2 * kNsPerSec + kStaleNs - 1));
+  EXPECT_TRUE(monitor.Check(2 * kNsPerSec + kStaleNs));
+  EXPECT_EQ(monitor.Health(), LinkHealth::kStale);
+  EXPECT_EQ(monitor.Deadline(), 2 * kNsPerSec + kDisconnectedNs);
+  EXPECT_TRUE(monitor.Check(2 * kNsPerSec + kDisconnectedNs));
+  EXPECT_EQ(monitor.Health(), LinkHealth::kDisconnected);
+  EXPECT_EQ(monitor.Deadline(), 0);
+  EXPECT_FALSE(monitor.Check(100 * kNsPerSec));
+  // Until the next frame.
+  EXPECT_TRUE(monitor.OnFrame(100 * kNsPerSec));
+  EXPECT_EQ(monitor.Health(), LinkHealth::kHealthy);
+}
+
+TEST(LinkHealthMonitor, ErrorsDisconnect) {
+  LinkHealthMonitor monitor(kStaleNs, kDisconnectedNs);
+  monitor.OnFrame(kNsPerSec);
+  EXPECT_TRUE(monitor.OnError());
+  EXPECT_EQ(monitor.Health(), LinkHealth::kDisconnected);
+  EXPECT_FALSE(monitor.OnError());
+  // A late check doesn't skip straight from healthy to stale.
+  monitor.OnFrame(2 * kNsPerSec);
+  EXPECT_TRUE(monitor.Check(10 * kNsPerSec));
+  EXPECT_EQ(monitor.Health(), LinkHealth::kDisconnected);
+}
+
+TEST(GrainfatherSerial, ReportsHealthAndStopsQuickly) {
+  std::unique_ptr<GrainfatherSerial> grainfather(new GrainfatherSerial);
+  grainfather->DisableForTest();
+  std::atomic<int> healthy_calls(0);
+  grainfather->AddLinkHealthCallback([&](LinkHealth health) {
+      if (health == LinkHealth::kHealthy) healthy_calls++;
+    });
+  EXPECT_EQ(grainfather->GetLinkHealth(), LinkHealth::kDisconnected);
+  // Init waits for the first state, rather than giving up because the
+  // link isn't up yet.
+  testing::internal::CaptureStdout();
+  ASSERT_EQ(grainfather->Init(nullptr), 0);
+  EXPECT_EQ(testing::internal::GetCapturedStdout().find("Not getting new readings"),
+            std::string::npos);
+  EXPECT_EQ(grainfather->GetLinkHealth(), LinkHealth::kHealthy);
+  EXPECT_EQ(healthy_calls, 1);
+  // A new state comes without waiting out the timeout.  The simulated
+  // Grainfather has a new state each second, and is read every 300 ms.
+  int64_t tstart = MonotonicNs();
+  EXPECT_TRUE(grainfather->GetLatestState(tstart).valid);
+  EXPECT_LT(MonotonicNs() - tstart, 1400 * kNsPerMs);
+  // The reading thread is woken up to stop, not left to finish a wait.
+  tstart = MonotonicNs();
+  grainfather.reset();
+  EXPECT_LT(MonotonicNs() - tstart, 100 * kNsPerMs);
+}
+
+}  // namespace
@@ -3,6 +3,7 @@
 // found in the LICENSE file.
 
 #include "logger.h"
+#include "monotonic_clock.h"
 
 #include <iostream>
 #include <stdio.h>
@@ -489,15 +490,16 @@ void BrewLogger::LogStageEvent(StageEvent event_id) {
 }
 
 
-void BrewLogger::LogWeight(double grams, time_t log_time) {
+void BrewLogger::LogWeight(double grams, int64_t log_time) {
   if (disable_for_test_) return;
   // time, time, weight
   timespec tm;
   if (log_time == 0) {
     clock_gettime(CLOCK_REALTIME, &tm);
   } else {
-    tm.tv_sec = log_time;
-    tm.tv_nsec = 0;
+    int64_t wall_time = MonotonicToWallNs(log_time);
+    tm.tv_sec = wall_time / kNsPerSec;
+    tm.tv_nsec = wall_time % kNsPerSec;
   }
   char values[2000];
   // time (readable), time(number), severity, message
@@ -617,7 +619,7 @@ void BrewLogger::LogBrewState(const BrewState &state) {
   // wait temp | target temp | current temp |heat on | %heat
   // pump on
   const char *values_format = "{\"values\":[[\"%s\", \"%ld\", ";
-  sprintf(values, values_format, ctime(&tm.tv_sec), state.read_time);
+  sprintf(values, values_format, ctime(&tm.tv_sec), MonotonicToWallMs(state.read_time));
   std::string sval(values);
   sval += ToValue(state.brew_session_loaded);
   sval += ToValue(state.stage);
@@ -47,7 +47,8 @@ class BrewLogger {
   const char *levels_[5] = {"Debug", "Info", "Warning", "Error", "Fatal"};
   void Log(int severity, std::string message);
 
-  void LogWeight(double grams, time_t log_time = 0);
+  // |log_time| is when the weight was measured (MonotonicNs), or 0 for now.
+  void LogWeight(double grams, int64_t log_time = 0);
   void LogWeightEvent(WeightEvent event_id, double grams);
 
   void LogBrewState(const BrewState &state);
@@ -0,0 +1,12 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "monotonic_clock.h"
+
+int64_t MonotonicToWallNs(int64_t monotonic_ns) {
+  timespec wall;
+  clock_gettime(CLOCK_REALTIME, &wall);
+  int64_t wall_now = wall.tv_sec * kNsPerSec + wall.tv_nsec;
+  return wall_now - (MonotonicNs() - monotonic_ns);
+}
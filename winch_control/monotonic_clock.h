@@ -0,0 +1,33 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+// All times in the brewhouse are nanoseconds on CLOCK_MONOTONIC.
+// Unlike the wall clock, it never jumps (NTP stepping the clock, or someone
+// setting the date), so intervals, timeouts and slopes stay right over a
+// six hour brew.  Only convert to wall clock time when writing logs.
+
+constexpr int64_t kNsPerUs = 1000;
+constexpr int64_t kNsPerMs = 1000 * kNsPerUs;
+constexpr int64_t kNsPerSec = 1000 * kNsPerMs;
+
+// The current monotonic time.  Goes through the vDSO, so it is cheap
+// enough to call in a busy loop.
+inline int64_t MonotonicNs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * kNsPerSec + ts.tv_nsec;
+}
+
+// Converts a monotonic time to the wall clock (ns since the epoch), using
+// the current offset between the two clocks.
+int64_t MonotonicToWallNs(int64_t monotonic_ns);
+
+inline int64_t MonotonicToWallMs(int64_t monotonic_ns) {
+  return MonotonicToWallNs(monotonic_ns) / kNsPerMs;
+}
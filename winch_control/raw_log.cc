@@ -0,0 +1,244 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "raw_log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "monotonic_clock.h"
+
+constexpr size_t RawLogWriter::kBufferEntries;
+constexpr int64_t RawLogWriter::kSyncIntervalNs;
+
+static constexpr char kRawLogMagic[4] = {'W', 'L', 'O', 'G'};
+static constexpr uint16_t kRawLogVersion = 1;
+static constexpr int kFlagShift = 28;
+static constexpr uint32_t kMaxDeltaUs = (1u << kFlagShift) - 1;  // about 4.5 minutes
+
+static bool ValidHeader(const RawLogHeader &header) {
+  return memcmp(header.magic, kRawLogMagic, sizeof(kRawLogMagic)) == 0 &&
+         header.version == kRawLogVersion &&
+         header.entry_size == sizeof(RawLogEntry);
+}
+
+// Writes all of |size| bytes.  Returns -1 on error.
+static int WriteAll(int fd, const void *data, size_t size) {
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  while (size > 0) {
+    ssize_t ret = write(fd, bytes, size);
+    if (ret < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    bytes += ret;
+    size -= ret;
+  }
+  return 0;
+}
+
+RawLogWriter::RawLogWriter() {
+  buffers_[0].reserve(kBufferEntries);
+  buffers_[1].reserve(kBufferEntries);
+}
+
+int RawLogWriter::Open(const char *path) {
+  Close();
+  int fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    printf("Failed to open raw log file at %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  RawLogHeader header;
+  ssize_t ret = pread(fd, &header, sizeof(header), 0);
+  if (ret == 0) {
+    // A new file.
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kRawLogMagic, sizeof(kRawLogMagic));
+    header.version = kRawLogVersion;
+    header.entry_size = sizeof(RawLogEntry);
+    if (WriteAll(fd, &header, sizeof(header))) {
+      printf("Failed to write raw log header to %s\n", path);
+      close(fd);
+      return -1;
+    }
+  } else if (ret != sizeof(header) || !ValidHeader(header)) {
+    printf("%s is not a raw log\n", path);
+    close(fd);
+    return -1;
+  } else {
+    // If we died in the middle of writing an entry, drop the part we
+    // wrote, or every entry we append would be misaligned.
+    struct stat st;
+    if (fstat(fd, &st)) {
+      printf("Failed to stat %s: %s\n", path, strerror(errno));
+      close(fd);
+      return -1;
+    }
+    size_t entries = (st.st_size - sizeof(header)) / sizeof(RawLogEntry);
+    off_t length = sizeof(header) + entries * sizeof(RawLogEntry);
+    if (length != st.st_size && ftruncate(fd, length)) {
+      printf("Failed to truncate %s: %s\n", path, strerror(errno));
+      close(fd);
+      return -1;
+    }
+  }
+  std::lock_guard<std::mutex> lock(flush_lock_);
+  last_sync_ = MonotonicNs();
+  last_time_ = 0;
+  fd_ = fd;
+  return 0;
+}
+
+void RawLogWriter::Close() {
+  std::lock_guard<std::mutex> lock(flush_lock_);
+  if (fd_ < 0) return;
+  FlushLocked(true);
+  close(fd_.exchange(-1));
+}
+
+bool RawLogWriter::Push(const RawLogEntry &entry) {
+  std::lock_guard<std::mutex> lock(lock_);
+  std::vector<RawLogEntry> &buffer = buffers_[front_];
+  if (buffer.size() == kBufferEntries) return false;
+  buffer.push_back(entry);
+  return true;
+}
+
+void RawLogWriter::Append(int64_t time, double raw, double grams, uint32_t flags) {
+  if (fd_ < 0) return;
+  RawLogEntry entry;
+  int64_t delta_us = (time - last_time_) / kNsPerUs;
+  if (last_time_ == 0 || delta_us < 0 || delta_us > kMaxDeltaUs) {
+    entry.delta_and_flags = kRawLogTimeBase << kFlagShift;
+    entry.grams = 0;
+    entry.wall_us = MonotonicToWallNs(time) / kNsPerUs;
+    if (!Push(entry)) {
+      dropped_++;
+      return;
+    }
+    last_time_ = time;
+    delta_us = 0;
+  }
+  entry.delta_and_flags = (flags << kFlagShift) | delta_us;
+  entry.grams = grams;
+  entry.raw = raw;
+  if (!Push(entry)) {
+    dropped_++;
+    // Deltas after a gap would be wrong, so start again from a time base.
+    last_time_ = 0;
+    return;
+  }
+  // Keep the rounding error from adding up.
+  last_time_ += delta_us * kNsPerUs;
+}
+
+int RawLogWriter::Flush(bool sync) {
+  std::lock_guard<std::mutex> lock(flush_lock_);
+  return FlushLocked(sync);
+}
+
+int RawLogWriter::FlushLocked(bool sync) {
+  int fd = fd_;
+  if (fd < 0) return -1;
+  int back;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    back = front_;
+    front_ = 1 - front_;
+  }
+  std::vector<RawLogEntry> &buffer = buffers_[back];
+  int ret = 0;
+  if (!buffer.empty()) {
+    ret = WriteAll(fd, buffer.data(), buffer.size() * sizeof(RawLogEntry));
+    if (ret) {
+      printf("Failed to write raw log: %s\n", strerror(errno));
+    }
+    buffer.clear();
+  }
+  int64_t tnow = MonotonicNs();
+  if (sync || tnow - last_sync_ > kSyncIntervalNs) {
+    fdatasync(fd);
+    last_sync_ = tnow;
+  }
+  return ret;
+}
+
+int RawLogReader::Open(const char *path) {
+  Close();
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    printf("Failed to open raw log file at %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) || (size_t)st.st_size < sizeof(RawLogHeader)) {
+    printf("%s is not a raw log\n", path);
+    close(fd);
+    return -1;
+  }
+  void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping stays valid after the file is closed.
+  close(fd);
+  if (data == MAP_FAILED) {
+    printf("Failed to map %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  data_ = static_cast<const uint8_t *>(data);
+  length_ = st.st_size;
+  if (!ValidHeader(*reinterpret_cast<const RawLogHeader *>(data_))) {
+    printf("%s is not a raw log\n", path);
+    Close();
+    return -1;
+  }
+  entries_ = reinterpret_cast<const RawLogEntry *>(data_ + sizeof(RawLogHeader));
+  num_entries_ = (length_ - sizeof(RawLogHeader)) / sizeof(RawLogEntry);
+  Rewind();
+  return 0;
+}
+
+void RawLogReader::Close() {
+  if (data_) {
+    munmap(const_cast<uint8_t *>(data_), length_);
+  }
+  data_ = nullptr;
+  entries_ = nullptr;
+  length_ = num_entries_ = 0;
+  Rewind();
+}
+
+bool RawLogReader::Next(RawLogSample *sample) {
+  while (next_ < num_entries_) {
+    const RawLogEntry &entry = entries_[next_++];
+    uint32_t flags = entry.delta_and_flags >> kFlagShift;
+    if (flags & kRawLogTimeBase) {
+      time_us_ = entry.wall_us;
+      continue;
+    }
+    time_us_ += entry.delta_and_flags & kMaxDeltaUs;
+    sample->wall_us = time_us_;
+    sample->raw = entry.raw;
+    sample->grams = entry.grams;
+    sample->flags = flags;
+    return true;
+  }
+  return false;
+}
+
+size_t RawLogReader::ExportCsv(FILE *out, int64_t start_us, int64_t end_us) {
+  Rewind();
+  RawLogSample sample;
+  size_t count = 0;
+  while (Next(&sample)) {
+    if (sample.wall_us < start_us) continue;
+    if (end_us && sample.wall_us > end_us) continue;
+    fprintf(out, "%lld.%03lld,%.3f,%.2f,%u\n", (long long)sample.wall_us / 1000,
+            (long long)sample.wall_us % 1000, sample.raw, sample.grams, sample.flags);
+    count++;
+  }
+  return count;
+}
@@ -0,0 +1,139 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+// A binary log of every scale reading.  The file is a RawLogHeader, then
+// fixed size RawLogEntries, and is only ever appended to.  Each entry has
+// the time since the entry before it, so to know when an entry was, read
+// from the start.  Every session starts with a time base entry, which has
+// the wall clock time.
+
+// Flags on each entry:
+constexpr uint32_t kRawLogTimeBase = 1;   // not a reading, wall_us is set
+constexpr uint32_t kRawLogSettled = 2;    // the weight was on a plateau
+constexpr uint32_t kRawLogDrainAlarm = 4; // the draining alarm was on
+
+struct RawLogHeader {
+  char magic[4];          // kRawLogMagic
+  uint16_t version;
+  uint16_t entry_size;    // sizeof(RawLogEntry)
+  uint64_t reserved;
+};
+
+struct RawLogEntry {
+  // The low 28 bits are the microseconds since the entry before.  The top
+  // 4 are the flags.
+  uint32_t delta_and_flags;
+  float grams;
+  union {
+    double raw;         // a reading
+    int64_t wall_us;    // a time base: microseconds since the epoch
+  };
+};
+
+static_assert(sizeof(RawLogHeader) == 16, "RawLogHeader is on disk");
+static_assert(sizeof(RawLogEntry) == 16, "RawLogEntry is on disk");
+
+// One reading, read back from the log.
+struct RawLogSample {
+  int64_t wall_us = 0;  // microseconds since the epoch
+  double raw = 0, grams = 0;
+  uint32_t flags = 0;
+};
+
+// Appends readings to the log.  Append() puts the readings in one of two
+// preallocated buffers.  Flush(), from another thread, swaps the buffers
+// and writes the full one with a single write(), so the reading thread
+// never waits on the disk.  The data is synced to the disk every
+// kSyncIntervalNs, or when asked.
+class RawLogWriter {
+ public:
+  // About a minute of readings at 80 SPS.  If Flush() falls behind, the
+  // readings that don't fit are dropped.
+  static constexpr size_t kBufferEntries = 4096;
+  static constexpr int64_t kSyncIntervalNs = 10LL * 1000 * 1000 * 1000;
+
+  RawLogWriter();
+  ~RawLogWriter() { Close(); }
+
+  // Opens |path| for appending, and creates it if needed.  Returns -1 if
+  // the file can't be opened, or isn't a raw log.
+  int Open(const char *path);
+  // Flushes, syncs and closes the file.  Safe to call while another
+  // thread is in Flush().
+  void Close();
+
+  // |time| is MonotonicNs.  Call from one thread only.  Does nothing if
+  // the log isn't open.
+  void Append(int64_t time, double raw, double grams, uint32_t flags);
+
+  // Writes out what has been appended.  Syncs the file if |sync|, or if it
+  // hasn't been synced for kSyncIntervalNs.  Can be called from any thread.
+  // Returns -1 on a write error, or if the log isn't open.
+  int Flush(bool sync = false);
+
+  // Readings dropped because the buffer was full.
+  int64_t Dropped() const { return dropped_; }
+
+ private:
+  // Adds an entry to the front buffer.  Returns false if it's full.
+  bool Push(const RawLogEntry &entry);
+  // Flush(), with flush_lock_ held.
+  int FlushLocked(bool sync);
+
+  // Held while writing out the back buffer, and while opening or closing
+  // the file, so only one thread at a time writes.
+  std::mutex flush_lock_;
+  std::atomic<int> fd_{-1};
+  int64_t last_sync_ = 0;
+  // The buffer Append() fills, and the one Flush() writes.
+  std::mutex lock_;
+  std::vector<RawLogEntry> buffers_[2];
+  int front_ = 0;
+  // Used only by Append().  The time of the last entry, or 0 if the next
+  // one must be a time base.
+  int64_t last_time_ = 0;
+  std::atomic<int64_t> dropped_{0};
+};
+
+// Reads a raw log by mapping it into memory.
+class RawLogReader {
+ public:
+  ~RawLogReader() { Close(); }
+
+  // Returns -1 if |path| can't be mapped, or isn't a raw log.
+  int Open(const char *path);
+  void Close();
+
+  // Entries in the file, including time bases.  A partly written entry at
+  // the end is ignored.
+  size_t NumEntries() const { return num_entries_; }
+
+  // The next reading.  Returns false at the end of the log.
+  bool Next(RawLogSample *sample);
+  // Back to the first reading.
+  void Rewind() { next_ = 0; time_us_ = 0; }
+
+  // Writes the readings from |start_us| up to |end_us| (wall clock
+  // microseconds, 0 for no limit) to |out| as CSV: the time in ms since
+  // the epoch, raw, grams, flags.  Reads from the start of the log.
+  // Returns the number of readings written.
+  size_t ExportCsv(FILE *out, int64_t start_us = 0, int64_t end_us = 0);
+
+ private:
+  const uint8_t *data_ = nullptr;
+  size_t length_ = 0;
+  const RawLogEntry *entries_ = nullptr;
+  size_t num_entries_ = 0;
+  size_t next_ = 0;
+  int64_t time_us_ = 0;
+};
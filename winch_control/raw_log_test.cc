@@ -0,0 +1,199 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "raw_log.h"
+#include "monotonic_clock.h"
+#include "gtest/gtest.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <thread>
+
+namespace {
+
+class RawLogTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    char path[] = "/tmp/raw_log_testXXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    unlink(path);  // the writer creates it
+    path_ = path;
+  }
+  void TearDown() override {
+    unlink(path_.c_str());
+  }
+
+  std::string path_;
+};
+
+TEST_F(RawLogTest, ReadsBackWhatWasWritten) {
+  int64_t tstart = MonotonicNs();
+  int64_t wall_start = MonotonicToWallNs(tstart) / kNsPerUs;
+  RawLogWriter writer;
+  ASSERT_EQ(writer.Open(path_.c_str()), 0);
+  for (int i = 0; i < 1000; ++i) {
+    writer.Append(tstart + i * 12500 * kNsPerUs, 8000000 + i, 1000 + i * 0.25,
+                  i % 2 ? kRawLogSettled : 0);
+    if (i % 100 == 0) writer.Flush();
+  }
+  writer.Close();
+
+  RawLogReader reader;
+  ASSERT_EQ(reader.Open(path_.c_str()), 0);
+  EXPECT_EQ(reader.NumEntries(), 1001u);  // and a time base
+  RawLogSample sample;
+  for (int i = 0; i < 1000; ++i) {
+    ASSERT_TRUE(reader.Next(&sample));
+    // Allow for the wall clock moving while we worked.
+    EXPECT_NEAR(sample.wall_us, wall_start + i * 12500, 1000);
+    EXPECT_EQ(sample.raw, 8000000 + i);
+    EXPECT_FLOAT_EQ(sample.grams, 1000 + i * 0.25);
+    EXPECT_EQ(sample.flags, i % 2 ? kRawLogSettled : 0);
+  }
+  EXPECT_FALSE(reader.Next(&sample));
+  EXPECT_EQ(writer.Dropped(), 0);
+}
+
+// Each session, and each long gap, starts from a new time base.
+TEST_F(RawLogTest, AppendsSessionsAndGaps) {
+  int64_t tstart = MonotonicNs();
+  RawLogWriter writer;
+  ASSERT_EQ(writer.Open(path_.c_str()), 0);
+  writer.Append(tstart, 1, 1, 0);
+  writer.Append(tstart + 600 * kNsPerSec, 2, 2, 0);  // 10 minutes later
+  writer.Close();
+  ASSERT_EQ(writer.Open(path_.c_str()), 0);
+  writer.Append(tstart + 601 * kNsPerSec, 3, 3, 0);
+  writer.Close();
+
+  RawLogReader reader;
+  ASSERT_EQ(reader.Open(path_.c_str()), 0);
+  EXPECT_EQ(reader.NumEntries(), 6u);
+  RawLogSample first, second, third;
+  ASSERT_TRUE(reader.Next(&first));
+  ASSERT_TRUE(reader.Next(&second));
+  ASSERT_TRUE(reader.Next(&third));
+  EXPECT_EQ(third.raw, 3);
+  EXPECT_NEAR(second.wall_us - first.wall_us, 600 * 1000000LL, 1000);
+  EXPECT_NEAR(third.wall_us - second.wall_us, 1000000, 1000);
+}
+
+// A crash can leave part of an entry at the end.
+TEST_F(RawLogTest, IgnoresPartialEntry) {
+  RawLogWriter writer;
+  ASSERT_EQ(writer.Open(path_.c_str()), 0);
+  writer.Append(MonotonicNs(), 1, 1, 0);
+  writer.Close();
+  FILE *file = fopen(path_.c_str(), "a");
+  fwrite("partial", 1, 7, file);
+  fclose(file);
+
+  RawLogReader reader;
+  ASSERT_EQ(reader.Open(path_.c_str()), 0);
+  EXPECT_EQ(reader.NumEntries(), 2u);
+  // But it's not a valid log to append to.
+  FILE *text = fopen(path_.c_str(), "w");
+  fprintf(text, "1571234567890 8234567 1234.5\n");
+  fclose(text);
+  EXPECT_EQ(writer.Open(path_.c_str()), -1);
+  EXPECT_EQ(reader.Open(path_.c_str()), -1);
+}
+
+// Appending after a crash drops the partial entry, so the new entries
+// line up.
+TEST_F(RawLogTest, AppendsAfterPartialEntry) {
+  int64_t tstart = MonotonicNs();
+  RawLogWriter writer;
+  ASSERT_EQ(writer.Open(path_.c_str()), 0);
+  writer.Append(tstart, 1, 1, 0);
+  writer.Close();
+  FILE *file = fopen(path_.c_str(), "a");
+  fwrite("partial", 1, 7, file);
+  fclose(file);
+
+  ASSERT_EQ(writer.Open(path_.c_str()), 0);
+  writer.Append(tstart + kNsPerSec, 2, 2, 0);
+  writer.Close();
+
+  RawLogReader reader;
+  ASSERT_EQ(reader.Open(path_.c_str()), 0);
+  EXPECT_EQ(reader.NumEntries(), 4u);  // two samples, two time bases
+  RawLogSample first, second;
+  ASSERT_TRUE(reader.Next(&first));
+  ASSERT_TRUE(reader.Next(&second));
+  EXPECT_EQ(first.raw, 1);
+  EXPECT_EQ(second.raw, 2);
+  EXPECT_FLOAT_EQ(second.grams, 2);
+  EXPECT_NEAR(second.wall_us - first.wall_us, 1000000, 1000);
+  EXPECT_FALSE(reader.Next(&second));
+}
+
+TEST_F(RawLogTest, ExportsRangeAsCsv) {
+  int64_t tstart = MonotonicNs();
+  RawLogWriter writer;
+  ASSERT_EQ(writer.Open(path_.c_str()), 0);
+  for (int i = 0; i < 10; ++i) {
+    writer.Append(tstart + i * kNsPerSec, 100 + i, 10 + i, 0);
+  }
+  writer.Close();
+
+  RawLogReader reader;
+  ASSERT_EQ(reader.Open(path_.c_str()), 0);
+  RawLogSample first;
+  ASSERT_TRUE(reader.Next(&first));
+  char *text = nullptr;
+  size_t size = 0;
+  FILE *out = open_memstream(&text, &size);
+  // Seconds 3 to 5.
+  EXPECT_EQ(reader.ExportCsv(out, first.wall_us + 2500000, first.wall_us + 5500000), 3u);
+  fclose(out);
+  char expected[200];
+  int64_t ms = first.wall_us / 1000 + 3000;
+  snprintf(expected, sizeof(expected), "%lld.%03lld,103.000,13.00,0\n",
+           (long long)ms, (long long)first.wall_us % 1000);
+  EXPECT_EQ(std::string(text).substr(0, strlen(expected)), expected);
+  EXPECT_EQ(std::count(text, text + size, '\n'), 3);
+  free(text);
+}
+
+// The logger thread can be flushing when the owner flushes or closes.
+TEST_F(RawLogTest, FlushesFromSeveralThreads) {
+  const int kEntries = 200000;
+  int64_t tstart = MonotonicNs();
+  RawLogWriter writer;
+  ASSERT_EQ(writer.Open(path_.c_str()), 0);
+  std::atomic<bool> done(false);
+  auto flusher = [&writer, &done]() {
+    while (!done) writer.Flush();
+  };
+  std::thread flusher1(flusher), flusher2(flusher);
+  for (int i = 0; i < kEntries; ++i) {
+    writer.Append(tstart + i * 12500 * kNsPerUs, i, i, 0);
+  }
+  std::thread closer([&writer]() { writer.Close(); });
+  writer.Flush();
+  closer.join();
+  done = true;
+  flusher1.join();
+  flusher2.join();
+
+  RawLogReader reader;
+  ASSERT_EQ(reader.Open(path_.c_str()), 0);
+  RawLogSample sample;
+  int count = 0;
+  double last = -1;
+  while (reader.Next(&sample)) {
+    ASSERT_GT(sample.raw, last);
+    last = sample.raw;
+    count++;
+  }
+  EXPECT_EQ(count, kEntries - writer.Dropped());
+}
+
+}  // namespace
@@ -0,0 +1,30 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Exports readings from a raw weight log as CSV.
+//
+// usage: raw_log_tool <log file> [start ms] [end ms]
+// The times are wall clock ms since the epoch, as in the CSV.  Prints
+// time_ms,raw,grams,flags lines to stdout, and a summary to stderr.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "raw_log.h"
+
+int main(int argc, char **argv) {
+  if (argc < 2 || argc > 4) {
+    fprintf(stderr, "usage: %s <log file> [start ms] [end ms]\n", argv[0]);
+    return 1;
+  }
+  int64_t start_us = argc > 2 ? atoll(argv[2]) * 1000 : 0;
+  int64_t end_us = argc > 3 ? atoll(argv[3]) * 1000 : 0;
+  RawLogReader reader;
+  if (reader.Open(argv[1])) {
+    return 1;
+  }
+  size_t count = reader.ExportCsv(stdout, start_us, end_us);
+  fprintf(stderr, "%zu readings exported, %zu entries in %s\n", count,
+          reader.NumEntries(), argv[1]);
+  return 0;
+}
@@ -9,13 +9,27 @@
 #include <functional>
 #include <iostream>
 #include <string>
+#include <errno.h>
 #include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <time.h>
 #include "gpio.h"
 #include "brew_types.h"
 
 RawScale::Status RawScale::GetStatus() {
    std::lock_guard<std::mutex> lock(status_lock_);
-   return current_status_;
+   Status status = current_status_;
+   status.queue_depth = samples_.Size();
+   status.queue_max_depth = samples_.MaxDepth();
+   status.dropped_samples = samples_.Overflows();
+   int64_t elapsed = MonotonicNs() - status.start_time;
+   if (status.start_time && elapsed > 0) {
+     status.wakeups_per_sec = status.wakeups * (double)kNsPerSec / elapsed;
+     status.cpu_percent = 100.0 * status.cpu_time_ns / elapsed;
+   }
+   return status;
 }
 
 void RawScale::RecordError(int64_t tnow, int error) {
@@ -28,7 +42,7 @@ void RawScale::RecordError(int64_t tnow, int error) {
    std::lock_guard<std::mutex> lock(status_lock_);
    current_status_.errors++;
    current_status_.consecutive_errors++;
-   current_status_.last_error = GetTimeMsec();
+   current_status_.last_error = tnow;
    if (current_status_.consecutive_errors > kMaxConsecutiveErrors) {
       std::cout << "Fatal: Too many consecutive errors (";
       std::cout << current_status_.consecutive_errors << ")" <<std::endl;
@@ -36,6 +50,31 @@ void RawScale::RecordError(int64_t tnow, int error) {
    }
 }
 
+static int64_t ThreadCpuNs() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * kNsPerSec + ts.tv_nsec;
+}
+
+// Busy wait, since sleeping for a microsecond costs far more than that.
+// clock_gettime goes through the vDSO (TSC), so this makes no syscalls.
+static inline void SpinUntil(int64_t deadline_ns) {
+  while (MonotonicNs() < deadline_ns) {
+  }
+}
+
+void RawScale::RecordTiming(const int64_t *pulse_ns, int num_pulses, int64_t read_ns) {
+  std::lock_guard<std::mutex> lock(status_lock_);
+  for (int i = 0; i < num_pulses; ++i) {
+    int64_t width_us = pulse_ns[i] / 1000;
+    current_status_.pulse_width_us.Add(width_us);
+    if (width_us > kMaxPulseWidthUs) {
+      current_status_.long_pulses++;
+    }
+  }
+  current_status_.read_duration_us.Add(read_ns / 1000);
+}
+
 void PrintRawValue(uint32_t val) {
   std::string out;
   uint32_t mask = 0x80000000;
@@ -47,65 +86,76 @@ void PrintRawValue(uint32_t val) {
 
 bool RawScale::ReadOne() {
   // The HX711 communicates by pulling the data line low every N Hz.
-  // Wait for the Data line to be pulled low:
-  int valid_count = 0;
-  int num_reads = 0;
-  do {
-    // The time between conversions is 100ms (at 10 hz), and data won't come
-    // until we strobe the clock, so we can poll pretty infrequently...
-    usleep(1000);
-    char buffer;
-    num_reads++;
-    lseek(data_fd_, 0, SEEK_SET);
-    int bytes = read(data_fd_, &buffer, 1);
-    if (bytes <= 0) {
-        int myerr = errno;
-        RecordError(GetTimeMsec(), myerr);
-        return false;
-    }
-    if (buffer == '0') {  // the signal is active low, so we count the # of 0 readings
-      valid_count++;
-      num_reads = 0;
-    } else {
-      valid_count = 0;
-    }
-    if (num_reads > kMaxReadsBeforeGiveUp) {
-      std::cout << "Fatal: num_reads > kMaxReadsBeforeGiveUp" <<std::endl;
-      had_fatal_error_ = true;
-      return false;
-      // shut it down, we're not functioning.
-    }
-  } while (valid_count < kReqNumLowReadings);
+  // Wait for the Data line to be pulled low.  Once we have learned the
+  // conversion period, the lines can sleep until it is almost time.
+  lines_->ExpectDataReadyAt(predictor_.Predict(MonotonicNs()));
+  int ready = lines_->WaitForDataReady(kDataReadyTimeoutMs);
+  if (ready < 0) {
+    int myerr = errno;
+    RecordError(MonotonicNs(), myerr);
+    return false;
+  }
+  if (ready == 0) {
+    std::cout << "Fatal: no data from the scale in " << kDataReadyTimeoutMs
+              << " ms" << std::endl;
+    had_fatal_error_ = true;
+    return false;
+    // shut it down, we're not functioning.
+  }
 
-  // Data is now available, so take the time:
-  int64_t tnow = GetTimeMsec();
+  // Data is now available.  The reading is from when DATA went low,
+  // not from when we got around to reading it.
+  int64_t tnow = lines_->DataReadyTime();
+  if (tnow == 0) {
+    tnow = MonotonicNs();
+  }
+  predictor_.Observe(tnow);
   // Pulse the sclk line at period of 2 us.  The rising edge triggers
   // the next bit to be available on data line, so read on the falling edge.
   // timespec sleep_time = { .tv_sec = 0, . tv_nsec = 100}, rem;
   // char buffer;
-  uint32_t ret = 0;
-  for (int i = 0; i < kHX711DataLength; ++i) {
+  int num_cells = lines_->NumDataLines();
+  uint32_t ret[kMaxCells] = {};
+  uint8_t bits[kMaxCells];
+  // This conversion was for the input selected last time. The number of
+  // pulses we use now selects the input of the next conversion.
+  Hx711Input measured_input = current_input_;
+  size_t next_index = (sequence_index_ + 1) % input_sequence_.size();
+  Hx711Input next_input = input_sequence_[next_index];
+  int num_pulses = static_cast<int>(next_input);
+  int64_t pulse_ns[kHX711MaxPulses];
+  int64_t read_start = MonotonicNs();
+  for (int i = 0; i < num_pulses; ++i) {
     // Pull high
-    write(sclk_fd_, "1", 1);
-    // TODO: Does this busy wait need to exist?
-    for (int j = 0; j < 10; ++j) {
-      asm("nop");
+    int64_t pulse_start = MonotonicNs();
+    if (lines_->SetClock(1) < 0) {
+      int myerr = errno;
+      RecordError(MonotonicNs(), myerr);
+      return false;
     }
-    write(sclk_fd_, "0", 1);
-    // Read the value at the data pin:
-
-    char buffer;
-    lseek(data_fd_, 0, SEEK_SET);
-    int bytes = read(data_fd_, &buffer, 1);
-    if (bytes <= 0) {
+    SpinUntil(pulse_start + kClockHighNs);
+    if (lines_->SetClock(0) < 0) {
+      int myerr = errno;
+      RecordError(MonotonicNs(), myerr);
+      return false;
+    }
+    pulse_ns[i] = MonotonicNs() - pulse_start;
+    // Read the value at the data pins.  All the cells shift out their
+    // bits on the same clock edge.
+    if (lines_->ReadDataLines(bits) < 0) {
         int myerr = errno;
-        RecordError(GetTimeMsec(), myerr);
+        RecordError(MonotonicNs(), myerr);
         return false;
     }
-    // Otherwise, the data was good. just convert from ascii:
-    ret = ret << 1;
-    ret += buffer - '0';
+    if (i < kHX711DataLength) {
+      for (int c = 0; c < num_cells; ++c) {
+        ret[c] = (ret[c] << 1) + bits[c];
+      }
+    }
   }
+  RecordTiming(pulse_ns, num_pulses, MonotonicNs() - read_start);
+  current_input_ = next_input;
+  sequence_index_ = next_index;
   // successful read!
   // One check here, since it is a binary thing:
   // If we screw up the timing, we will just read ones
@@ -114,9 +164,12 @@ bool RawScale::ReadOne() {
   // naturally, so we strike a balance between throwing out to much
   // data and too little.  The noise floor is around 1000, so throwing
   // out 1FF (511) and above shouldn't affect the data much.
-  if ((ret ^ (ret + 1)) > kMaxConsecutiveOnesValue) {
-    RecordError(tnow, -1);
-    return false;
+  // The cells share the clock, so if one is bad, we drop them all.
+  for (int c = 0; c < num_cells; ++c) {
+    if ((ret[c] ^ (ret[c] + 1)) > kMaxConsecutiveOnesValue) {
+      RecordError(tnow, -1);
+      return false;
+    }
   }
   // Now we will keep the data
   {
@@ -124,19 +177,102 @@ bool RawScale::ReadOne() {
     current_status_.readings++;
     current_status_.consecutive_errors = 0;
     current_status_.last_read_time = tnow;
-    current_status_.last_reading = ret;
+    current_status_.last_reading = ret[0];
+    current_status_.last_input = measured_input;
+    current_status_.num_cells = num_cells;
+    current_status_.wakeups = lines_->Wakeups();
+    current_status_.cpu_time_ns = ThreadCpuNs();
+    current_status_.predicted_period_ns = predictor_.PeriodNs();
+    current_status_.prediction_misses = predictor_.Misses();
+    for (int c = 0; c < num_cells; ++c) {
+      current_status_.last_cell_readings[c] = ret[c];
+    }
   }
   // If debugging scale values, this can be helpful:
   // PrintRawValue(ret);
   return true;
 }
 
+void RawScale::SetInputSequence(const std::vector<Hx711Input> &sequence,
+    std::function<void(Hx711Input, double, int64_t)> aux_callback) {
+  if (sequence.empty()) {
+    printf("RawScale: empty input sequence, keeping {A128}\n");
+    return;
+  }
+  input_sequence_ = sequence;
+  // The chip powers up converting A128, which we treat as sequence[0], so
+  // the first read selects sequence[1].  If the sequence doesn't start
+  // with A128, the first reading goes to the aux callback.
+  sequence_index_ = 0;
+  aux_callback_ = aux_callback;
+}
+
+void RawScale::ApplyRealtime() {
+  if (!realtime_.enabled) return;
+  if (realtime_.lock_memory && mlockall(MCL_CURRENT | MCL_FUTURE)) {
+    printf("RawScale: mlockall failed: %s\n", strerror(errno));
+  }
+  if (realtime_.cpu >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(realtime_.cpu, &cpus);
+    int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (ret) {
+      printf("RawScale: Failed to pin to cpu %d: %s\n", realtime_.cpu, strerror(ret));
+    }
+  }
+  sched_param param;
+  memset(&param, 0, sizeof(param));
+  param.sched_priority = realtime_.priority;
+  int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+  if (ret) {
+    printf("RawScale: Failed to set SCHED_FIFO: %s\n", strerror(ret));
+  }
+}
+
+void RawScale::Deliver(const Sample &sample) {
+  if (sample.input == input_sequence_[0] && cell_callback_) {
+    cell_callback_(sample.cells, sample.num_cells, sample.time);
+  } else if (sample.input == input_sequence_[0]) {
+    weight_callback_(sample.reading, sample.time);
+  } else if (aux_callback_) {
+    aux_callback_(sample.input, sample.reading, sample.time);
+  }
+}
+
+void RawScale::DeliveryThread() {
+  Sample sample;
+  while (true) {
+    if (sem_wait(&samples_ready_) && errno == EINTR) {
+      continue;
+    }
+    while (samples_.Pop(&sample)) {
+      Deliver(sample);
+    }
+    if (!delivery_thread_enabled_) {
+      return;
+    }
+  }
+}
+
 void RawScale::ReadingThread() {
+  ApplyRealtime();
+  Sample sample;
   while (reading_thread_enabled_) {
     if (ReadOne()) {
-      std::lock_guard<std::mutex> lock(status_lock_);
-      weight_callback_(current_status_.last_reading,
-                       current_status_.last_read_time);
+      {
+        std::lock_guard<std::mutex> lock(status_lock_);
+        sample.reading = current_status_.last_reading;
+        sample.input = current_status_.last_input;
+        sample.time = current_status_.last_read_time;
+        sample.num_cells = current_status_.num_cells;
+        memcpy(sample.cells, current_status_.last_cell_readings, sizeof(sample.cells));
+      }
+      // If the callbacks fall behind, the sample is dropped (and counted),
+      // rather than holding up the next read.
+      if (samples_.Push(sample)) {
+        sem_post(&samples_ready_);
+      }
     } else {
       if (had_fatal_error_) {
         std::cout << "RawScale has fatal error, quitting." <<std::endl;
@@ -149,55 +285,46 @@ void RawScale::ReadingThread() {
 
 int RawScale::InitLoop(std::function<void(double, int64_t)> callback,
                        std::function<void()> error_callback) {
-  if (SetDirection(SCALE_DATA, 0)) {
-    printf("Failed to set GPIO direction RawScale::Init\n");
-    return -1;
-  }
-  if (SetDirection(SCALE_SCLK, 1, 0)) {
-    printf("Failed to set GPIO direction RawScale::Init\n");
-    return -1;
-  }
-  std::string sclk_path = gpio_val_path(SCALE_SCLK);
-  sclk_fd_ = open(sclk_path.c_str(), O_RDWR);
-  if (!sclk_fd_) {
-    printf("Failed to open %s\n", sclk_path.c_str());
-    return -1;
-  }
-  std::string data_path = gpio_val_path(SCALE_DATA);
-  data_fd_ = open(data_path.c_str(), O_RDWR);
-  if (!data_fd_) {
-    printf("Failed to open %s\n", data_path.c_str());
-    return -1;
-  }
-  // Try to read and write from the buffers:
-  char buffer;
-  int bytes = read(data_fd_, &buffer, 1);
-  if (bytes <= 0) {
-    int myerr = errno;
-    RecordError(GetTimeMsec(), myerr);
-    return -1;
-  }
-  if (bytes == 0) {
-    printf("Failed to read during RawScale::Init\n");
-    return -1;
+  if (lines_) {
+    if (lines_->Init()) {
+      printf("Failed to initialize scale lines in RawScale::Init\n");
+      return -1;
+    }
+  } else {
+    lines_ = OpenHx711Lines(data_pins_, SCALE_SCLK);
+    if (!lines_) {
+      printf("Failed to open scale lines in RawScale::Init\n");
+      return -1;
+    }
   }
-  bytes = write(sclk_fd_, "0", 1);
-  if (bytes < 1) {
-    printf("Failed to write during RawScale::Init\n");
+  if (lines_->NumDataLines() > kMaxCells) {
+    printf("RawScale: %d data lines, but only %d can be read\n",
+           lines_->NumDataLines(), kMaxCells);
     return -1;
   }
 
   weight_callback_ = callback;
   error_callback_ = error_callback;
+  current_status_.start_time = MonotonicNs();
+  delivery_thread_enabled_ = true;
+  delivery_thread_ = std::thread(&RawScale::DeliveryThread, this);
   reading_thread_enabled_ = true;
   reading_thread_ = std::thread(&RawScale::ReadingThread, this);
   return 0;
 }
 
-RawScale::~RawScale() {
+void RawScale::Stop() {
   reading_thread_enabled_ = false;
   if (reading_thread_.joinable())
     reading_thread_.join();
-  close(sclk_fd_);
-  close(data_fd_);
+  // Deliver whatever is left, then stop.
+  delivery_thread_enabled_ = false;
+  sem_post(&samples_ready_);
+  if (delivery_thread_.joinable())
+    delivery_thread_.join();
+}
+
+RawScale::~RawScale() {
+  Stop();
+  sem_destroy(&samples_ready_);
 }
@@ -4,17 +4,41 @@
 
 #pragma once
 
+#include <atomic>
 #include <fstream>
+#include <semaphore.h>
 #include <thread>
 #include <functional>
 #include <iostream>
+#include <memory>
+#include <vector>
 #include "gpio.h"
 #include "brew_types.h"
+#include "monotonic_clock.h"
+#include "hx711_lines.h"
+#include "data_ready_predictor.h"
+#include "histogram.h"
+#include "spsc_ring.h"
 
 
-// Just performs reading in a thread, publishing dat when available:
+// The HX711 input and gain used for the next conversion is selected by the
+// number of clock pulses used to read the current one.
+enum class Hx711Input {
+  A128 = 25,  // channel A, gain 128 (power up default)
+  B32 = 26,   // channel B, gain 32
+  A64 = 27,   // channel A, gain 64
+};
+
+// Just performs reading in a thread, publishing dat when available.
+// The reading thread only reads the chip: samples are handed through a
+// lock free queue to a second thread, which calls the callbacks.  That way
+// a slow callback can't make us miss a conversion.
 class RawScale {
  public:
+  // The most HX711s that can share the clock line.
+  static constexpr int kMaxCells = 8;
+
+  // All times are MonotonicNs().
   struct Status {
     int64_t readings = 0;
     int64_t errors = 0;
@@ -23,29 +47,129 @@ class RawScale {
     int64_t last_read_time = 0;
     int64_t last_error = 0;
     uint32_t last_reading = 0;
+    Hx711Input last_input = Hx711Input::A128;
+    // With several load cells, last_reading is the first cell.
+    int num_cells = 1;
+    uint32_t last_cell_readings[kMaxCells] = {};
+    // Samples waiting for the callbacks, the most that have waited at once,
+    // and the number dropped because the queue was full.
+    size_t queue_depth = 0, queue_max_depth = 0;
+    int64_t dropped_samples = 0;
+    // How often the reading thread wakes up while waiting for data, and
+    // how much CPU it uses.  The rates are averaged since InitLoop.
+    int64_t wakeups = 0, cpu_time_ns = 0;
+    double wakeups_per_sec = 0, cpu_percent = 0;
+    // The learned conversion period (0 until we lock on), and how many
+    // times we lost track of it.
+    int64_t predicted_period_ns = 0, prediction_misses = 0;
+    // How long SCLK was held high for each bit, and how long it took to
+    // clock out each reading.  The HX711 powers down if SCLK stays high
+    // for more than 60 us, which shows up as a discarded reading.
+    Log2Histogram pulse_width_us, read_duration_us;
+    int64_t long_pulses = 0;  // pulses over kMaxPulseWidthUs
+  };
+
+  // The reading thread can be given real-time priority, so the scheduler
+  // can't preempt it in the middle of a clock pulse.
+  struct RealtimeOptions {
+    bool enabled = false;
+    int priority = 50;        // SCHED_FIFO priority, 1-99
+    int cpu = -1;             // CPU to pin the reading thread to, -1 for any
+    bool lock_memory = true;  // mlockall, so a page fault can't stall a read
   };
 
+  // Must be called before InitLoop.  Needs root (or CAP_SYS_NICE and
+  // CAP_IPC_LOCK); if a setting can't be applied, we print and carry on.
+  void SetRealtime(const RealtimeOptions &options) { realtime_ = options; }
+
+  // The inputs to read, in order, repeating.  The first input in the
+  // sequence is the weight, and is passed to the weight callback.  Readings
+  // from any other input go to |aux_callback|.  Defaults to just {A128}.
+  // e.g. {A128, B32} alternates channels, giving each half the sample rate.
+  // Must be called before InitLoop.
+  void SetInputSequence(const std::vector<Hx711Input> &sequence,
+      std::function<void(Hx711Input, double, int64_t)> aux_callback = nullptr);
+
+  // Reads several HX711s, with a DATA line each, sharing SCALE_SCLK.
+  // Defaults to just {SCALE_DATA}.  Must be called before InitLoop.
+  void SetDataPins(const std::vector<uint8_t> &data_pins) { data_pins_ = data_pins; }
+
+  // Called with the raw reading of every cell, instead of the weight
+  // callback.  Must be called before InitLoop.
+  void SetCellCallback(
+      std::function<void(const uint32_t *raw, int num_cells, int64_t)> callback) {
+    cell_callback_ = callback;
+  }
+
   // dumps the state of the scale, to check latest weight, or
   // to determine if there are issues.
   Status GetStatus();
 
   // Then starts thread loop continously reading the scale
-  // When a reading is available, (about every 100 miliseconds)
+  // When a reading is available, (every 100 ms at 10 SPS, or 12.5 ms at
+  // 80 SPS, depending on the RATE pin of the board)
   // |callback| will be called with the weight.
   virtual int InitLoop(std::function<void(double, int64_t)> weight_callback,
                        std::function<void()> error_callback);
 
-  ~RawScale();
+  // By default, the scale uses the hardware on SCALE_DATA (or the pins
+  // given to SetDataPins) and SCALE_SCLK.
+  // Other lines (like a SimulatedHx711) can be passed in instead.
+  explicit RawScale(std::unique_ptr<Hx711Lines> lines = nullptr)
+    : lines_(std::move(lines)) {
+    sem_init(&samples_ready_, 0, 0);
+  }
+
+  // Stops reading, and returns once the readings already taken have been
+  // delivered.  No callbacks are called after this.  The destructor calls
+  // it, but an owner whose callbacks use its own members should call it
+  // first.
+  void Stop();
+
+  virtual ~RawScale();
  protected:
   Status current_status_;
-  int data_fd_, sclk_fd_;
+  std::unique_ptr<Hx711Lines> lines_;
   bool reading_thread_enabled_ = false;
   std::thread reading_thread_;
   std::function<void(double, int64_t)> weight_callback_;
   std::function<void()> error_callback_;
-  static constexpr int kReqNumLowReadings = 3;
-  static constexpr int kMaxReadsBeforeGiveUp = 3000; // at least 3 seconds
+  std::function<void(Hx711Input, double, int64_t)> aux_callback_;
+  std::function<void(const uint32_t *, int, int64_t)> cell_callback_;
+  std::vector<uint8_t> data_pins_ = {SCALE_DATA};
+
+  // One reading, on its way from the reading thread to the callbacks.
+  struct Sample {
+    double reading;
+    Hx711Input input;
+    int64_t time;
+    int num_cells;
+    uint32_t cells[kMaxCells];
+  };
+  // 25 seconds at 10 SPS, 3 seconds at 80 SPS.
+  static constexpr size_t kSampleQueueSize = 256;
+  SpscRing<Sample, kSampleQueueSize> samples_;
+  // Posted for each sample pushed.  sem_post never blocks.
+  sem_t samples_ready_;
+  std::atomic<bool> delivery_thread_enabled_{false};
+  std::thread delivery_thread_;
+  std::vector<Hx711Input> input_sequence_ = {Hx711Input::A128};
+  size_t sequence_index_ = 0;
+  // The input the chip is converting now, set by the last read.
+  Hx711Input current_input_ = Hx711Input::A128;
+  static constexpr int kDataReadyTimeoutMs = 3000;
+  // The bits we keep: 24 data bits, plus the 25th pulse, which always
+  // reads 1.  Extra pulses for gain selection are not shifted in, so
+  // readings look the same regardless of the input.
   static constexpr int kHX711DataLength = 25;
+  static constexpr int kHX711MaxPulses = 27;
+  // SCLK high time.  The HX711 needs at least 0.2 us, and powers down after
+  // 60 us, so anything longer than kMaxPulseWidthUs is counted as long.
+  static constexpr int64_t kClockHighNs = 1000;
+  static constexpr int64_t kMaxPulseWidthUs = 50;
+  RealtimeOptions realtime_;
+  // Learns when conversions will be ready, so we can sleep until then.
+  DataReadyPredictor predictor_;
   // The one filter we perform:
   // If we screw up the timing, we will just read ones
   // for the rest of the data.  So we want to throw out data
@@ -64,6 +188,14 @@ class RawScale {
   // a 0 errno means print 'read 0 bytes' error
   void RecordError(int64_t tnow, int my_errorno);
 
+  // Records the timing of one reading (and its pulses) in current_status_.
+  void RecordTiming(const int64_t *pulse_ns, int num_pulses, int64_t read_ns);
+
+  void ApplyRealtime();
+
   void ReadingThread();
+  // Calls the callbacks for samples from the reading thread.
+  void DeliveryThread();
+  void Deliver(const Sample &sample);
 };
 
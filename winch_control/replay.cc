@@ -0,0 +1,151 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "replay.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include "raw_log.h"
+
+// Returns true if the file starts like a RawLogWriter log.
+static bool IsRawLog(const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (!file) return false;
+  char magic[4];
+  bool is_raw_log = fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+                    memcmp(magic, "WLOG", sizeof(magic)) == 0;
+  fclose(file);
+  return is_raw_log;
+}
+
+int LoadWeightLog(const char *path, std::vector<ReplaySample> *samples) {
+  samples->clear();
+  if (IsRawLog(path)) {
+    RawLogReader reader;
+    if (reader.Open(path)) return -1;
+    samples->reserve(reader.NumEntries());
+    RawLogSample sample;
+    while (reader.Next(&sample)) {
+      samples->push_back({sample.wall_us, sample.grams});
+    }
+    return 0;
+  }
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    printf("No weight log at %s\n", path);
+    return -1;
+  }
+  char line[256];
+  while (fgets(line, sizeof(line), file)) {
+    for (char *c = line; *c; ++c) {
+      if (*c == ',') *c = ' ';
+    }
+    double time_ms, raw, grams;
+    // Skips headers and partial lines.
+    if (sscanf(line, "%lf %lf %lf", &time_ms, &raw, &grams) != 3) continue;
+    samples->push_back({(int64_t)llround(time_ms * 1000), grams});
+  }
+  fclose(file);
+  return 0;
+}
+
+const char *ReplayEventName(ReplayEvent event) {
+  switch (event) {
+    case ReplayEvent::kDrain: return "drain";
+    case ReplayEvent::kLift: return "lift";
+    case ReplayEvent::kEmpty: return "empty";
+    default: return "unknown";
+  }
+}
+
+static bool ParseEvent(const char *name, ReplayEvent *event) {
+  for (int i = 0; i < kNumReplayEvents; ++i) {
+    if (strcmp(name, ReplayEventName(static_cast<ReplayEvent>(i))) == 0) {
+      *event = static_cast<ReplayEvent>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+// If |wall_us| is in one of |windows|.
+static bool InWindow(const ReplayLabels::Windows &windows, int64_t wall_us) {
+  for (const auto &window : windows) {
+    if (wall_us >= window.first && wall_us <= window.second) return true;
+  }
+  return false;
+}
+
+bool ReplayLabels::Armed(ReplayEvent event, int64_t wall_us) const {
+  const Windows &windows = arm[static_cast<int>(event)];
+  return windows.empty() || InWindow(windows, wall_us);
+}
+
+int LoadReplayLabels(const char *path, ReplayLabels *labels) {
+  *labels = ReplayLabels();
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    printf("No labels at %s\n", path);
+    return -1;
+  }
+  char line[256];
+  int line_number = 0;
+  int ret = 0;
+  while (fgets(line, sizeof(line), file)) {
+    line_number++;
+    char name[32];
+    long long start_ms, end_ms;
+    ReplayEvent event;
+    if (line[strspn(line, " \t\r\n")] == '\0' || line[0] == '#') continue;
+    if (sscanf(line, "ignore %31s %lld %lld", name, &start_ms, &end_ms) == 3 &&
+        ParseEvent(name, &event)) {
+      labels->ignore[static_cast<int>(event)].push_back({start_ms * 1000, end_ms * 1000});
+    } else if (sscanf(line, "arm %31s %lld %lld", name, &start_ms, &end_ms) == 3 &&
+               ParseEvent(name, &event)) {
+      labels->arm[static_cast<int>(event)].push_back({start_ms * 1000, end_ms * 1000});
+    } else if (sscanf(line, "%lld %31s", &start_ms, name) == 2 && ParseEvent(name, &event)) {
+      labels->labels.push_back({event, start_ms * 1000});
+    } else {
+      printf("%s:%d: bad label: %s", path, line_number, line);
+      ret = -1;
+    }
+  }
+  fclose(file);
+  std::sort(labels->labels.begin(), labels->labels.end(),
+            [](const ReplayLabels::Label &a, const ReplayLabels::Label &b) {
+              return a.wall_us < b.wall_us;
+            });
+  return ret;
+}
+
+EventScore ScoreEvent(const ReplayLabels &labels, ReplayEvent event,
+                      const std::vector<int64_t> &alarms, int64_t max_latency_us) {
+  EventScore score;
+  std::vector<bool> matched(alarms.size(), false);
+  double latency_sum = 0;
+  for (const ReplayLabels::Label &label : labels.labels) {
+    if (label.event != event) continue;
+    score.labels++;
+    auto first = std::lower_bound(alarms.begin(), alarms.end(), label.wall_us);
+    if (first == alarms.end() || *first - label.wall_us > max_latency_us ||
+        matched[first - alarms.begin()]) {
+      score.missed++;
+      continue;
+    }
+    matched[first - alarms.begin()] = true;
+    score.detected++;
+    double latency = (*first - label.wall_us) / 1e6;
+    latency_sum += latency;
+    score.max_latency_sec = std::max(score.max_latency_sec, latency);
+  }
+  if (score.detected) score.mean_latency_sec = latency_sum / score.detected;
+  for (size_t i = 0; i < alarms.size(); ++i) {
+    if (!matched[i] && !InWindow(labels.ignore[static_cast<int>(event)], alarms[i])) {
+      score.false_alarms++;
+    }
+  }
+  return score;
+}
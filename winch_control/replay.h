@@ -0,0 +1,66 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+// Tools for replaying recorded weight logs, and scoring the alarms they set
+// off against labels of what really happened.
+
+// A reading from a recorded log.
+struct ReplaySample {
+  int64_t wall_us;  // microseconds since the epoch
+  double grams;
+};
+
+// Reads a weight log: the binary log from RawLogWriter, or the text of
+// the old weight_data.txt or raw_log_tool's CSV, which have "time_ms raw
+// grams" on each line.  Returns -1 if the file can't be read.
+int LoadWeightLog(const char *path, std::vector<ReplaySample> *samples);
+
+enum class ReplayEvent { kDrain = 0, kLift, kEmpty, kNumEvents };
+constexpr int kNumReplayEvents = static_cast<int>(ReplayEvent::kNumEvents);
+// "drain", "lift" or "empty".
+const char *ReplayEventName(ReplayEvent event);
+
+// What really happened, from a labels file with lines like:
+//   <time ms> <drain|lift|empty>
+//   ignore <drain|lift|empty> <start ms> <end ms>
+//   arm <drain|lift|empty> <start ms> <end ms>
+// Lines starting with # are comments.  An ignore line is a time when
+// alarms of that kind don't count as false, like a planned drain.  If
+// there are arm lines for a kind, its alarm is only on in those times,
+// like BrewSession turns it on.  The empty alarm goes off whenever the
+// flow stops, so it needs them.
+struct ReplayLabels {
+  struct Label {
+    ReplayEvent event;
+    int64_t wall_us;
+  };
+  typedef std::vector<std::pair<int64_t, int64_t>> Windows;
+  std::vector<Label> labels;
+  Windows ignore[kNumReplayEvents];
+  Windows arm[kNumReplayEvents];
+
+  // If the alarm for |event| should be on at |wall_us|.
+  bool Armed(ReplayEvent event, int64_t wall_us) const;
+};
+
+// Returns -1 if the file can't be read, or has a bad line.
+int LoadReplayLabels(const char *path, ReplayLabels *labels);
+
+struct EventScore {
+  int labels = 0, detected = 0, missed = 0, false_alarms = 0;
+  double mean_latency_sec = 0, max_latency_sec = 0;
+};
+
+// Matches |alarms| (wall_us, in order) against the labels of |event|.
+// A label is detected by the first alarm up to |max_latency_us| after it.
+// The other alarms are false, unless they are in an ignore window.
+EventScore ScoreEvent(const ReplayLabels &labels, ReplayEvent event,
+                      const std::vector<int64_t> &alarms, int64_t max_latency_us);
@@ -0,0 +1,118 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "replay.h"
+#include "monotonic_clock.h"
+#include "raw_log.h"
+#include "gtest/gtest.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+
+namespace {
+
+class ReplayTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    char path[] = "/tmp/replay_testXXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    path_ = path;
+  }
+  void TearDown() override {
+    unlink(path_.c_str());
+  }
+  void WriteFile(const char *text) {
+    FILE *file = fopen(path_.c_str(), "w");
+    fputs(text, file);
+    fclose(file);
+  }
+
+  std::string path_;
+};
+
+TEST_F(ReplayTest, LoadsTextLogs) {
+  // The old weight_data.txt, then raw_log_tool's CSV.
+  WriteFile("1571234567890 8234567 1234.5\n"
+            "1571234567990 8234568 1234.75\n"
+            "1571234568\n"
+            "1571234568090.500,8234569.000,1235.00,2\n");
+  std::vector<ReplaySample> samples;
+  ASSERT_EQ(LoadWeightLog(path_.c_str(), &samples), 0);
+  ASSERT_EQ(samples.size(), 3u);
+  EXPECT_EQ(samples[0].wall_us, 1571234567890000LL);
+  EXPECT_EQ(samples[0].grams, 1234.5);
+  EXPECT_EQ(samples[2].wall_us, 1571234568090500LL);
+  EXPECT_EQ(samples[2].grams, 1235);
+}
+
+TEST_F(ReplayTest, LoadsRawLogs) {
+  unlink(path_.c_str());
+  RawLogWriter writer;
+  ASSERT_EQ(writer.Open(path_.c_str()), 0);
+  int64_t tstart = MonotonicNs();
+  for (int i = 0; i < 10; ++i) {
+    writer.Append(tstart + i * 100 * kNsPerMs, 800000 + i, 12000 + i, 0);
+  }
+  writer.Close();
+  std::vector<ReplaySample> samples;
+  ASSERT_EQ(LoadWeightLog(path_.c_str(), &samples), 0);
+  ASSERT_EQ(samples.size(), 10u);
+  EXPECT_EQ(samples[9].grams, 12009);
+  EXPECT_EQ(samples[9].wall_us - samples[0].wall_us, 900000);
+}
+
+TEST_F(ReplayTest, LoadsLabels) {
+  WriteFile("# a brew\n"
+            "\n"
+            "2000 drain\n"
+            "1000 lift\n"
+            "ignore drain 5000 6000\n"
+            "arm empty 7000 8000\n");
+  ReplayLabels labels;
+  ASSERT_EQ(LoadReplayLabels(path_.c_str(), &labels), 0);
+  ASSERT_EQ(labels.labels.size(), 2u);
+  EXPECT_EQ(labels.labels[0].event, ReplayEvent::kLift);  // in time order
+  EXPECT_EQ(labels.labels[0].wall_us, 1000000);
+  EXPECT_EQ(labels.labels[1].event, ReplayEvent::kDrain);
+  ASSERT_EQ(labels.ignore[static_cast<int>(ReplayEvent::kDrain)].size(), 1u);
+  EXPECT_EQ(labels.ignore[static_cast<int>(ReplayEvent::kDrain)][0].second, 6000000);
+  // With no arm lines, always armed.
+  EXPECT_TRUE(labels.Armed(ReplayEvent::kDrain, 0));
+  EXPECT_FALSE(labels.Armed(ReplayEvent::kEmpty, 6999999));
+  EXPECT_TRUE(labels.Armed(ReplayEvent::kEmpty, 7500000));
+
+  WriteFile("1000 spill\n");
+  EXPECT_EQ(LoadReplayLabels(path_.c_str(), &labels), -1);
+}
+
+TEST(ReplayScoreTest, ScoresAlarms) {
+  ReplayLabels labels;
+  labels.labels = {{ReplayEvent::kDrain, 10000000},   // found in 2 s
+                   {ReplayEvent::kDrain, 100000000},  // found too late
+                   {ReplayEvent::kDrain, 200000000},  // found in 4 s
+                   {ReplayEvent::kLift, 300000000}};
+  labels.ignore[static_cast<int>(ReplayEvent::kDrain)] = {{400000000, 500000000}};
+  std::vector<int64_t> alarms = {12000000,    // the first drain
+                                 50000000,    // false
+                                 190000000,   // the late one, and false
+                                 204000000,   // the third drain
+                                 450000000};  // ignored
+  EventScore score = ScoreEvent(labels, ReplayEvent::kDrain, alarms, 10000000);
+  EXPECT_EQ(score.labels, 3);
+  EXPECT_EQ(score.detected, 2);
+  EXPECT_EQ(score.missed, 1);
+  EXPECT_EQ(score.false_alarms, 2);
+  EXPECT_DOUBLE_EQ(score.mean_latency_sec, 3);
+  EXPECT_DOUBLE_EQ(score.max_latency_sec, 4);
+
+  score = ScoreEvent(labels, ReplayEvent::kLift, {}, 10000000);
+  EXPECT_EQ(score.labels, 1);
+  EXPECT_EQ(score.missed, 1);
+}
+
+}  // namespace
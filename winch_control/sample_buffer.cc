@@ -0,0 +1,49 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sample_buffer.h"
+
+#include <algorithm>
+
+constexpr size_t SampleBuffer::kCapacity;
+constexpr size_t SampleBuffer::kMaxSamples;
+
+void SampleBuffer::Push(int64_t time, double weight) {
+  uint64_t count = count_.load(std::memory_order_relaxed);
+  size_t slot = count & (kCapacity - 1);
+  times_[slot].store(time, std::memory_order_relaxed);
+  weights_[slot].store(weight, std::memory_order_relaxed);
+  // Publishes the sample.
+  count_.store(count + 1, std::memory_order_release);
+}
+
+size_t SampleBuffer::Snapshot(int64_t since_time, size_t max_points,
+                              SampleSnapshot *out) const {
+  if (max_points > kMaxSamples) max_points = kMaxSamples;
+  while (true) {
+    out->times.clear();
+    out->weights.clear();
+    uint64_t count = count_.load(std::memory_order_acquire);
+    uint64_t available = count < max_points ? count : max_points;
+    // Newest first:
+    uint64_t slots_read = 0;
+    while (slots_read < available) {
+      size_t slot = (count - ++slots_read) & (kCapacity - 1);
+      int64_t t = times_[slot].load(std::memory_order_relaxed);
+      if (t < since_time) break;
+      out->times.push_back(t);
+      out->weights.push_back(weights_[slot].load(std::memory_order_relaxed));
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // The writer may be part way through slot |now|.  If that (or anything
+    // before it) wrapped around onto the slots we read, try again.
+    uint64_t now = count_.load(std::memory_order_relaxed);
+    if (now - (count - slots_read) < kCapacity) {
+      break;
+    }
+  }
+  std::reverse(out->times.begin(), out->times.end());
+  std::reverse(out->weights.begin(), out->weights.end());
+  return out->size();
+}
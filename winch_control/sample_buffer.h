@@ -0,0 +1,56 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+// A copy of some of the samples in a SampleBuffer, oldest first.
+// Keep one around and reuse it, so snapshots don't allocate.
+struct SampleSnapshot {
+  std::vector<int64_t> times;
+  std::vector<double> weights;
+  size_t size() const { return times.size(); }
+  bool empty() const { return times.empty(); }
+};
+
+// The recent (time, weight) samples of the scale, in preallocated arrays.
+// One thread writes, and any number of threads can read at the same time.
+// Readers never block the writer: they copy what they need, and check the
+// sample count afterwards to see if the writer overwrote any of it while
+// they were copying (like a seqlock).  If it did, they copy again.
+class SampleBuffer {
+ public:
+  // Samples kept.  The last few slots are slack, so readers copying the
+  // oldest samples aren't racing the writer.
+  static constexpr size_t kCapacity = 1024;
+  static constexpr size_t kMaxSamples = 1000;
+
+  // Writer only.
+  void Push(int64_t time, double weight);
+
+  // Fills |out| with up to |max_points| of the newest samples at or after
+  // |since_time|.  Returns the number of samples copied.
+  size_t Snapshot(int64_t since_time, size_t max_points, SampleSnapshot *out) const;
+
+  // The number of samples ever pushed.
+  uint64_t Count() const { return count_.load(std::memory_order_acquire); }
+  size_t Size() const {
+    uint64_t count = Count();
+    return count < kMaxSamples ? count : kMaxSamples;
+  }
+
+ private:
+  static_assert((kCapacity & (kCapacity - 1)) == 0, "kCapacity must be a power of 2");
+  static_assert(kMaxSamples < kCapacity, "Need some slack");
+
+  // Atomic so the readers' copies are well defined even when they lose a
+  // race with the writer.  Relaxed loads and stores are plain moves.
+  std::atomic<int64_t> times_[kCapacity];
+  std::atomic<double> weights_[kCapacity];
+  std::atomic<uint64_t> count_{0};
+};
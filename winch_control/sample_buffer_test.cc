@@ -0,0 +1,78 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sample_buffer.h"
+#include "gtest/gtest.h"
+
+#include <thread>
+
+namespace {
+
+TEST(SampleBuffer, SnapshotIsOldestFirst) {
+  SampleBuffer buffer;
+  SampleSnapshot snap;
+  EXPECT_EQ(buffer.Snapshot(0, 10, &snap), 0u);
+  for (int i = 1; i <= 5; ++i) {
+    buffer.Push(i * 100, i * 2.0);
+  }
+  ASSERT_EQ(buffer.Snapshot(0, 10, &snap), 5u);
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_EQ(snap.times[i], (i + 1) * 100);
+    EXPECT_EQ(snap.weights[i], (i + 1) * 2.0);
+  }
+  // Newest points only:
+  ASSERT_EQ(buffer.Snapshot(0, 2, &snap), 2u);
+  EXPECT_EQ(snap.times[0], 400);
+  EXPECT_EQ(snap.times[1], 500);
+}
+
+TEST(SampleBuffer, SinceTime) {
+  SampleBuffer buffer;
+  SampleSnapshot snap;
+  for (int i = 1; i <= 5; ++i) {
+    buffer.Push(i * 100, i);
+  }
+  ASSERT_EQ(buffer.Snapshot(300, 10, &snap), 3u);
+  EXPECT_EQ(snap.times[0], 300);
+  EXPECT_EQ(buffer.Snapshot(501, 10, &snap), 0u);
+}
+
+TEST(SampleBuffer, KeepsMaxSamples) {
+  SampleBuffer buffer;
+  SampleSnapshot snap;
+  int total = SampleBuffer::kCapacity * 3 + 7;
+  for (int i = 0; i < total; ++i) {
+    buffer.Push(i, i);
+  }
+  EXPECT_EQ(buffer.Size(), SampleBuffer::kMaxSamples);
+  ASSERT_EQ(buffer.Snapshot(0, 5000, &snap), SampleBuffer::kMaxSamples);
+  EXPECT_EQ(snap.times.front(), total - (int)SampleBuffer::kMaxSamples);
+  EXPECT_EQ(snap.times.back(), total - 1);
+}
+
+// Readers should always see consistent, consecutive samples, even while
+// the writer laps the buffer.
+TEST(SampleBuffer, ConcurrentReaders) {
+  SampleBuffer buffer;
+  std::atomic<bool> done(false);
+  std::thread writer([&]() {
+    for (int64_t i = 1; i <= 200000; ++i) {
+      buffer.Push(i, i * 0.5);
+    }
+    done = true;
+  });
+  int bad = 0;
+  SampleSnapshot snap;
+  while (!done) {
+    buffer.Snapshot(0, SampleBuffer::kMaxSamples, &snap);
+    for (size_t i = 0; i < snap.size(); ++i) {
+      if (snap.weights[i] != snap.times[i] * 0.5) bad++;
+      if (i && snap.times[i] != snap.times[i - 1] + 1) bad++;
+    }
+  }
+  writer.join();
+  EXPECT_EQ(bad, 0);
+}
+
+}  // namespace
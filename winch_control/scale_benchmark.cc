@@ -0,0 +1,379 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Measures what the scale pipeline costs per sample: the filtering of each
+// reading (with and without the draining checks), GetWeight, FitSlope,
+// GetWeight and GetFlow while the readings are coming in, and the raw log,
+// at 80 samples per second.  A steady scale that sets off the draining
+// alarm is reported as a failure.
+// Prints a table, and writes the results as JSON, so runs on the UP board
+// can be compared between builds.
+//
+// usage: scale_benchmark [json file] [samples]
+// The json file defaults to scale_benchmark.json, samples to 200000.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "monotonic_clock.h"
+#include "raw_log.h"
+#include "scale_filter.h"
+#include "window_stats.h"
+
+// Counts the allocations made by each thread.
+static thread_local int64_t t_allocations = 0;
+
+void *operator new(size_t size) {
+  t_allocations++;
+  void *p = malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+// The HX711 with the RATE pin high, the fastest the scale goes.
+static constexpr int64_t kSamplePeriodNs = 12500 * kNsPerUs;
+// Readings before the timing starts, so the filter has measured the
+// sample period and its windows are full.
+static constexpr int kWarmupSamples = 2000;
+// TestRig's drain window, in points at kSamplePeriodNs, as the filter
+// sizes it.
+static constexpr size_t kDrainPoints =
+    TestRig::kPointsToCheckForDrain * TestRig::kDefaultSamplePeriodMs * kNsPerMs /
+    kSamplePeriodNs;
+static constexpr int kReaderThreads = 3;
+
+struct Result {
+  std::string name;
+  int64_t count = 0;  // samples or calls
+  double ns_per_op = 0, allocs_per_op = 0;
+  // Of each op, if they were timed one at a time.
+  int64_t p50_ns = 0, p99_ns = 0, max_ns = 0;
+  // Anything else worth knowing, by name.
+  std::vector<std::pair<std::string, double>> extra;
+};
+
+static std::vector<Result> results;
+
+// Fills in the percentiles.  Sorts |times|.
+static void SetPercentiles(std::vector<int64_t> *times, Result *result) {
+  if (times->empty()) return;
+  std::sort(times->begin(), times->end());
+  result->p50_ns = (*times)[times->size() / 2];
+  result->p99_ns = (*times)[times->size() * 99 / 100];
+  result->max_ns = times->back();
+}
+
+// A steady kettle: 12 kg with a few grams of noise.
+class Readings {
+ public:
+  double Next() { return 12000 + noise_(gen_); }
+ private:
+  std::mt19937 gen_{1};
+  std::normal_distribution<double> noise_{0, 3.0};
+};
+
+// A filter fed through its FakeScale, like fake_scale_test.
+class Scale {
+ public:
+  Scale() : filter_("") {
+    filter_.DisableForTest();
+    filter_.InitLoop(nullptr);
+    fake_scale_ = filter_.GetFakeScale();
+    fake_scale_->StopLoop();
+  }
+  // Feeds one reading through OnNewMeasurement.
+  void Input() {
+    fake_scale_->InputData(readings_.Next(), time_);
+    time_ += kSamplePeriodNs;
+  }
+  TestScaleFilter *filter() { return &filter_; }
+
+ private:
+  TestScaleFilter filter_;
+  FakeScale *fake_scale_;
+  Readings readings_;
+  int64_t time_ = kNsPerSec;
+};
+
+static void BenchmarkMeasurement(const char *name, bool draining_alarm, int samples) {
+  Scale scale;
+  // The scale is steady, so any alarm is a false one.  It is re-armed
+  // every kRearmSamples, so each arming gets a chance to go off.
+  static constexpr int kRearmSamples = 160;
+  std::atomic<int> false_alarms(0);
+  int armings = 0;
+  auto arm = [&]() {
+    scale.filter()->EnableDrainingAlarm([&false_alarms]() { false_alarms++; });
+    armings++;
+  };
+  for (int i = 0; i < kWarmupSamples; ++i) scale.Input();
+  if (draining_alarm) arm();
+  std::vector<int64_t> times(samples);
+  int64_t allocations = t_allocations;
+  int64_t tstart = MonotonicNs();
+  for (int i = 0; i < samples; ++i) {
+    int64_t t0 = MonotonicNs();
+    scale.Input();
+    times[i] = MonotonicNs() - t0;
+    if (draining_alarm && i % kRearmSamples == kRearmSamples - 1) arm();
+  }
+  Result result;
+  result.name = name;
+  result.count = samples;
+  result.ns_per_op = (MonotonicNs() - tstart) / (double)samples;
+  result.allocs_per_op = (t_allocations - allocations) / (double)samples;
+  SetPercentiles(&times, &result);
+  if (draining_alarm) {
+    // Let the dispatcher deliver the last alarms.
+    usleep(100000);
+    result.extra.push_back({"armings", (double)armings});
+    result.extra.push_back({"false_alarms", (double)false_alarms});
+    if (false_alarms) {
+      printf("FAILED: the draining alarm went off %d times in %d armings on a "
+             "steady scale\n", (int)false_alarms, armings);
+    }
+  }
+  results.push_back(result);
+}
+
+// GetWeight(0) is the running mean.  With a time, it copies the samples.
+static void BenchmarkGetWeight(int calls) {
+  Scale scale;
+  for (int i = 0; i < kWarmupSamples; ++i) scale.Input();
+  int64_t since = kNsPerSec + (kWarmupSamples - kDrainPoints) * kSamplePeriodNs;
+  for (int64_t since_time : {(int64_t)0, since}) {
+    std::vector<int64_t> times(calls);
+    double sum = 0;
+    int64_t allocations = t_allocations;
+    int64_t tstart = MonotonicNs();
+    for (int i = 0; i < calls; ++i) {
+      int64_t t0 = MonotonicNs();
+      sum += scale.filter()->GetWeight(since_time);
+      times[i] = MonotonicNs() - t0;
+    }
+    Result result;
+    result.name = since_time ? "GetWeight(since)" : "GetWeight(0)";
+    result.count = calls;
+    result.ns_per_op = (MonotonicNs() - tstart) / (double)calls;
+    result.allocs_per_op = (t_allocations - allocations) / (double)calls;
+    SetPercentiles(&times, &result);
+    result.extra.push_back({"mean_grams", sum / calls});
+    results.push_back(result);
+  }
+}
+
+// The slope fits behind CheckDraining: the old batch FitSlope, and the
+// running WindowStats that replaced it.
+static void BenchmarkSlopes(int calls) {
+  const size_t kPoints = kDrainPoints;
+  Readings readings;
+  std::vector<double> weights(kPoints);
+  std::vector<int64_t> times(kPoints);
+  WindowStats stats(kPoints);
+  for (size_t i = 0; i < kPoints; ++i) {
+    weights[i] = readings.Next();
+    times[i] = i * kSamplePeriodNs;
+    stats.Add(times[i], weights[i]);
+  }
+  double sum = 0;
+  int64_t allocations = t_allocations;
+  int64_t tstart = MonotonicNs();
+  for (int i = 0; i < calls; ++i) {
+    weights[i % kPoints] += 0.001;
+    sum += FitSlope(weights, times).slope;
+  }
+  Result fit;
+  fit.name = "FitSlope(" + std::to_string(kPoints) + ")";
+  fit.count = calls;
+  fit.ns_per_op = (MonotonicNs() - tstart) / (double)calls;
+  fit.allocs_per_op = (t_allocations - allocations) / (double)calls;
+  results.push_back(fit);
+
+  allocations = t_allocations;
+  tstart = MonotonicNs();
+  for (int i = 0; i < calls; ++i) {
+    stats.Add((kPoints + i) * kSamplePeriodNs, readings.Next());
+    sum += stats.Slope().slope;
+  }
+  Result running;
+  running.name = "WindowStats::Add+Slope(" + std::to_string(kPoints) + ")";
+  running.count = calls;
+  running.ns_per_op = (MonotonicNs() - tstart) / (double)calls;
+  running.allocs_per_op = (t_allocations - allocations) / (double)calls;
+  running.extra.push_back({"checksum", sum});
+  results.push_back(running);
+}
+
+// Readers hammer GetWeight and GetFlow while the readings come in.  GetFlow
+// takes the lock the measurement thread holds while it publishes its
+// estimates, so how long a GetFlow call takes bounds how long that lock
+// is held (plus the wait for it).
+static void BenchmarkContention(int samples) {
+  Scale scale;
+  for (int i = 0; i < kWarmupSamples; ++i) scale.Input();
+  std::atomic<bool> running(true);
+  std::vector<std::vector<int64_t>> flow_times(kReaderThreads);
+  std::vector<int64_t> weight_calls(kReaderThreads);
+  std::vector<std::thread> readers;
+  for (int r = 0; r < kReaderThreads; ++r) {
+    flow_times[r].reserve(samples);
+    readers.emplace_back([&, r]() {
+        while (running) {
+          scale.filter()->GetWeight(0);
+          weight_calls[r]++;
+          int64_t t0 = MonotonicNs();
+          scale.filter()->GetFlow();
+          if (flow_times[r].size() < flow_times[r].capacity()) {
+            flow_times[r].push_back(MonotonicNs() - t0);
+          }
+        }
+      });
+  }
+  std::vector<int64_t> times(samples);
+  int64_t allocations = t_allocations;
+  int64_t tstart = MonotonicNs();
+  for (int i = 0; i < samples; ++i) {
+    int64_t t0 = MonotonicNs();
+    scale.Input();
+    times[i] = MonotonicNs() - t0;
+  }
+  int64_t elapsed = MonotonicNs() - tstart;
+  running = false;
+  for (std::thread &reader : readers) reader.join();
+
+  Result result;
+  result.name = "OnNewMeasurement, " + std::to_string(kReaderThreads) + " readers";
+  result.count = samples;
+  result.ns_per_op = elapsed / (double)samples;
+  result.allocs_per_op = (t_allocations - allocations) / (double)samples;
+  SetPercentiles(&times, &result);
+  std::vector<int64_t> all_flow_times;
+  int64_t total_weight_calls = 0;
+  for (int r = 0; r < kReaderThreads; ++r) {
+    all_flow_times.insert(all_flow_times.end(), flow_times[r].begin(), flow_times[r].end());
+    total_weight_calls += weight_calls[r];
+  }
+  Result flow;
+  SetPercentiles(&all_flow_times, &flow);
+  result.extra.push_back({"reader_calls_per_sec", total_weight_calls * 1e9 / elapsed});
+  result.extra.push_back({"get_flow_p50_ns", (double)flow.p50_ns});
+  result.extra.push_back({"get_flow_p99_ns", (double)flow.p99_ns});
+  result.extra.push_back({"get_flow_max_ns", (double)flow.max_ns});
+  results.push_back(result);
+}
+
+// Appends, flushing once a second like the logger thread.
+static void BenchmarkRawLog(int samples) {
+  char path[] = "/tmp/scale_benchmarkXXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    printf("Failed to make a file for the raw log\n");
+    return;
+  }
+  close(fd);
+  unlink(path);
+  RawLogWriter writer;
+  if (writer.Open(path)) return;
+  Readings readings;
+  std::vector<int64_t> flush_times;
+  int64_t time = MonotonicNs();
+  int64_t allocations = t_allocations;
+  int64_t append_ns = 0;
+  for (int i = 0; i < samples; ++i) {
+    int64_t t0 = MonotonicNs();
+    writer.Append(time, readings.Next() * 100, readings.Next(), 0);
+    append_ns += MonotonicNs() - t0;
+    time += kSamplePeriodNs;
+    if (i % 10 == 9) {
+      t0 = MonotonicNs();
+      writer.Flush();
+      flush_times.push_back(MonotonicNs() - t0);
+    }
+  }
+  int64_t t0 = MonotonicNs();
+  writer.Close();
+  int64_t close_ns = MonotonicNs() - t0;
+  unlink(path);
+
+  Result result;
+  result.name = "RawLogWriter::Append";
+  result.count = samples;
+  result.ns_per_op = append_ns / (double)samples;
+  result.allocs_per_op = (t_allocations - allocations) / (double)samples;
+  Result flush;
+  SetPercentiles(&flush_times, &flush);
+  result.extra.push_back({"flush_p50_ns", (double)flush.p50_ns});
+  result.extra.push_back({"flush_max_ns", (double)flush.max_ns});
+  result.extra.push_back({"close_ns", (double)close_ns});
+  result.extra.push_back({"dropped", (double)writer.Dropped()});
+  results.push_back(result);
+}
+
+static int WriteJson(const char *path) {
+  FILE *out = fopen(path, "w");
+  if (!out) {
+    printf("Failed to open %s\n", path);
+    return -1;
+  }
+  utsname host;
+  uname(&host);
+  fprintf(out, "{\n  \"context\": {\"host\": \"%s\", \"machine\": \"%s\", "
+          "\"cpus\": %u, \"built\": \"%s %s\"},\n  \"benchmarks\": [\n",
+          host.nodename, host.machine, std::thread::hardware_concurrency(),
+          __DATE__, __TIME__);
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result &r = results[i];
+    fprintf(out, "    {\"name\": \"%s\", \"count\": %lld, \"ns_per_op\": %.1f, "
+            "\"allocs_per_op\": %.3f, \"p50_ns\": %lld, \"p99_ns\": %lld, "
+            "\"max_ns\": %lld", r.name.c_str(), (long long)r.count, r.ns_per_op,
+            r.allocs_per_op, (long long)r.p50_ns, (long long)r.p99_ns,
+            (long long)r.max_ns);
+    for (const auto &extra : r.extra) {
+      fprintf(out, ", \"%s\": %.1f", extra.first.c_str(), extra.second);
+    }
+    fprintf(out, "}%s\n", i + 1 < results.size() ? "," : "");
+  }
+  fprintf(out, "  ]\n}\n");
+  fclose(out);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  const char *json_path = argc > 1 ? argv[1] : "scale_benchmark.json";
+  int samples = argc > 2 ? atoi(argv[2]) : 200000;
+  if (samples <= 0) {
+    printf("usage: %s [json file] [samples]\n", argv[0]);
+    return -1;
+  }
+
+  BenchmarkMeasurement("OnNewMeasurement", false, samples);
+  BenchmarkMeasurement("OnNewMeasurement+CheckDraining", true, samples);
+  BenchmarkGetWeight(samples);
+  BenchmarkSlopes(samples);
+  BenchmarkContention(samples);
+  BenchmarkRawLog(samples);
+
+  printf("%-40s %10s %10s %8s %8s %8s\n", "", "ns/op", "allocs/op", "p50", "p99", "max");
+  for (const Result &r : results) {
+    printf("%-40s %10.1f %10.3f %8lld %8lld %8lld\n", r.name.c_str(), r.ns_per_op,
+           r.allocs_per_op, (long long)r.p50_ns, (long long)r.p99_ns, (long long)r.max_ns);
+    for (const auto &extra : r.extra) {
+      printf("    %s: %.1f\n", extra.first.c_str(), extra.second);
+    }
+  }
+  return WriteJson(json_path);
+}
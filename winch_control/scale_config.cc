@@ -0,0 +1,23 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "scale_config.h"
+
+// RuntimeRig starts out as the brewhouse rig.
+double RuntimeRig::kKettleLiftedThresholdGrams = Rig10Sps::kKettleLiftedThresholdGrams;
+size_t RuntimeRig::kPointsForFiltering = Rig10Sps::kPointsForFiltering;
+size_t RuntimeRig::kPointsForQuickFiltering = Rig10Sps::kPointsForQuickFiltering;
+size_t RuntimeRig::kVibrationFftSize = Rig10Sps::kVibrationFftSize;
+size_t RuntimeRig::kSettlePoints = Rig10Sps::kSettlePoints;
+size_t RuntimeRig::kMinPointsForSettling = Rig10Sps::kMinPointsForSettling;
+double RuntimeRig::kWeightToleranceGrams = Rig10Sps::kWeightToleranceGrams;
+double RuntimeRig::kDefaultSamplePeriodMs = Rig10Sps::kDefaultSamplePeriodMs;
+double RuntimeRig::kDrainingThreshGramsPerSecond = Rig10Sps::kDrainingThreshGramsPerSecond;
+double RuntimeRig::kDrainingConfidenceThresh = Rig10Sps::kDrainingConfidenceThresh;
+double RuntimeRig::kTotalLossThreshold = Rig10Sps::kTotalLossThreshold;
+double RuntimeRig::kDrainingRateSigmas = Rig10Sps::kDrainingRateSigmas;
+size_t RuntimeRig::kPointsToCheckForDrain = Rig10Sps::kPointsToCheckForDrain;
+size_t RuntimeRig::kPointsToCheckForDrainQuickly = Rig10Sps::kPointsToCheckForDrainQuickly;
+double RuntimeRig::kEmptyThresholdGrams = Rig10Sps::kEmptyThresholdGrams;
+double RuntimeRig::kDrainDoneGramsPerSec = Rig10Sps::kDrainDoneGramsPerSec;
@@ -0,0 +1,113 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stddef.h>
+
+// The tuning of a ScaleFilter, for one rig.  BasicScaleFilter is templated
+// on one of these, so the window sizes and thresholds are compile time
+// constants.  To add a rig, add a struct here and an instantiation at the
+// bottom of scale_filter.cc.  The point counts are for
+// kDefaultSamplePeriodMs; the filter scales them to the measured sample
+// period, so the windows cover the same time at any rate.
+
+// HX711 with the RATE pin low: 10 samples per second.  This is the
+// brewhouse scale.
+struct Rig10Sps {
+  // The Kettle weighs about 8kg, so 2kg is pretty conservative.
+  // This is the threshold below which we declare the kettle lifted off
+  // of the scale.
+  static constexpr double kKettleLiftedThresholdGrams = 2000;
+  static constexpr size_t kPointsForFiltering = 30;
+  // While the pump's vibration is being filtered out.
+  static constexpr size_t kPointsForQuickFiltering = 10;  //TODO: check value
+  // Readings in each FFT of the vibration filter.  The notches start after
+  // one and a half of these with the pump on.
+  static constexpr size_t kVibrationFftSize = 64;  //TODO: check value
+  // Readings on a plateau for WaitForPlateau.
+  static constexpr size_t kSettlePoints = 20;
+  // MeasureWeight needs this many points to trust the standard error.
+  static constexpr size_t kMinPointsForSettling = 5;
+  static constexpr double kWeightToleranceGrams = 2.0;  //TODO: check value
+  // Until we have measured it.
+  static constexpr double kDefaultSamplePeriodMs = 100;
+  // Represents slope / ave deviation from slope
+  static constexpr double kDrainingThreshGramsPerSecond = -50.0;  //TODO: check value
+  // On the RMS deviation from the slope.  This was 10 on the mean absolute
+  // deviation, which is sqrt(pi / 2) times smaller for normal noise.
+  static constexpr double kDrainingConfidenceThresh = 12.5;  //TODO: check value
+  static constexpr double kTotalLossThreshold = 200.0;  //TODO: check value
+  // The draining alarm also goes off if the filtered flow rate is below
+  // kDrainingThreshGramsPerSecond by this many standard deviations.
+  static constexpr double kDrainingRateSigmas = 3.0;  //TODO: check value
+  // Data points to use when checking for draining.  Note that each point
+  // delays the warning by one sample period.
+  static constexpr size_t kPointsToCheckForDrain = 30;
+  static constexpr size_t kPointsToCheckForDrainQuickly = 12;  //TODO: check value
+  // Below this weight, we declare the grainfather empty
+  static constexpr double kEmptyThresholdGrams = 9000;
+  // Below this flow, draining is done.  About 2 liters an hour.
+  static constexpr double kDrainDoneGramsPerSec = 0.5;  //TODO: check value
+};
+
+// HX711 with the RATE pin high: 80 samples per second.  The readings are
+// noisier, so the windows have more points.
+struct Rig80Sps : Rig10Sps {
+  static constexpr size_t kPointsForFiltering = 120;  //TODO: check value
+  static constexpr size_t kPointsForQuickFiltering = 40;  //TODO: check value
+  static constexpr size_t kVibrationFftSize = 256;  //TODO: check value
+  static constexpr size_t kSettlePoints = 80;  //TODO: check value
+  static constexpr size_t kMinPointsForSettling = 20;  //TODO: check value
+  static constexpr double kDefaultSamplePeriodMs = 12.5;
+  static constexpr size_t kPointsToCheckForDrain = 120;  //TODO: check value
+  static constexpr size_t kPointsToCheckForDrainQuickly = 48;  //TODO: check value
+};
+
+// For the tests, so retuning a real rig doesn't change what they test.
+struct TestRig : Rig10Sps {
+};
+
+// For experiments: the same values, but they can be changed at run time.
+// Set them before making a BasicScaleFilter<RuntimeRig>, and don't change
+// them while it runs.
+struct RuntimeRig {
+  static double kKettleLiftedThresholdGrams;
+  static size_t kPointsForFiltering;
+  static size_t kPointsForQuickFiltering;
+  static size_t kVibrationFftSize;
+  static size_t kSettlePoints;
+  static size_t kMinPointsForSettling;
+  static double kWeightToleranceGrams;
+  static double kDefaultSamplePeriodMs;
+  static double kDrainingThreshGramsPerSecond;
+  static double kDrainingConfidenceThresh;
+  static double kTotalLossThreshold;
+  static double kDrainingRateSigmas;
+  static size_t kPointsToCheckForDrain;
+  static size_t kPointsToCheckForDrainQuickly;
+  static double kEmptyThresholdGrams;
+  static double kDrainDoneGramsPerSec;
+
+  // Copies the values of a rig.
+  template <class Rig>
+  static void Set() {
+    kKettleLiftedThresholdGrams = Rig::kKettleLiftedThresholdGrams;
+    kPointsForFiltering = Rig::kPointsForFiltering;
+    kPointsForQuickFiltering = Rig::kPointsForQuickFiltering;
+    kVibrationFftSize = Rig::kVibrationFftSize;
+    kSettlePoints = Rig::kSettlePoints;
+    kMinPointsForSettling = Rig::kMinPointsForSettling;
+    kWeightToleranceGrams = Rig::kWeightToleranceGrams;
+    kDefaultSamplePeriodMs = Rig::kDefaultSamplePeriodMs;
+    kDrainingThreshGramsPerSecond = Rig::kDrainingThreshGramsPerSecond;
+    kDrainingConfidenceThresh = Rig::kDrainingConfidenceThresh;
+    kTotalLossThreshold = Rig::kTotalLossThreshold;
+    kDrainingRateSigmas = Rig::kDrainingRateSigmas;
+    kPointsToCheckForDrain = Rig::kPointsToCheckForDrain;
+    kPointsToCheckForDrainQuickly = Rig::kPointsToCheckForDrainQuickly;
+    kEmptyThresholdGrams = Rig::kEmptyThresholdGrams;
+    kDrainDoneGramsPerSec = Rig::kDrainDoneGramsPerSec;
+  }
+};
@@ -4,12 +4,16 @@
 
 #include "scale_filter.h"
 
+#include <algorithm>
+#include <chrono>
 #include <fstream>
+#include <math.h>
 #include <vector>
 #include <thread>
 #include <functional>
 #include "gpio.h"
 #include "brew_types.h"
+#include "monotonic_clock.h"
 #include "raw_scale.h"
 
 // Gets the weight reading of the scale.
@@ -17,43 +21,112 @@
 // reading.  If you want to limit how far back the data is taken from,
 // you can pass in a time, the averaging will be limited to after that
 // point.
-double ScaleFilter::GetWeight(int64_t since_time) {
+template <class Rig>
+double BasicScaleFilter<Rig>::GetWeight(int64_t since_time) {
   return FilterData(since_time);
 }
 
-// This function does a silly amount of blocking, but we've got lots of time...
-double ScaleFilter::GetWeightStartingNow(unsigned max_points, int64_t timeout) {
-  // Wait until we see max_points points of data, or until timeout
-  int64_t tnow = GetTimeMsec();
-  unsigned num_points = 0;
-  do {
-    num_points = 0;
-    if (!disable_for_test_) {
-      usleep(100000); //at least sleep for the time in between readings
+template <class Rig>
+bool BasicScaleFilter<Rig>::WaitForSamplesAfter(uint64_t count, int64_t deadline) {
+  std::unique_lock<std::mutex> lock(new_sample_lock_);
+  while (samples_.Count() <= count) {
+    int64_t left = deadline - MonotonicNs();
+    if (left <= 0) return false;
+    new_sample_cv_.wait_for(lock, std::chrono::nanoseconds(left));
+  }
+  return true;
+}
+
+template <class Rig>
+typename BasicScaleFilter<Rig>::WeightReading BasicScaleFilter<Rig>::MeasureWeight(
+    double tolerance_grams, size_t max_points, int64_t timeout) {
+  return CollectReadings(tolerance_grams, max_points, timeout, nullptr);
+}
+
+template <class Rig>
+typename BasicScaleFilter<Rig>::WeightReading BasicScaleFilter<Rig>::CollectReadings(
+    double tolerance_grams, size_t max_points, int64_t timeout, double *raw_mean) {
+  int64_t tstart = MonotonicNs();
+  if (timeout == 0) {
+    timeout = 2 * max_points * sample_period_ms_;
+  }
+  int64_t deadline = tstart + timeout * kNsPerMs;
+  // Running mean and variance of the raw readings (Welford's method)
+  size_t n = 0;
+  double mean = 0, m2 = 0;
+  WeightReading reading;
+  SampleSnapshot snapshot;
+  int64_t since = tstart;
+  while (true) {
+    uint64_t count = samples_.Count();
+    samples_.Snapshot(since, max_points - n, &snapshot);
+    for (size_t i = 0; i < snapshot.size(); ++i) {
+      n++;
+      double delta = snapshot.weights[i] - mean;
+      mean += delta / n;
+      m2 += delta * (snapshot.weights[i] - mean);
     }
-    // find out how many points we have accumulated:
-    for (unsigned i = 0; i < weight_data_.size() && i <= max_points; ++i) {
-      if (time_data_[time_data_.size() - 1 - i] < tnow) {
-        break;
-      } else {
-        num_points++;
-      }
+    if (snapshot.size()) {
+      since = snapshot.times.back() + 1;
     }
-    // printf("%s: wait loop points: %u\n", __func__, num_points);
-  } while ((num_points < max_points) && (GetTimeMsec() - tnow < timeout));
-  if (num_points == 0) {
+    if (n > 1) {
+      reading.std_error = sqrt(m2 / (n - 1) / n) * fabs(scale_);
+      reading.settled = n >= Rig::kMinPointsForSettling &&
+                        reading.std_error <= tolerance_grams;
+    }
+    if (reading.settled || n >= max_points) break;
+    if (!WaitForSamplesAfter(count, deadline)) break;
+  }
+  if (n == 0) {
     printf("We have timed out with no points!\n");
-    return 0.0;
+    return reading;
   }
-  // How much should we wait?
-  // we won't use more than kPointsForFiltering
-  // measuring period * kPointsForFiltering
-  return FilterData(tnow);
+  reading.grams = ToGrams(mean);
+  reading.num_points = n;
+  if (raw_mean) *raw_mean = mean;
+  return reading;
+}
+
+template <class Rig>
+FlowEstimate BasicScaleFilter<Rig>::GetFlow() {
+  std::lock_guard<std::mutex> lock(estimates_lock_);
+  return flow_;
 }
 
+template <class Rig>
+Plateau BasicScaleFilter<Rig>::GetPlateau() {
+  std::lock_guard<std::mutex> lock(estimates_lock_);
+  return plateau_;
+}
 
+template <class Rig>
+bool BasicScaleFilter<Rig>::WaitForPlateau(int64_t timeout, double *grams) {
+  int64_t tstart = MonotonicNs();
+  int64_t deadline = tstart + timeout * kNsPerMs;
+  uint64_t count = samples_.Count();
+  // Readings since we started, all on the current plateau
+  size_t steady = 0;
+  while (WaitForSamplesAfter(count, deadline)) {
+    uint64_t new_count = samples_.Count();
+    Plateau plateau = GetPlateau();
+    if (!plateau.settled) {
+      steady = 0;
+    } else if (plateau.start_time >= tstart) {
+      steady = plateau.num_points;
+    } else {
+      steady += new_count - count;
+    }
+    count = new_count;
+    if (steady >= Rig::kSettlePoints) {
+      *grams = plateau.grams;
+      return true;
+    }
+  }
+  return false;
+}
 
-void ScaleFilter::SetPeriodicWeightCallback(int64_t reporting_interval,
+template <class Rig>
+void BasicScaleFilter<Rig>::SetPeriodicWeightCallback(int64_t reporting_interval,
     std::function<void(double, int64_t)> callback) {
   periodic_update_period_ = reporting_interval;
   periodic_callback_ = callback;
@@ -61,19 +134,24 @@ void ScaleFilter::SetPeriodicWeightCallback(int64_t reporting_interval,
 
 // Checks if the weight is below the Kettle lifted threshold.
 // doesn't need to get as accurate reading so can return faster.
-bool ScaleFilter::HasKettleLifted() {
-  if (weight_data_.size() == 0) return false;
-  return ToGrams(weight_data_.back()) < kKettleLiftedThresholdGrams;
+template <class Rig>
+bool BasicScaleFilter<Rig>::HasKettleLifted() {
+  SampleSnapshot latest;
+  if (!samples_.Snapshot(0, 1, &latest)) return false;
+  return ToGrams(latest.weights[0]) < Rig::kKettleLiftedThresholdGrams;
 }
 
 // Enabes a check if the kettle is losing weight at a rate
 // indicating it is draining somewhere.
-void ScaleFilter::EnableDrainingAlarm(std::function<void()> callback) {
-  draining_update_period_ = kCheckDrainingIntervalMs;
+template <class Rig>
+void BasicScaleFilter<Rig>::EnableDrainingAlarm(std::function<void()> callback) {
+  // Whatever happened to the weight before now doesn't count.
+  reset_trends_ = true;
   draining_callback_ = callback;
 }
 
-void ScaleFilter::DisableDrainingAlarm() {
+template <class Rig>
+void BasicScaleFilter<Rig>::DisableDrainingAlarm() {
   draining_callback_ = nullptr;
 }
 
@@ -81,10 +159,14 @@ void ScaleFilter::DisableDrainingAlarm() {
 // This is detected by looking for a set weight threshold, and
 // also checking if the draining rate decreases.
 // This also disables the draining alarm (for obvious reasons)
-void ScaleFilter::NotifyWhenDrainComplete(std::function<void()> callback) {
+template <class Rig>
+void BasicScaleFilter<Rig>::NotifyWhenDrainComplete(std::function<void()> callback,
+                                          double done_grams_per_sec) {
+  drain_done_rate_ = done_grams_per_sec;
+  predicted_drain_done_ = 0;
+  reset_drain_monitor_ = true;
   empty_callback_ = callback;
   draining_callback_ = nullptr;
-  empty_update_period_ = kCheckEmptyIntervalMs;
 }
 
 // Then starts thread loop continously reading the scale
@@ -92,23 +174,26 @@ void ScaleFilter::NotifyWhenDrainComplete(std::function<void()> callback) {
 // |callback| will be called with the weight.
 // This function blocks while it checks the scale readings.
 // It can take around 3 seconds to return
-int ScaleFilter::InitLoop(std::function<void()> error_callback) {
+template <class Rig>
+int BasicScaleFilter<Rig>::InitLoop(std::function<void()> error_callback) {
   using std::placeholders::_1;
   using std::placeholders::_2;
   error_callback_ = error_callback;
+  // Open the log before the readings start coming in.
+  if (!disable_for_test_ && raw_log_.Open(kRawLogFile) == 0) {
+    raw_logger_enabled_ = true;
+    raw_logger_thread_ = std::thread(&BasicScaleFilter::RawLoggerThread, this);
+  }
   int ret;
   if (disable_for_test_) {
-   ret = fake_scale_.InitLoop(std::bind(&ScaleFilter::OnNewMeasurement, this, _1, _2),
-      std::bind(&ScaleFilter::OnScaleError, this));
+   ret = fake_scale_.InitLoop(std::bind(&BasicScaleFilter::OnNewMeasurement, this, _1, _2),
+      std::bind(&BasicScaleFilter::OnScaleError, this));
 
   } else {
-   ret = raw_scale_.InitLoop(std::bind(&ScaleFilter::OnNewMeasurement, this, _1, _2),
-      std::bind(&ScaleFilter::OnScaleError, this));
+   ret = raw_scale_.InitLoop(std::bind(&BasicScaleFilter::OnNewMeasurement, this, _1, _2),
+      std::bind(&BasicScaleFilter::OnScaleError, this));
   }
 
-  raw_logger_enabled_ = true;
-  raw_logger_thread_ = std::thread(&ScaleFilter::RawLoggerThread, this);
-
   if (ret == 0) {
     looping_ = true;
   } else {
@@ -118,28 +203,115 @@ int ScaleFilter::InitLoop(std::function<void()> error_callback) {
   return ret;
 }
 
+// The levels of trends_.  A slow leak won't show up in the few seconds
+// CheckDraining looks at, so look over longer times, with lower thresholds.
+// The weight should hold steady whenever the draining alarm is on.
+static std::vector<TrendPyramid::LevelConfig> TrendLevels() {
+  // bucket size, buckets, grams/sec, confidence, total loss  //TODO: check values
+  // The confidences are on the RMS deviation, like kDrainingConfidenceThresh.
+  return {
+    {kNsPerSec, 30, -15.0, 12.5, 200.0},       // 30 seconds
+    {10 * kNsPerSec, 18, -4.0, 12.5, 300.0},   // 3 minutes
+    {60 * kNsPerSec, 30, -2.0, 12.5, 1000.0},  // 30 minutes
+  };
+}
+
+// The vibration filter, with FFTs of at least |points| readings.  The FFT
+// needs a power of 2.
+static VibrationFilter::Config VibrationConfig(size_t points) {
+  VibrationFilter::Config config;
+  config.fft_size = 16;
+  while (config.fft_size < points) config.fft_size *= 2;
+  return config;
+}
+
 // Initialize with calibration.  Creates file otherwise, and writes to it on
 // calls to Calibrate()
-ScaleFilter::ScaleFilter(const char *calibration_file) : calibration_file_(calibration_file) {
+template <class Rig>
+BasicScaleFilter<Rig>::BasicScaleFilter(const char *calibration_file,
+                         const std::vector<uint8_t> &cell_data_pins)
+  : cells_(cell_data_pins.size()), calibration_file_(calibration_file),
+    vibration_filter_(VibrationConfig(Rig::kVibrationFftSize)),
+    trends_(TrendLevels()) {
+  alarm_sub_ = dispatcher_.Subscribe(CallbackDispatcher::kAlarm);
+  // Every step is its own event, so none are dropped, however close.
+  step_sub_ = dispatcher_.Subscribe(CallbackDispatcher::kNormal);
+  periodic_sub_ = dispatcher_.Subscribe(CallbackDispatcher::kLow);
+  if (cells_.size() > 1) {
+    using std::placeholders::_1;
+    using std::placeholders::_2;
+    using std::placeholders::_3;
+    raw_scale_.SetDataPins(cell_data_pins);
+    raw_scale_.SetCellCallback(
+        std::bind(&BasicScaleFilter::OnCellMeasurement, this, _1, _2, _3));
+  }
   std::fstream calfile;
   calfile.open(calibration_file, std::fstream::in);
   if(!calfile.is_open()) {
     printf("No Calfile at %s\n", calibration_file_);
     return;
   }
-  calfile >> offset_ >> scale_;
+  if (cells_.size() == 1) {
+    calfile >> offset_ >> scale_;
+  } else {
+    for (size_t i = 0; i < cells_.size(); ++i) {
+      if (!(calfile >> cells_[i].offset >> cells_[i].scale)) {
+        printf("No calibration for cell %zu in %s\n", i, calibration_file_);
+        cells_[i] = CellCalibration();
+      }
+    }
+  }
   calfile.close();
 }
 
-ScaleFilter::~ScaleFilter() {
+template <class Rig>
+int BasicScaleFilter<Rig>::SaveCalibration() {
+  std::fstream calfile;
+  calfile.open(calibration_file_, std::fstream::out);
+  if(!calfile.is_open()) {
+    printf("Failed to open cal file at %s\n", calibration_file_);
+    return -1;
+  }
+  if (cells_.size() == 1) {
+    printf("Calibration Result: Scale %f, Offset: %f\n", scale_, offset_);
+    calfile << offset_ << " " << scale_ << std::endl;
+  } else {
+    for (size_t i = 0; i < cells_.size(); ++i) {
+      printf("Calibration Result: Cell %zu Scale %f, Offset: %f\n", i,
+             cells_[i].scale, cells_[i].offset);
+      calfile << cells_[i].offset << " " << cells_[i].scale << std::endl;
+    }
+  }
+  calfile.close();
+  return 0;
+}
+
+template <class Rig>
+std::vector<double> BasicScaleFilter<Rig>::GetCellWeights() {
+  std::lock_guard<std::mutex> lock(data_lock_);
+  std::vector<double> weights;
+  for (size_t i = 0; i < last_cell_readings_.size(); ++i) {
+    weights.push_back((last_cell_readings_[i] - cells_[i].offset) * cells_[i].scale);
+  }
+  return weights;
+}
+
+template <class Rig>
+BasicScaleFilter<Rig>::~BasicScaleFilter() {
+  // The scales' threads call OnNewMeasurement, which uses the raw log and
+  // the callbacks, and those are destroyed before the scales are.
+  raw_scale_.Stop();
+  fake_scale_.Stop();
   raw_logger_enabled_ = false;
   if (raw_logger_thread_.joinable()) {
     raw_logger_thread_.join();
   }
+  raw_log_.Close();
 }
 
 
-void ScaleFilter::OnScaleError() {
+template <class Rig>
+void BasicScaleFilter<Rig>::OnScaleError() {
   looping_ = false;
   if (error_callback_) {
     error_callback_();
@@ -150,14 +322,20 @@ void ScaleFilter::OnScaleError() {
 // Assume that the load cell value is linear with weight (which is the whole point right?)
 // Calibrate will need to be called with calibration_mass == 0, then again with
 // calibration_mass == something non-zero.
-int ScaleFilter::Calibrate(double calibration_mass) {
+template <class Rig>
+int BasicScaleFilter<Rig>::Calibrate(double calibration_mass, int cell) {
   if (!looping_) {
     printf("Not measuring data, so cannot collect raw data\n");
     return -1;
   }
-  int64_t tnow = GetTimeMsec();
-  usleep(3000000);
-  double average = FilterData(tnow);
+  if (cells_.size() > 1) {
+    return CalibrateCells(calibration_mass, cell);
+  }
+  // Average Rig::kPointsForFiltering new raw readings.
+  double average;
+  if (CollectReadings(0, Rig::kPointsForFiltering, 0, &average).num_points == 0) {
+    return -1;
+  }
   if (calibration_mass == 0) {
     offset_ = average;
     return 0;
@@ -169,222 +347,284 @@ int ScaleFilter::Calibrate(double calibration_mass) {
   }
   scale_ =  calibration_mass / (average - offset_);
   // Write new calibration values out to file:
-  std::fstream calfile;
-  calfile.open(calibration_file_, std::fstream::out);
-  if(!calfile.is_open()) {
-    printf("Failed to open cal file at %s\n", calibration_file_);
+  return SaveCalibration();
+}
+
+template <class Rig>
+int BasicScaleFilter<Rig>::CalibrateCells(double calibration_mass, int cell) {
+  if (cell >= (int)cells_.size()) {
+    printf("No cell %d to calibrate\n", cell);
     return -1;
   }
-  printf("Calibration Result: Scale %f, Offset: %f\n", scale_, offset_);
-  calfile << offset_ << " " << scale_ << std::endl;
-  calfile.close();
-
-  return 0;
+  {
+    std::lock_guard<std::mutex> lock(data_lock_);
+    cell_sums_.assign(cells_.size(), 0);
+    cell_sum_count_ = 0;
+  }
+  // Sum up Rig::kPointsForFiltering readings.
+  int64_t deadline = MonotonicNs() + 2 * Rig::kPointsForFiltering * sample_period_ms_ * kNsPerMs;
+  WaitForSamplesAfter(samples_.Count() + Rig::kPointsForFiltering - 1, deadline);
+  // The load on each cell, in raw units:
+  std::vector<double> loads(cells_.size());
+  {
+    std::lock_guard<std::mutex> lock(data_lock_);
+    if (cell_sum_count_ == 0) {
+      printf("No readings from the load cells\n");
+      return -1;
+    }
+    for (size_t i = 0; i < cells_.size(); ++i) {
+      loads[i] = cell_sums_[i] / cell_sum_count_ - cells_[i].offset;
+    }
+  }
+  if (calibration_mass == 0) {
+    for (size_t i = 0; i < cells_.size(); ++i) {
+      cells_[i].offset += loads[i];
+    }
+    return 0;
+  }
+  if (cell < 0) {
+    // Keep the ratios between the cells, just scale the total
+    double total = 0;
+    for (size_t i = 0; i < cells_.size(); ++i) {
+      total += loads[i] * cells_[i].scale;
+    }
+    if (total == 0) {
+      printf("Error, average == offset. calibration mass may not be sufficient\n");
+      return -1;
+    }
+    for (CellCalibration &cal : cells_) {
+      cal.scale *= calibration_mass / total;
+    }
+    return SaveCalibration();
+  }
+  // The mass is over |cell|, but the other cells still take some of it.
+  // Pick the scale of |cell| so the total comes out right.
+  if (loads[cell] == 0) {
+    printf("Error, average == offset. calibration mass may not be sufficient\n");
+    return -1;
+  }
+  double others = 0;
+  for (size_t i = 0; i < cells_.size(); ++i) {
+    if ((int)i != cell) others += loads[i] * cells_[i].scale;
+  }
+  cells_[cell].scale = (calibration_mass - others) / loads[cell];
+  return SaveCalibration();
 }
 
-void ScaleFilter::OnNewMeasurement(uint32_t weight, int64_t tmeas) {
-  int64_t tnow = GetTimeMsec();
-  // add data to deque
+// Combines the cells into one weight, in grams.
+template <class Rig>
+void BasicScaleFilter<Rig>::OnCellMeasurement(const uint32_t *raw, int num_cells, int64_t tmeas) {
+  double grams = 0;
   {
     std::lock_guard<std::mutex> lock(data_lock_);
-    weight_data_.push_back(weight);
-    time_data_.push_back(tmeas);
-    if (weight_data_.size() < kPointsForFiltering)
-      return;
+    last_cell_readings_.assign(raw, raw + num_cells);
+    if (cell_sums_.size() == (size_t)num_cells) {
+      for (int i = 0; i < num_cells; ++i) {
+        cell_sums_[i] += raw[i];
+      }
+      cell_sum_count_++;
+    }
+    for (int i = 0; i < num_cells && i < (int)cells_.size(); ++i) {
+      grams += (raw[i] - cells_[i].offset) * cells_[i].scale;
+    }
   }
+  OnNewMeasurement(grams, tmeas);
+}
+
+template <class Rig>
+void BasicScaleFilter<Rig>::OnNewMeasurement(double weight, int64_t tmeas) {
+  int64_t tnow = MonotonicNs();
+  // Track the sample rate.  Ignore gaps from dropped readings.
+  if (last_sample_time_) {
+    double dt = (tmeas - last_sample_time_) / (double)kNsPerMs;
+    double period = sample_period_ms_;
+    if (num_first_intervals_ < kFirstIntervals) {
+      if (dt > 0) first_intervals_[num_first_intervals_++] = dt;
+      if (num_first_intervals_ == kFirstIntervals) {
+        // The median, so a dropped reading doesn't count.
+        std::nth_element(first_intervals_.begin(),
+                         first_intervals_.begin() + kFirstIntervals / 2,
+                         first_intervals_.end());
+        sample_period_ms_ = first_intervals_[kFirstIntervals / 2];
+      }
+    } else if (dt > 0 && dt < 4 * period) {
+      sample_period_ms_ = period + kSamplePeriodFilterGain * (dt - period);
+    }
+  }
+  last_sample_time_ = tmeas;
+  if (fabs(sample_period_ms_ - window_period_ms_) >
+      kWindowResizeFraction * window_period_ms_) {
+    ResizeWindows();
+  }
+  filter_stats_.Add(tmeas, weight);
+  filtered_raw_ = filter_stats_.Mean();
+  samples_.Push(tmeas, weight);
+  {
+    // So a waiter can't miss the notify between checking and waiting.
+    std::lock_guard<std::mutex> lock(new_sample_lock_);
+  }
+  new_sample_cv_.notify_all();
+  double grams = vibration_filter_.Add(tmeas, ToGrams(weight), pump_on_);
+  quick_filter_stats_.Add(tmeas, grams);
+  quick_filtered_grams_ = quick_filter_stats_.Mean();
+  vibration_filtered_ = vibration_filter_.Active() && quick_filter_stats_.Full();
+  drain_stats_.Add(tmeas, grams);
+  quick_drain_stats_.Add(tmeas, grams);
+  if (reset_trends_.exchange(false)) {
+    trends_.Clear();
+  }
+  trends_.Add(tmeas, grams);
+  flow_estimator_.Update(tmeas, grams);
+  bool stepped = step_detector_.Add(tmeas, grams);
+  if (reset_drain_monitor_.exchange(false)) {
+    drain_monitor_.Reset(drain_done_rate_);
+  }
+  drain_monitor_.Add(tmeas, grams);
+  predicted_drain_done_ = drain_monitor_.PredictedDoneTime();
+  {
+    std::lock_guard<std::mutex> lock(estimates_lock_);
+    flow_ = flow_estimator_.Estimate();
+    plateau_ = step_detector_.Current();
+  }
+  uint32_t log_flags = 0;
+  if (step_detector_.Current().settled) log_flags |= kRawLogSettled;
+  if (draining_callback_) log_flags |= kRawLogDrainAlarm;
+  raw_log_.Append(tmeas, weight, ToGrams(weight), log_flags);
+  if (stepped && step_callback_) {
+    std::function<void(const WeightStep &)> callback = step_callback_;
+    WeightStep step = step_detector_.LastStep();
+    dispatcher_.Post(step_sub_, [callback, step]() { callback(step); });
+  }
+  if (samples_.Size() < points_for_filtering_)
+    return;
   // TODO: maybe this should just be its own thread...
   // If we need to call periodic callback, filter for that reading
-  if (periodic_callback_ && tnow - last_periodic_update_  > periodic_update_period_) {
-    periodic_callback_(FilterData(0), tmeas); // TODO: should be in the middle of sequence
+  if (periodic_callback_ &&
+      tnow - last_periodic_update_  > periodic_update_period_ * kNsPerMs) {
+    dispatcher_.Post(periodic_sub_, std::bind(periodic_callback_,
+                                              flow_estimator_.Estimate().grams, tmeas));
     last_periodic_update_ = tnow;
   }
-  // If we are monitoring for draining, and it has been long enough since we last checked
-  if (draining_callback_ && tnow - last_draining_update_  > draining_update_period_) {
-    if (CheckDraining()) {
-      draining_callback_();
-      draining_callback_ = nullptr; // one shot call
-    }
-    last_draining_update_ = tnow;
+  // The checks are cheap, so make them on every sample, rather than
+  // waiting for a timer.
+  if (draining_callback_ && CheckDraining()) {
+    dispatcher_.Post(alarm_sub_, draining_callback_);
+    draining_callback_ = nullptr; // one shot call
   }
-  // If we are monitoring for drain complete, and it has been long enough since we last checked
-  if (empty_callback_ && tnow - last_empty_update_  > empty_update_period_) {
-    if(CheckEmpty()) {
-      empty_callback_();
-      empty_callback_ = nullptr;  // one shot call
-    }
-    last_empty_update_ = tnow;
-  }
-  // If over max storage size, drop earliest
-  if (weight_data_.size() > kMaxDataPoints) {
-    std::lock_guard<std::mutex> lock(data_lock_);
-    weight_data_.pop_front();
-    time_data_.pop_front();
+  // If a reset is pending, drain_monitor_ is from before the request.
+  bool drained = !reset_drain_monitor_ && drain_monitor_.Done();
+  if (empty_callback_ && (drained || CheckEmpty())) {
+    dispatcher_.Post(alarm_sub_, empty_callback_);
+    empty_callback_ = nullptr;  // one shot call
   }
 }
 
-double ScaleFilter::FilterData(int64_t min_time_bound) {
-    std::lock_guard<std::mutex> lock(data_lock_);
+template <class Rig>
+size_t BasicScaleFilter<Rig>::ScaledPoints(size_t rig_points) const {
+  size_t points = ceil(rig_points * Rig::kDefaultSamplePeriodMs / sample_period_ms_);
+  return std::max<size_t>(points, 2);
+}
+
+// Without this, at 80 SPS the drain window covers 0.4 s, and the noise
+// alone fits a slope steep enough to set off the alarm.
+template <class Rig>
+void BasicScaleFilter<Rig>::ResizeWindows() {
+  window_period_ms_ = sample_period_ms_;
+  points_for_filtering_ = ScaledPoints(Rig::kPointsForFiltering);
+  filter_stats_ = WindowStats(points_for_filtering_);
+  drain_stats_ = WindowStats(ScaledPoints(Rig::kPointsToCheckForDrain));
+  quick_filter_stats_ = WindowStats(ScaledPoints(Rig::kPointsForQuickFiltering));
+  quick_drain_stats_ = WindowStats(ScaledPoints(Rig::kPointsToCheckForDrainQuickly));
+  vibration_filter_ = VibrationFilter(VibrationConfig(ScaledPoints(Rig::kVibrationFftSize)));
+}
+
+template <class Rig>
+double BasicScaleFilter<Rig>::FilterData(int64_t min_time_bound) {
   // TODO: explore other filtering methods...
-  double wsum = 0;
-  int data_points = 0;
-  if (weight_data_.size() == 0) {
+  if (min_time_bound == 0) {
+    if (samples_.Count() == 0) return 0.0;
+    if (vibration_filtered_) return quick_filtered_grams_;
+    return ToGrams(filtered_raw_);
+  }
+  SampleSnapshot snapshot;
+  if (!samples_.Snapshot(min_time_bound, points_for_filtering_, &snapshot)) {
     return 0.0;
   }
-  for (unsigned i = 0; i < weight_data_.size() && i < kPointsForFiltering; ++i) {
-    if (time_data_[time_data_.size() - 1 - i] < min_time_bound) {
-      break;
-    }
-    wsum += ToGrams(weight_data_[weight_data_.size() - 1 - i]);
-    data_points++;
+  double wsum = 0;
+  for (double w : snapshot.weights) {
+    wsum += ToGrams(w);
   }
-  return wsum / data_points;
+  return wsum / snapshot.size();
 }
 
-// This function has no locking because it is private and only called
-// on the same thread that alters the data.
-bool ScaleFilter::CheckDraining() {
-  if (weight_data_.size() < kPointsToCheckForDrain) return false;
+// Only called on the measurement thread, which owns drain_stats_.
+template <class Rig>
+bool BasicScaleFilter<Rig>::CheckDraining() {
+  // With the pump's vibration taken out, fewer points give the same
+  // confidence.
+  const WindowStats &stats =
+      vibration_filter_.Active() ? quick_drain_stats_ : drain_stats_;
+  if (!stats.Full()) {
+    return false;
+  }
   // Fit line to data:
   // mx = average(weight_data_)
   // my = average(time_data_)
   // sum((weight - mx) * (time - my))
   // divide by sum((weight-mx)*(weight-mx))
   // if slope < threshold
-  std::vector<double> weights;
-  std::vector<int64_t> times;
-  for (int i = weight_data_.size() - 1; i > 1 && i > (int)weight_data_.size() - kPointsToCheckForDrain; i--) {
-    weights.push_back(ToGrams(weight_data_[i]));
-    times.push_back(time_data_[i]);
-  }
-  SlopeInfo info = FitSlope(weights, times);
-  if (info.slope < kDrainingThreshGramsPerSecond &&
-      info.ave_diff < kDrainingConfidenceThresh &&
-      info.biggest_change < kTotalLossThreshold) {
-    std::cout << "Slope was: " << info.slope << " > " << kDrainingThreshGramsPerSecond 
+  SlopeInfo info = stats.Slope();
+  if (info.slope < Rig::kDrainingThreshGramsPerSecond &&
+      info.ave_diff < Rig::kDrainingConfidenceThresh &&
+      info.biggest_change < Rig::kTotalLossThreshold) {
+    std::cout << "Slope was: " << info.slope << " > " << Rig::kDrainingThreshGramsPerSecond 
               << " grams/sec" << std::endl;
     return true;
   }
-  // TODO: also check for longer trends with lower thresholds
+  // Or the filtered flow rate is confidently draining.
+  const FlowEstimate &flow = flow_estimator_.Estimate();
+  if (flow.grams_per_sec + Rig::kDrainingRateSigmas * sqrt(flow.rate_variance) <
+      Rig::kDrainingThreshGramsPerSecond) {
+    std::cout << "Flow rate was: " << flow.grams_per_sec << " +/- "
+              << sqrt(flow.rate_variance) << " grams/sec" << std::endl;
+    return true;
+  }
+  int level = trends_.DrainingLevel();
+  if (level >= 0) {
+    std::cout << "Slope over " << trends_.Buckets(level).size() << " buckets was: "
+              << trends_.Slope(level).slope << " grams/sec" << std::endl;
+    return true;
+  }
 
   return false;
 }
 
-bool ScaleFilter::CheckEmpty() {
+template <class Rig>
+bool BasicScaleFilter<Rig>::CheckEmpty() {
   //This is a bit of a hack, but it is for testing...
   if (disable_for_test_) {
     fake_scale_.DrainOut();
   }
-  std::lock_guard<std::mutex> lock(data_lock_);
   // TODO: regardless of the weight, check if we are slowing down
   // For now, just check if we are below kettle+trub threshold
   // A +/- 40 gram weight difference doesn't matter - just get last reading
-  if (weight_data_.size() == 0) return false;
-  return ToGrams(weight_data_.back()) < kEmptyThresholdGrams;
+  SampleSnapshot latest;
+  if (!samples_.Snapshot(0, 1, &latest)) return false;
+  return ToGrams(latest.weights[0]) < Rig::kEmptyThresholdGrams;
 }
 
-SlopeInfo FitSlope(std::vector<double> weights, std::vector<int64_t> times) {
-  // run = (numpy.array(range(window))-numpy.mean(range(window))) / 100.0
-  // ...:     s0 = run * (r1 - m1)
-  // ...:     s1 = (r1-m1)*(r1-m1)
-  // ...:     slope = min(max(sum(s1)/sum(s0),-3000),3000)
-  // ...:     # how accurate was the slope:
-  // ...:     est=m1 + run*slope
-  // ...:     diff = sum(abs(r1-est))
-  double wsum = 0 ;
-  for (double w : weights) { wsum+=w; }
-  double wmean = wsum/weights.size();
-  double tsum = 0 ;
-  for (auto t : times) { tsum+=t; }
-  double tmean = tsum/weights.size();
-  double slope_num = 0, slope_denom = 0;
-  for (unsigned i = 0; i < weights.size(); ++i) {
-    slope_denom += (times[i] - tmean) * (weights[i] - wmean);
-    slope_num += (weights[i] - wmean)  * (weights[i] - wmean);
-  }
-  double slope;
-  if (slope_num < 1e-6 && slope_num > -1e-6) {
-    slope = 0;
-  } else {
-    slope = slope_num / slope_denom;
-  }
-  // some losses are to large to be believed.  If we are truly losing at this rate,
-  // it won't matter anyway...
-  // slope is in grams(approx ml)/millisecond, so 1L/sec is crazy high
-  slope = slope > kMaxDrainSlope ? kMaxDrainSlope : slope;
-  slope = slope < -1*kMaxDrainSlope ? -1*kMaxDrainSlope : slope;
-  double diff = 0;
-  for (unsigned i = 0; i < weights.size(); ++i) {
-    // error = reading  - estimate from slope
-    double err = weights[i] - (wmean + (times[i] - tmean) * slope);
-    diff += err > 0 ? err : -1.0 * err; // abs(err)
-  }
-  diff /= weights.size();
-
-  // calculate max and min:
-  double wmin = weights[0], wmax = weights[0];
-  bool slope_down = false; // if lowest value comes after highest value
-  for (double w : weights) {
-      if (w < wmin) {
-          wmin = w;
-          slope_down = true;
-      }
-      if (w > wmax) {
-          wmax = w;
-          slope_down = false;
-      }
-  }
-
-  SlopeInfo info = {
-    .num_points = weights.size(),
-    .mean = wmean,
-    .slope = slope * 1000, // convert from ms to seconds
-    .ave_diff = diff,
-    .biggest_change = slope_down ? wmin - wmax : wmax - wmin,
-  };
-  return info;
-}
-
-void ScaleFilter::RawLoggerThread() {
-  int64_t last_time = 0;
-  std::vector<double> weights;
-  std::vector<int64_t> times;
+template <class Rig>
+void BasicScaleFilter<Rig>::RawLoggerThread() {
   while (raw_logger_enabled_) {
-    weights.clear();
-    times.clear();
-    {
-      std::lock_guard<std::mutex> lock(data_lock_);
-      if (time_data_.size() && time_data_.back() > last_time) {
-        ssize_t i = time_data_.size() - 1;
-        while (i >= 0 && time_data_[i] > last_time) {
-          weights.push_back(weight_data_[i]);
-          times.push_back(time_data_[i]);
-          --i;
-        }
-        // aur local vector now has a reverse order of the last n data points
-      }
-    }
-    if (weights.size() == 0) {
-      usleep(1000000);
-      continue;
-    }
-    // we have some info to write:
-    std::fstream raw_log_file;
-    raw_log_file.open(kRawLogFile, std::fstream::out | std::fstream::app);
-    if(!raw_log_file.is_open()) {
-      printf("Failed to open raw log file at %s\n", kRawLogFile);
+    usleep(kRawLogFlushIntervalUs);
+    if (raw_log_.Flush()) {
+      printf("Stopping the raw log\n");
       return;
     }
-    last_time = times[0];
-    for (size_t i = 0; i < weights.size(); ++i) {
-      raw_log_file << times.back() << " " << weights.back()
-        << " " << ToGrams(weights.back()) << std::endl;
-      times.pop_back();
-      weights.pop_back();
-    }
-    raw_log_file.close();
-    usleep(1000000);
-  } // end while
+  }
 }
 
-
-
+template class BasicScaleFilter<Rig10Sps>;
+template class BasicScaleFilter<Rig80Sps>;
+template class BasicScaleFilter<TestRig>;
+template class BasicScaleFilter<RuntimeRig>;
@@ -4,52 +4,104 @@
 
 #pragma once
 
+#include <array>
+#include <condition_variable>
 #include <fstream>
 #include <vector>
 #include <thread>
 #include <functional>
 #include "gpio.h"
 #include "brew_types.h"
+#include "monotonic_clock.h"
 #include "raw_scale.h"
 #include "fake_scale.h"
+#include "sample_buffer.h"
+#include "window_stats.h"
+#include "trend_pyramid.h"
+#include "flow_estimator.h"
+#include "drain_monitor.h"
+#include "step_detector.h"
+#include "callback_dispatcher.h"
+#include "raw_log.h"
+#include "vibration_filter.h"
+#include "scale_config.h"
 
 
-
-struct SlopeInfo {
-  size_t num_points = 0;
-  double mean = 0, slope = 0, ave_diff = 0;
-  double biggest_change = 0;
-};
-
-  // Maximum drainage rate we believe.  Anything more is too big.
-  static constexpr double kMaxDrainSlope = 500; // ml per second
-SlopeInfo FitSlope(std::vector<double> weights, std::vector<int64_t> times);
-
 // We have 3 uses of the scale:
 // to log accurate weights at specific times
 // To measure changes in weight over time, to characterize processes
 // And to alert when either:
 //   - we are losing fluid unintentionally (usually because of a bad hose position)
 //   - We have picked up the grainfather
-class ScaleFilter {
+// The tuning comes from |Rig| (see scale_config.h).
+template <class Rig>
+class BasicScaleFilter {
   public:
   void DisableForTest() { disable_for_test_ = true; }
 
   // Gets the weight reading of the scale.
   // This will pull on some amount of historical data to get a filtered
   // reading.  If you want to limit how far back the data is taken from,
-  // you can pass in a time, the averaging will be limited to after that
-  // point.
+  // you can pass in a time (MonotonicNs), the averaging will be limited to
+  // after that point.
   double GetWeight(int64_t since_time = 0);
 
-  // Get an averaged weight using readings after this call was made.
-  // This call will block until enough readings are available, then return the
-  // weight.
-  double GetWeightStartingNow(unsigned max_points = kPointsForFiltering,
-                             int64_t timeout = 100000 * kPointsForFiltering);
+  struct WeightReading {
+    double grams = 0;
+    double std_error = 0;   // standard error of the mean, in grams
+    size_t num_points = 0;
+    bool settled = false;   // std_error got below the tolerance
+  };
 
+  // Get an averaged weight using readings after this call was made.
+  // Wakes up with each new reading, and returns as soon as the standard
+  // error of the mean is below |tolerance_grams|, or once |max_points|
+  // readings are in, or at the timeout.  A |timeout| (ms) of 0 waits for
+  // twice as long as |max_points| should take at the measured sample rate.
+  // A steady scale settles in well under a second.
+  WeightReading MeasureWeight(double tolerance_grams = Rig::kWeightToleranceGrams,
+                              size_t max_points = Rig::kPointsForFiltering,
+                              int64_t timeout = 0);
+
+  // Just the weight from MeasureWeight().
+  double GetWeightStartingNow(double tolerance_grams = Rig::kWeightToleranceGrams) {
+    return MeasureWeight(tolerance_grams).grams;
+  }
+
+  // Tells the filter when the Grainfather pump is running.  The pump shakes
+  // the scale, so while it runs the readings go through notch filters,
+  // which let GetWeight() and the draining alarm use fewer points.
+  void SetPumpOn(bool pump_on) { pump_on_ = pump_on; }
+  // True once the notches are taking the pump out of GetWeight().
+  bool IsVibrationFiltered() const { return vibration_filtered_; }
+
+  // The time between readings, measured from the data.  The HX711 runs at
+  // 10 or 80 samples per second depending on how the RATE pin is wired.
+  double GetSamplePeriodMs() { return sample_period_ms_; }
+
+  // The weight and flow rate (g/s) as of the latest reading, from a
+  // Kalman filter, with their variances.
+  FlowEstimate GetFlow();
+
+  // The plateau the weight is on (or was last on, if it is changing).
+  Plateau GetPlateau();
+
+  // Blocks until the weight has held steady for Rig::kSettlePoints readings
+  // after this call, then sets |grams| to the plateau mean.  Returns false
+  // if that doesn't happen within |timeout| ms.
+  bool WaitForPlateau(int64_t timeout, double *grams);
+
+  // Called whenever the weight steps from one plateau to another,
+  // planned or not.
+  void SetWeightStepCallback(std::function<void(const WeightStep &)> callback) {
+    step_callback_ = callback;
+  }
+
+  // All the callbacks are called from a dispatcher thread, not the thread
+  // reading the scale.
   // Sets a callback to be called at a constant reporting_interval (in milliseconds)
-  // with the time of the latest measurement and a filtered weight reading.
+  // with the time (MonotonicNs) of the latest measurement and the filtered
+  // weight from GetFlow().
   void SetPeriodicWeightCallback(int64_t reporting_interval,
                                  std::function<void(double, int64_t)> callback);
 
@@ -70,9 +122,15 @@ class ScaleFilter {
 
   // Calls the given callback when draining is complete.
   // This is detected by looking for a set weight threshold, and
-  // also checking if the draining rate decreases.
+  // also checking if the draining rate decreases, to below
+  // |done_grams_per_sec|.  (See DrainMonitor)
   // This also disables the draining alarm (for obvious reasons)
-  void NotifyWhenDrainComplete(std::function<void()> callback);
+  void NotifyWhenDrainComplete(std::function<void()> callback,
+                               double done_grams_per_sec = Rig::kDrainDoneGramsPerSec);
+
+  // When the flow is predicted to drop below the done rate passed to
+  // NotifyWhenDrainComplete (MonotonicNs), or 0 if we can't tell yet.
+  int64_t PredictedDrainDoneTime() { return predicted_drain_done_; }
 
   // Then starts thread loop continously reading the scale
   // After this call, callbacks from:
@@ -87,54 +145,153 @@ class ScaleFilter {
 
   // Initialize with calibration.  Creates file otherwise, and writes to it on
   // calls to Calibrate()
-  ScaleFilter(const char *calibration_file);
+  // The scale can be made of several load cells, each with its own HX711
+  // on one of |cell_data_pins|, all sharing SCALE_SCLK.  The weight is then
+  // the sum of the calibrated cells, and the calibration file has an
+  // "offset scale" line for each cell.
+  BasicScaleFilter(const char *calibration_file,
+              const std::vector<uint8_t> &cell_data_pins = {SCALE_DATA});
 
   // Assume that the load cell value is linear with weight (which is the whole point right?)
   // Calibrate will need to be called with calibration_mass == 0, then again with
   // calibration_mass == something non-zero.
-  int Calibrate(double calibration_mass);
+  // With several load cells, calibration_mass == 0 zeros every cell.
+  // Then the mass can be put over each cell in turn, passing |cell|, to
+  // find the scale of that cell.  With |cell| == -1, the mass can be put
+  // anywhere, and the cell scales are adjusted together.
+  int Calibrate(double calibration_mass, int cell = -1);
+
+  struct CellCalibration {
+    double offset = 0, scale = 1.0;
+  };
 
-  ~ScaleFilter();
+  int NumCells() { return cells_.size(); }
+
+  // The calibrated weight on each load cell, from the latest reading.
+  std::vector<double> GetCellWeights();
+
+  ~BasicScaleFilter();
+
+  // Runs the scale reading thread with real-time priority.
+  // Must be called before InitLoop.
+  void SetRealtime(const RawScale::RealtimeOptions &options) {
+    raw_scale_.SetRealtime(options);
+  }
+
+  // Queue depth and latency of the callbacks.
+  CallbackDispatcher::Status GetDispatchStatus() { return dispatcher_.GetStatus(); }
+
+  // Read counts, errors and timing of the raw scale.
+  RawScale::Status GetRawStatus() {
+    return disable_for_test_ ? fake_scale_.GetStatus() : raw_scale_.GetStatus();
+  }
 
   // For Testing:
   FakeScale *GetFakeScale() { return &fake_scale_; }
 
  private:
+  // With several cells, the samples are already in grams, and these stay
+  // at 0 and 1.  cells_ has the calibration of each cell.
   double offset_ = 0, scale_ = 1.0;
+  std::vector<CellCalibration> cells_;
+  // Latest reading of each cell, and a sum of readings for calibration.
+  std::vector<uint32_t> last_cell_readings_;
+  std::vector<double> cell_sums_;
+  int cell_sum_count_ = 0;
   const char *calibration_file_;
-  std::deque<double> weight_data_;
-  std::deque<int64_t> time_data_;
+  // Raw readings (or grams, with several cells).  Everything reads these
+  // through samples_.Snapshot().
+  SampleBuffer samples_;
+  // Notified with each new sample, for MeasureWeight.
+  std::mutex new_sample_lock_;
+  std::condition_variable new_sample_cv_;
+  // Only touched on the measurement thread:
+  int64_t last_sample_time_ = 0;
+  // Running stats of the newest samples, updated with each one, so the
+  // checks cost the same however many points they look at.
+  // filter_stats_ is raw, drain_stats_ is in grams.  ResizeWindows()
+  // keeps them covering the same time at any sample rate.
+  WindowStats filter_stats_{Rig::kPointsForFiltering};
+  WindowStats drain_stats_{Rig::kPointsToCheckForDrain};
+  // filter_stats_.Mean(), for other threads.
+  std::atomic<double> filtered_raw_{0};
+  // Takes out the pump's vibration.  Everything in grams below is after it.
+  std::atomic<bool> pump_on_{false};
+  VibrationFilter vibration_filter_;
+  // While the vibration is being taken out, the weight and the draining
+  // check need fewer points.  These are used instead, in grams.
+  WindowStats quick_filter_stats_{Rig::kPointsForQuickFiltering};
+  WindowStats quick_drain_stats_{Rig::kPointsToCheckForDrainQuickly};
+  std::atomic<bool> vibration_filtered_{false};
+  // quick_filter_stats_.Mean(), for other threads.
+  std::atomic<double> quick_filtered_grams_{0};
+  // The weight in grams, downsampled, for finding slow leaks.
+  TrendPyramid trends_;
+  // Set when the draining alarm is enabled, so the measurement thread
+  // forgets trends from before then.
+  std::atomic<bool> reset_trends_{false};
+  // Watches for the flow to stop, for NotifyWhenDrainComplete.  Only used
+  // on the measurement thread, which resets it when reset_drain_monitor_
+  // is set.
+  DrainMonitor drain_monitor_;
+  std::atomic<bool> reset_drain_monitor_{false};
+  std::atomic<double> drain_done_rate_{0};
+  std::atomic<int64_t> predicted_drain_done_{0};
+  // Only updated on the measurement thread.  flow_ and plateau_ are
+  // copies of their estimates, for other threads.
+  FlowEstimator flow_estimator_;
+  StepDetector step_detector_;
+  std::mutex estimates_lock_;
+  FlowEstimate flow_;
+  Plateau plateau_;
+  std::function<void(const WeightStep &)> step_callback_;
+  // Runs the callbacks, so user code never holds up the measurements.
+  // Alarms (draining, drain complete) go first, then weight steps, then
+  // the periodic weight.  Declared before the scales, so it outlives
+  // their threads, which post to it.
+  CallbackDispatcher dispatcher_;
+  int alarm_sub_, step_sub_, periodic_sub_;
   RawScale raw_scale_;
   FakeScale fake_scale_;
-  std::mutex data_lock_;
+  std::mutex data_lock_;  // for the cell data
   bool looping_ = false;
 
   static constexpr double kMinNormalReadingGrams = -10;    // -10 g
   static constexpr double kMaxNormalReadingGrams = 100000; // 100 kg
-  // The Kettle weighs about 8kg, so 2kg is pretty conservative.
-  // This is the threshold below which we declare the kettle lifted off
-  // of the scale.
-  static constexpr double kKettleLiftedThresholdGrams = 2000;
-  static constexpr size_t kPointsForFiltering = 30;
+  // The rest of the tuning is in Rig.
   // Max number of points to store in our data queue
-  static constexpr size_t kMaxDataPoints = 1000;
-  static constexpr int64_t kCheckEmptyIntervalMs = 1000;
-  static constexpr int64_t kCheckDrainingIntervalMs = 500;
-  // Represents slope / ave deviation from slope
-  static constexpr double kDrainingThreshGramsPerSecond = -50.0;  //TODO: check value
-  static constexpr double kDrainingConfidenceThresh = 10.0;  //TODO: check value
-  static constexpr double kTotalLossThreshold = 200.0;  //TODO: check value
-  // Data points to use when checking for draining.  Note that each point delays
-  // the warning by ~100ms.
-  static constexpr int kPointsToCheckForDrain = 30;
-  // Below this weight, we declare the grainfather empty
-  static constexpr double kEmptyThresholdGrams = 9000;
+  static constexpr size_t kMaxDataPoints = SampleBuffer::kMaxSamples;
+  // Weight for new measurements of the sample period.
+  static constexpr double kSamplePeriodFilterGain = 0.05;
+  // Written on the measurement thread, and read by MeasureWeight.
+  std::atomic<double> sample_period_ms_{Rig::kDefaultSamplePeriodMs};
+  // The period starts out as the median of the first intervals, so the
+  // windows are sized once, rather than each time the filtered period
+  // moves towards the real one.  Only touched on the measurement thread.
+  static constexpr size_t kFirstIntervals = 9;
+  std::array<double, kFirstIntervals> first_intervals_;
+  size_t num_first_intervals_ = 0;
+  // Rig's point counts are for Rig::kDefaultSamplePeriodMs.  The windows
+  // are resized to cover the same time when the measured period is off by
+  // more than this fraction.  The noise of the HX711 goes up with its
+  // rate about as fast as the points come in, so it takes the same time
+  // to be as sure of a slope at any rate.
+  static constexpr double kWindowResizeFraction = 0.2;
+  // The period the windows were last sized for.  Only touched on the
+  // measurement thread.
+  double window_period_ms_ = Rig::kDefaultSamplePeriodMs;
+  // filter_stats_'s window, for FilterData.
+  std::atomic<size_t> points_for_filtering_{Rig::kPointsForFiltering};
 
   bool disable_for_test_ = false;
 
-  static constexpr const char *kRawLogFile = "./weight_data.txt";
-  bool raw_logger_enabled_ = false;
+  // Every reading is logged to kRawLogFile.  raw_log_tool reads it.
+  static constexpr const char *kRawLogFile = "./weight_data.bin";
+  static constexpr int64_t kRawLogFlushIntervalUs = 1000000;
+  RawLogWriter raw_log_;
+  std::atomic<bool> raw_logger_enabled_{false};
   std::thread raw_logger_thread_;
+  // Writes raw_log_ to the file every kRawLogFlushIntervalUs.
   void RawLoggerThread();
 
   std::function<void(double)> weight_callback_;
@@ -143,27 +300,52 @@ class ScaleFilter {
   // For periodic update:
   int64_t periodic_update_period_, last_periodic_update_ = 0;
   std::function<void(double, int64_t)> periodic_callback_;
-  // For draining update:
-  int64_t draining_update_period_, last_draining_update_ = 0;
+  // The draining and empty checks are made on every sample.
   std::function<void()> draining_callback_;
-  // For empty update:
-  int64_t empty_update_period_, last_empty_update_ = 0;
   std::function<void()> empty_callback_;
 
   // callbacks for raw scale:
-  void OnNewMeasurement(uint32_t weight, int64_t tmeas);
+  void OnNewMeasurement(double weight, int64_t tmeas);
+  void OnCellMeasurement(const uint32_t *raw, int num_cells, int64_t tmeas);
   void OnScaleError();
+  // |rig_points| at Rig::kDefaultSamplePeriodMs, scaled to cover the same
+  // time at sample_period_ms_.
+  size_t ScaledPoints(size_t rig_points) const;
+  // Resizes (and empties) the windows, and the vibration filter, for
+  // sample_period_ms_.
+  void ResizeWindows();
 
   // Filter all a set of data since |min_time_bound|
-  // Right now just returns the mean.
+  // Right now just returns the mean.  With no bound, this is just the
+  // running mean, which doesn't need to look at the samples.
   double FilterData(int64_t min_time_bound);
 
   // Fits a slope to the recent data, to see if we are losing weight
-  // at a constant rate.
+  // at a constant rate.  Also checks trends_, which fit slopes over
+  // longer times, against lower thresholds.
   bool CheckDraining();
 
-  inline double ToGrams(uint32_t raw) { return ((double)raw - offset_) * scale_;}
+  // Blocks until there are samples past |count| (a samples_.Count()),
+  // or until |deadline| (MonotonicNs).  Returns false at the deadline.
+  bool WaitForSamplesAfter(uint64_t count, int64_t deadline);
+
+  // MeasureWeight, which can also give the mean of the raw readings.
+  WeightReading CollectReadings(double tolerance_grams, size_t max_points,
+                                int64_t timeout, double *raw_mean);
+
+  int CalibrateCells(double calibration_mass, int cell);
+  int SaveCalibration();
+
+  inline double ToGrams(double raw) { return (raw - offset_) * scale_;}
 
 };
 
+// The instantiations are in scale_filter.cc.
+extern template class BasicScaleFilter<Rig10Sps>;
+extern template class BasicScaleFilter<Rig80Sps>;
+extern template class BasicScaleFilter<TestRig>;
+extern template class BasicScaleFilter<RuntimeRig>;
 
+// The brewhouse scale.
+using ScaleFilter = BasicScaleFilter<Rig10Sps>;
+using TestScaleFilter = BasicScaleFilter<TestRig>;
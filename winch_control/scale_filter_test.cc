@@ -16,14 +16,10 @@ void ErrorFunc() {
 }
 
 
-// Stuff from ScaleFilter:
-  static constexpr size_t kMaxDataPoints = 1000;
-  static constexpr size_t kPointsForFiltering = 30;
-  static constexpr double kDrainingThreshGramsPerSecond = -50.0;  //TODO: check value
-  static constexpr double kDrainingConfidenceThresh = 10.0;  //TODO: check value
-  // Data points to use when checking for draining.  Note that each point delays
-  // the warning by ~100ms.
-  static constexpr int kPointsToCheckForDrain = 30;
+// The same tuning as ScaleFilter's tests:
+  static constexpr size_t kMaxDataPoints = SampleBuffer::kMaxSamples;
+  static constexpr size_t kPointsForFiltering = TestRig::kPointsForFiltering;
+  static constexpr int kPointsToCheckForDrain = TestRig::kPointsToCheckForDrain;
   std::deque<double> weight_data_;
   std::deque<int64_t> time_data_;
 
@@ -58,10 +54,10 @@ bool OnNewMeasurement(double weight, int64_t tmeas, SlopeInfo *info) {
   }
   *info = FitSlope(weights, times);
 
-  // if (info.slope < kDrainingThreshGramsPerSecond &&
-      // info.ave_diff < kDrainingConfidenceThresh &&
+  // if (info.slope < TestRig::kDrainingThreshGramsPerSecond &&
+      // info.ave_diff < TestRig::kDrainingConfidenceThresh &&
       // info.biggest_change < kTotalLossThreshold) {
-    // std::cout << "Slope was: " << info.slope << " > " << kDrainingThreshGramsPerSecond 
+    // std::cout << "Slope was: " << info.slope << " > " << TestRig::kDrainingThreshGramsPerSecond 
               // << " grams/sec" << std::endl;
     // return true;
   // }
@@ -97,7 +93,8 @@ int main(int argc, char **argv) {
       double uncal_data, cal_data;
       data_file >> tmeas >> uncal_data >> cal_data;
       SlopeInfo info;
-      if (OnNewMeasurement(cal_data, tmeas, &info)) {
+      // The raw log is in wall clock ms.
+      if (OnNewMeasurement(cal_data, tmeas * kNsPerMs, &info)) {
           log_file << tmeas << " " << cal_data << " " << info.mean << " "
               << info.slope << " " << info.ave_diff << " " << info.biggest_change <<std::endl;
       }
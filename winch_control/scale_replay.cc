@@ -0,0 +1,207 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Replays a recorded weight log through ScaleFilter, as fast as it will
+// go, and scores the alarms against labels of what really happened:
+// how long each took to go off, what was missed, and false alarms per
+// hour.  For checking the "TODO: check value" thresholds against real
+// brews.
+//
+// usage: scale_replay <weight log> [labels file] [options]
+//   --set <name>=<value>   changes a threshold (a RuntimeRig member, like
+//                          kDrainingThreshGramsPerSecond=-40)
+//   --max-latency <sec>    an alarm later than this misses (default 60)
+//   --rearm <sec>          time after an alarm before the next (default 60)
+// The weight log is a binary raw log, or text with "time_ms raw grams"
+// lines.  See replay.h for the labels.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "monotonic_clock.h"
+#include "replay.h"
+#include "scale_config.h"
+#include "scale_filter.h"
+
+struct RigValue {
+  const char *name;
+  double *value;
+  size_t *points;
+};
+
+static const RigValue kRigValues[] = {
+  {"kKettleLiftedThresholdGrams", &RuntimeRig::kKettleLiftedThresholdGrams, nullptr},
+  {"kPointsForFiltering", nullptr, &RuntimeRig::kPointsForFiltering},
+  {"kPointsForQuickFiltering", nullptr, &RuntimeRig::kPointsForQuickFiltering},
+  {"kVibrationFftSize", nullptr, &RuntimeRig::kVibrationFftSize},
+  {"kDrainingThreshGramsPerSecond", &RuntimeRig::kDrainingThreshGramsPerSecond, nullptr},
+  {"kDrainingConfidenceThresh", &RuntimeRig::kDrainingConfidenceThresh, nullptr},
+  {"kTotalLossThreshold", &RuntimeRig::kTotalLossThreshold, nullptr},
+  {"kDrainingRateSigmas", &RuntimeRig::kDrainingRateSigmas, nullptr},
+  {"kPointsToCheckForDrain", nullptr, &RuntimeRig::kPointsToCheckForDrain},
+  {"kPointsToCheckForDrainQuickly", nullptr, &RuntimeRig::kPointsToCheckForDrainQuickly},
+  {"kEmptyThresholdGrams", &RuntimeRig::kEmptyThresholdGrams, nullptr},
+  {"kDrainDoneGramsPerSec", &RuntimeRig::kDrainDoneGramsPerSec, nullptr},
+};
+
+// Sets a RuntimeRig value from "name=value".  Returns -1 if there's no
+// such value, or if it is a window of less than 2 points.
+static int SetRigValue(const char *setting) {
+  const char *equals = strchr(setting, '=');
+  if (!equals) return -1;
+  std::string name(setting, equals - setting);
+  for (const RigValue &rig_value : kRigValues) {
+    if (name != rig_value.name) continue;
+    if (rig_value.value) {
+      *rig_value.value = atof(equals + 1);
+    } else {
+      // A slope needs two points.
+      int points = atoi(equals + 1);
+      if (points < 2) return -1;
+      *rig_value.points = points;
+    }
+    return 0;
+  }
+  return -1;
+}
+
+// A filter fed through its FakeScale.  Its alarms go off on the
+// dispatcher thread, so after each reading that posted one, we wait for
+// it, so we know which reading set it off.
+class ReplayFilter {
+ public:
+  ReplayFilter() : filter_("") {
+    filter_.DisableForTest();
+    filter_.InitLoop(nullptr);
+    fake_scale_ = filter_.GetFakeScale();
+    fake_scale_->StopLoop();
+  }
+
+  // Returns true if the reading set off an alarm.
+  bool Input(double grams, int64_t time) {
+    fake_scale_->InputData(grams, time);
+    CallbackDispatcher::Status status = filter_.GetDispatchStatus();
+    if (status.posted == posted_) return false;
+    posted_ = status.posted;
+    while (filter_.GetDispatchStatus().delivered < posted_) usleep(10);
+    return fired_.exchange(false);
+  }
+
+  BasicScaleFilter<RuntimeRig> *filter() { return &filter_; }
+  std::function<void()> Alarm() { return [this]() { fired_ = true; }; }
+
+ private:
+  BasicScaleFilter<RuntimeRig> filter_;
+  FakeScale *fake_scale_;
+  int64_t posted_ = 0;
+  std::atomic<bool> fired_{false};
+};
+
+int main(int argc, char **argv) {
+  const char *log_path = nullptr, *labels_path = nullptr;
+  double max_latency_sec = 60, rearm_sec = 60;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--set") && i + 1 < argc) {
+      if (SetRigValue(argv[++i])) {
+        printf("Can't set %s\n", argv[i]);
+        return -1;
+      }
+    } else if (!strcmp(argv[i], "--max-latency") && i + 1 < argc) {
+      max_latency_sec = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--rearm") && i + 1 < argc) {
+      rearm_sec = atof(argv[++i]);
+    } else if (!log_path) {
+      log_path = argv[i];
+    } else if (!labels_path) {
+      labels_path = argv[i];
+    } else {
+      log_path = nullptr;
+      break;
+    }
+  }
+  if (!log_path) {
+    printf("usage: %s <weight log> [labels file] [--set name=value] "
+           "[--max-latency sec] [--rearm sec]\n", argv[0]);
+    return -1;
+  }
+
+  std::vector<ReplaySample> samples;
+  if (LoadWeightLog(log_path, &samples)) return -1;
+  if (samples.empty()) {
+    printf("No readings in %s\n", log_path);
+    return -1;
+  }
+  ReplayLabels labels;
+  if (labels_path && LoadReplayLabels(labels_path, &labels)) return -1;
+
+  // The draining alarm and NotifyWhenDrainComplete can't both be on in one
+  // filter, so each gets its own.
+  ReplayFilter drain_filter, empty_filter;
+  std::vector<int64_t> alarms[kNumReplayEvents];
+  std::vector<int64_t> &drains = alarms[static_cast<int>(ReplayEvent::kDrain)];
+  std::vector<int64_t> &lifts = alarms[static_cast<int>(ReplayEvent::kLift)];
+  std::vector<int64_t> &empties = alarms[static_cast<int>(ReplayEvent::kEmpty)];
+  int64_t rearm_us = rearm_sec * 1e6;
+  int64_t drain_rearm = 0, empty_rearm = 0;
+  bool drain_armed = false, empty_armed = false, lifted = false;
+
+  int64_t tstart = MonotonicNs();
+  int64_t first_us = samples.front().wall_us;
+  for (const ReplaySample &sample : samples) {
+    // Turn the alarms on and off as the labels say.
+    bool arm_drain = labels.Armed(ReplayEvent::kDrain, sample.wall_us) &&
+                     sample.wall_us >= drain_rearm;
+    if (arm_drain != drain_armed) {
+      if (arm_drain) {
+        drain_filter.filter()->EnableDrainingAlarm(drain_filter.Alarm());
+      } else {
+        drain_filter.filter()->DisableDrainingAlarm();
+      }
+      drain_armed = arm_drain;
+    }
+    bool arm_empty = labels.Armed(ReplayEvent::kEmpty, sample.wall_us) &&
+                     sample.wall_us >= empty_rearm;
+    if (arm_empty != empty_armed) {
+      empty_filter.filter()->NotifyWhenDrainComplete(arm_empty ? empty_filter.Alarm() : nullptr);
+      empty_armed = arm_empty;
+    }
+    // The filter only needs the times to go up.
+    int64_t time = kNsPerSec + (sample.wall_us - first_us) * kNsPerUs;
+    if (drain_filter.Input(sample.grams, time)) {
+      drains.push_back(sample.wall_us);
+      drain_armed = false;
+      drain_rearm = sample.wall_us + rearm_us;
+    }
+    if (empty_filter.Input(sample.grams, time)) {
+      empties.push_back(sample.wall_us);
+      empty_armed = false;
+      empty_rearm = sample.wall_us + rearm_us;
+    }
+    bool now_lifted = drain_filter.filter()->HasKettleLifted();
+    if (now_lifted && !lifted && labels.Armed(ReplayEvent::kLift, sample.wall_us)) {
+      lifts.push_back(sample.wall_us);
+    }
+    lifted = now_lifted;
+  }
+  double replay_sec = (MonotonicNs() - tstart) / (double)kNsPerSec;
+  double log_hours = (samples.back().wall_us - first_us) / 3600e6;
+
+  printf("Replayed %zu readings (%.2f hours) in %.2f seconds, %.0fx real time\n",
+         samples.size(), log_hours, replay_sec, log_hours * 3600 / replay_sec);
+  printf("%-6s %7s %9s %7s %8s %12s %12s %13s\n", "event", "labels", "detected",
+         "missed", "false", "false/hour", "mean lat s", "max lat s");
+  for (int i = 0; i < kNumReplayEvents; ++i) {
+    ReplayEvent event = static_cast<ReplayEvent>(i);
+    EventScore score = ScoreEvent(labels, event, alarms[i], max_latency_sec * 1e6);
+    printf("%-6s %7d %9d %7d %8d %12.2f %12.1f %13.1f\n", ReplayEventName(event),
+           score.labels, score.detected, score.missed, score.false_alarms,
+           log_hours > 0 ? score.false_alarms / log_hours : 0,
+           score.mean_latency_sec, score.max_latency_sec);
+  }
+  return 0;
+}
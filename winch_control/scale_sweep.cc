@@ -0,0 +1,346 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Tries every combination of the draining slope test's settings (window,
+// slope threshold, confidence and total loss) against recorded sessions,
+// on all the cores, and prints the settings that are the best trade off
+// between how quickly a drain is seen and how many false alarms there are.
+//
+// usage: scale_sweep [options] <weight log> <labels file> [<log> <labels> ...]
+//   --windows <n,n,...>      points to check for drain
+//   --slopes <g,g,...>       draining thresholds, grams per second
+//   --confidence <g,g,...>   draining confidence thresholds, grams
+//   --loss <g,g,...>         total loss thresholds, grams
+//   --max-latency <sec>      an alarm later than this misses (default 60)
+//   --rearm <sec>            time after an alarm before the next (default 60)
+//   --threads <n>            default is all the cores
+//   --csv <file>             also write every combination's score
+// The logs and labels are as for scale_replay.  This only sweeps the slope
+// test in CheckDraining, on the unfiltered weights.  The flow estimate and
+// the pump's vibration filter are left out, so check the settings it picks
+// with scale_replay.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "monotonic_clock.h"
+#include "replay.h"
+#include "scale_config.h"
+#include "slope_batch.h"
+
+// Runs tasks on all the cores.  Each worker takes tasks from the front of
+// its own queue, and when that's empty, steals from the back of another's,
+// so a worker that got the long sessions doesn't hold up the rest.
+class TaskPool {
+ public:
+  explicit TaskPool(int threads) : queues_(threads) {}
+
+  // Only before Run().
+  void Add(std::function<void()> task) {
+    queues_[next_queue_++ % queues_.size()].tasks.push_back(std::move(task));
+  }
+
+  // Returns when all the tasks are done.
+  void Run() {
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < queues_.size(); ++i) {
+      workers.emplace_back(&TaskPool::Work, this, i);
+    }
+    for (std::thread &worker : workers) worker.join();
+  }
+
+  int64_t Steals() const { return steals_; }
+
+ private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  bool Take(size_t queue, bool steal, std::function<void()> *task) {
+    std::lock_guard<std::mutex> lock(queues_[queue].mutex);
+    std::deque<std::function<void()>> &tasks = queues_[queue].tasks;
+    if (tasks.empty()) return false;
+    if (steal) {
+      *task = std::move(tasks.back());
+      tasks.pop_back();
+    } else {
+      *task = std::move(tasks.front());
+      tasks.pop_front();
+    }
+    return true;
+  }
+
+  void Work(size_t queue) {
+    std::function<void()> task;
+    while (true) {
+      if (!Take(queue, false, &task)) {
+        // Nothing adds tasks while they run, so once every queue is
+        // empty, we're done.
+        bool stole = false;
+        for (size_t i = 1; i < queues_.size() && !stole; ++i) {
+          stole = Take((queue + i) % queues_.size(), true, &task);
+        }
+        if (!stole) return;
+        steals_++;
+      }
+      task();
+    }
+  }
+
+  std::vector<Queue> queues_;
+  size_t next_queue_ = 0;
+  std::atomic<int64_t> steals_{0};
+};
+
+struct Session {
+  std::string log_path;
+  std::vector<double> weights;
+  std::vector<int64_t> times;   // ns, for FitSlopes
+  std::vector<int64_t> wall_us;
+  std::vector<bool> armed;      // if the draining alarm is on at each reading
+  ReplayLabels labels;
+  double hours = 0;
+};
+
+struct Setting {
+  size_t window;
+  double slope, confidence, loss;
+};
+
+// A setting's score on all the sessions.
+struct SweepScore {
+  int labels = 0, detected = 0, false_alarms = 0;
+  double latency_sum = 0, max_latency_sec = 0;
+  double hours = 0;
+  // Misses count as the longest latency allowed.
+  double Latency(double max_latency_sec) const {
+    if (labels == 0) return 0;
+    return (latency_sum + (labels - detected) * max_latency_sec) / labels;
+  }
+  double FalsePerHour() const { return hours > 0 ? false_alarms / hours : 0; }
+};
+
+// Parses "a,b,c".  Returns -1 if it's empty or has something that isn't a
+// number.
+static int ParseList(const char *text, std::vector<double> *values) {
+  values->clear();
+  std::string list(text);
+  size_t start = 0;
+  while (start <= list.size()) {
+    size_t comma = list.find(',', start);
+    if (comma == std::string::npos) comma = list.size();
+    std::string item = list.substr(start, comma - start);
+    char *end;
+    double value = strtod(item.c_str(), &end);
+    if (item.empty() || *end) return -1;
+    values->push_back(value);
+    start = comma + 1;
+  }
+  return values->empty() ? -1 : 0;
+}
+
+static int LoadSession(const char *log_path, const char *labels_path, Session *session) {
+  std::vector<ReplaySample> samples;
+  if (LoadWeightLog(log_path, &samples)) return -1;
+  if (samples.empty()) {
+    printf("No readings in %s\n", log_path);
+    return -1;
+  }
+  if (LoadReplayLabels(labels_path, &session->labels)) return -1;
+  session->log_path = log_path;
+  for (const ReplaySample &sample : samples) {
+    session->weights.push_back(sample.grams);
+    session->times.push_back(sample.wall_us * kNsPerUs);
+    session->wall_us.push_back(sample.wall_us);
+    session->armed.push_back(session->labels.Armed(ReplayEvent::kDrain, sample.wall_us));
+  }
+  session->hours = (samples.back().wall_us - samples.front().wall_us) / 3600e6;
+  return 0;
+}
+
+// Where the draining alarm would go off with |setting|, like scale_replay:
+// one shot, and on again |rearm_us| later.
+static void FindAlarms(const Session &session, const SlopeSeries &series,
+                       const Setting &setting, int64_t rearm_us,
+                       std::vector<int64_t> *alarms) {
+  alarms->clear();
+  int64_t rearm = INT64_MIN;
+  for (size_t i = 0; i < series.size(); ++i) {
+    if (!series.Full(i) || !session.armed[i] || session.wall_us[i] < rearm) continue;
+    if (series.slope[i] < setting.slope && series.ave_diff[i] < setting.confidence &&
+        series.biggest_change[i] < setting.loss) {
+      alarms->push_back(session.wall_us[i]);
+      rearm = session.wall_us[i] + rearm_us;
+    }
+  }
+}
+
+// Settings no other setting beats on both latency and false alarms, by
+// false alarms.
+static std::vector<size_t> ParetoFront(const std::vector<SweepScore> &scores,
+                                       double max_latency_sec) {
+  std::vector<size_t> order(scores.size());
+  for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      double fa = scores[a].FalsePerHour(), fb = scores[b].FalsePerHour();
+      if (fa != fb) return fa < fb;
+      return scores[a].Latency(max_latency_sec) < scores[b].Latency(max_latency_sec);
+    });
+  std::vector<size_t> front;
+  for (size_t i : order) {
+    if (front.empty() ||
+        scores[i].Latency(max_latency_sec) < scores[front.back()].Latency(max_latency_sec)) {
+      front.push_back(i);
+    }
+  }
+  return front;
+}
+
+static int WriteCsv(const char *path, const std::vector<Setting> &settings,
+                    const std::vector<SweepScore> &scores, double max_latency_sec) {
+  FILE *out = fopen(path, "w");
+  if (!out) {
+    printf("Failed to open %s\n", path);
+    return -1;
+  }
+  fprintf(out, "window,slope,confidence,loss,labels,detected,false_alarms,"
+          "false_per_hour,latency_sec,max_latency_sec\n");
+  for (size_t i = 0; i < settings.size(); ++i) {
+    const Setting &s = settings[i];
+    const SweepScore &score = scores[i];
+    fprintf(out, "%zu,%g,%g,%g,%d,%d,%d,%.3f,%.2f,%.2f\n", s.window, s.slope,
+            s.confidence, s.loss, score.labels, score.detected, score.false_alarms,
+            score.FalsePerHour(), score.Latency(max_latency_sec), score.max_latency_sec);
+  }
+  fclose(out);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  std::vector<double> windows = {10, 15, 20, 30, 40, 60};
+  std::vector<double> slopes = {-10, -20, -30, -40, -50, -60, -80};
+  std::vector<double> confidences = {2, 5, 10, 20, 40};
+  std::vector<double> losses = {Rig10Sps::kTotalLossThreshold};
+  double max_latency_sec = 60, rearm_sec = 60;
+  int threads = std::max(1u, std::thread::hardware_concurrency());
+  const char *csv_path = nullptr;
+  std::vector<const char *> paths;
+  bool ok = true;
+  for (int i = 1; i < argc && ok; ++i) {
+    bool has_value = i + 1 < argc;
+    if (!strcmp(argv[i], "--windows") && has_value) {
+      ok = !ParseList(argv[++i], &windows);
+    } else if (!strcmp(argv[i], "--slopes") && has_value) {
+      ok = !ParseList(argv[++i], &slopes);
+    } else if (!strcmp(argv[i], "--confidence") && has_value) {
+      ok = !ParseList(argv[++i], &confidences);
+    } else if (!strcmp(argv[i], "--loss") && has_value) {
+      ok = !ParseList(argv[++i], &losses);
+    } else if (!strcmp(argv[i], "--max-latency") && has_value) {
+      max_latency_sec = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--rearm") && has_value) {
+      rearm_sec = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--threads") && has_value) {
+      threads = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--csv") && has_value) {
+      csv_path = argv[++i];
+    } else if (argv[i][0] == '-') {
+      ok = false;
+    } else {
+      paths.push_back(argv[i]);
+    }
+  }
+  for (double window : windows) ok &= window >= 2;
+  if (!ok || paths.empty() || paths.size() % 2 || threads < 1) {
+    printf("usage: %s [--windows n,n] [--slopes g,g] [--confidence g,g] [--loss g,g] "
+           "[--max-latency sec] [--rearm sec] [--threads n] [--csv file] "
+           "<weight log> <labels file> [<weight log> <labels file> ...]\n", argv[0]);
+    return -1;
+  }
+
+  std::vector<Session> sessions(paths.size() / 2);
+  double hours = 0;
+  for (size_t i = 0; i < sessions.size(); ++i) {
+    if (LoadSession(paths[2 * i], paths[2 * i + 1], &sessions[i])) return -1;
+    hours += sessions[i].hours;
+  }
+
+  // Settings are in window order, so each window's are together.
+  std::vector<Setting> settings;
+  for (double window : windows) {
+    for (double slope : slopes) {
+      for (double confidence : confidences) {
+        for (double loss : losses) {
+          settings.push_back({(size_t)window, slope, confidence, loss});
+        }
+      }
+    }
+  }
+  size_t per_window = slopes.size() * confidences.size() * losses.size();
+
+  // One task per session and window: it fits the slopes once, then tries
+  // all the thresholds on them.  Each task has its own row of scores, so
+  // they don't need a lock.
+  int64_t rearm_us = rearm_sec * 1e6, max_latency_us = max_latency_sec * 1e6;
+  std::vector<std::vector<EventScore>> session_scores(
+      sessions.size(), std::vector<EventScore>(settings.size()));
+  TaskPool pool(threads);
+  for (size_t w = 0; w < windows.size(); ++w) {
+    for (size_t s = 0; s < sessions.size(); ++s) {
+      pool.Add([&, w, s]() {
+          const Session &session = sessions[s];
+          SlopeSeries series;
+          FitSlopes(session.weights, session.times, (size_t)windows[w], &series);
+          std::vector<int64_t> alarms;
+          for (size_t i = w * per_window; i < (w + 1) * per_window; ++i) {
+            FindAlarms(session, series, settings[i], rearm_us, &alarms);
+            session_scores[s][i] =
+                ScoreEvent(session.labels, ReplayEvent::kDrain, alarms, max_latency_us);
+          }
+        });
+    }
+  }
+  int64_t tstart = MonotonicNs();
+  pool.Run();
+  double sweep_sec = (MonotonicNs() - tstart) / (double)kNsPerSec;
+
+  std::vector<SweepScore> scores(settings.size());
+  for (size_t i = 0; i < settings.size(); ++i) {
+    SweepScore &score = scores[i];
+    score.hours = hours;
+    for (size_t s = 0; s < sessions.size(); ++s) {
+      const EventScore &event = session_scores[s][i];
+      score.labels += event.labels;
+      score.detected += event.detected;
+      score.false_alarms += event.false_alarms;
+      score.latency_sum += event.mean_latency_sec * event.detected;
+      score.max_latency_sec = std::max(score.max_latency_sec, event.max_latency_sec);
+    }
+  }
+
+  printf("Swept %zu settings over %zu sessions (%.2f hours) in %.2f seconds on %d threads, "
+         "%lld steals\n", settings.size(), sessions.size(), hours, sweep_sec, threads,
+         (long long)pool.Steals());
+  printf("Best trade offs (misses count as %.0f s):\n", max_latency_sec);
+  printf("%6s %8s %10s %8s %9s %10s %12s %11s\n", "window", "slope", "confidence",
+         "loss", "detected", "false", "false/hour", "latency s");
+  for (size_t i : ParetoFront(scores, max_latency_sec)) {
+    const Setting &s = settings[i];
+    const SweepScore &score = scores[i];
+    printf("%6zu %8g %10g %8g %5d/%-3d %10d %12.2f %11.1f\n", s.window, s.slope,
+           s.confidence, s.loss, score.detected, score.labels, score.false_alarms,
+           score.FalsePerHour(), score.Latency(max_latency_sec));
+  }
+  if (csv_path) return WriteCsv(csv_path, settings, scores, max_latency_sec);
+  return 0;
+}
@@ -15,12 +15,35 @@ void ErrorFunc() {
   global_error=true;
 }
 
+// usage: scale_test [cpu]
+// If a cpu is given, the scale is read with real-time priority on that cpu.
 int main(int argc, char **argv) {
    ScaleFilter sf("calibration.txt");
+   if (argc > 1) {
+     RawScale::RealtimeOptions options;
+     options.enabled = true;
+     options.cpu = atoi(argv[1]);
+     sf.SetRealtime(options);
+   }
    sf.InitLoop(&ErrorFunc);
    sf.SetPeriodicWeightCallback(1000, &PrintWeight);
  while (!global_error) {
     sleep(10);
+    RawScale::Status status = sf.GetRawStatus();
+    printf("readings: %ld  discarded/errors: %ld  long pulses: %ld\n",
+           status.readings, status.errors, status.long_pulses);
+    printf("queued: %zu  max queued: %zu  dropped: %ld\n",
+           status.queue_depth, status.queue_max_depth, status.dropped_samples);
+    printf("wakeups/s: %.1f  cpu: %.2f%%  period: %.3f ms  prediction misses: %ld\n",
+           status.wakeups_per_sec, status.cpu_percent,
+           status.predicted_period_ns / 1e6, status.prediction_misses);
+    status.pulse_width_us.Print("SCLK pulse width", "us");
+    status.read_duration_us.Print("Read duration", "us");
+    CallbackDispatcher::Status dispatch = sf.GetDispatchStatus();
+    printf("callbacks: %ld  queued: %zu  max queued: %zu  dropped: %ld  rate limited: %ld\n",
+           dispatch.delivered, dispatch.queue_depth, dispatch.queue_max_depth,
+           dispatch.dropped, dispatch.rate_limited);
+    dispatch.latency_us.Print("Callback latency", "us");
  }
   return 0;
 }
@@ -0,0 +1,101 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "simulated_hx711.h"
+
+#include <chrono>
+
+void SimulatedHx711::PushConversion(uint32_t value) {
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    pending_.push_back(value & 0xFFFFFF);
+  }
+  conversion_cv_.notify_all();
+}
+
+int SimulatedHx711::LastPulseCount() {
+  std::lock_guard<std::mutex> lock(lock_);
+  return last_pulse_count_;
+}
+
+bool SimulatedHx711::LoadNext() {
+  if (loaded_ && pulses_ == 0) return true;  // still waiting to be read
+  loaded_ = false;
+  if (pending_.empty()) return false;
+  current_ = pending_.front();
+  pending_.pop_front();
+  loaded_ = true;
+  pulses_ = 0;
+  data_ = 0;
+  loaded_time_ = MonotonicNs();
+  return true;
+}
+
+int SimulatedHx711::WaitForDataReady(int timeout_ms) {
+  std::unique_lock<std::mutex> lock(lock_);
+  if (conversion_cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                              [this]() { return LoadNext(); })) {
+    wakeups_++;
+    ready_time_ns_ = loaded_time_;
+    return 1;
+  }
+  return 0;
+}
+
+int SimulatedHx711::SetClock(uint8_t value) {
+  std::lock_guard<std::mutex> lock(lock_);
+  // Rising edge shifts out the next bit:
+  if (value && !clock_ && loaded_) {
+    if (pulses_ < 24) {
+      data_ = (current_ >> (23 - pulses_)) & 1;
+    } else {
+      data_ = 1;
+    }
+    pulses_++;
+    last_pulse_count_ = pulses_;
+  }
+  clock_ = value ? 1 : 0;
+  return 0;
+}
+
+int SimulatedHx711::ReadData() {
+  std::lock_guard<std::mutex> lock(lock_);
+  return data_;
+}
+
+SimulatedHx711Array::SimulatedHx711Array(int num_cells) {
+  for (int i = 0; i < num_cells; ++i) {
+    cells_.emplace_back(new SimulatedHx711());
+  }
+}
+
+int SimulatedHx711Array::WaitForDataReady(int timeout_ms) {
+  int64_t deadline = MonotonicNs() + timeout_ms * kNsPerMs;
+  ready_time_ns_ = 0;
+  for (auto &cell : cells_) {
+    int remaining = (deadline - MonotonicNs()) / kNsPerMs;
+    if (cell->WaitForDataReady(remaining > 0 ? remaining : 0) <= 0) {
+      return 0;
+    }
+    if (cell->DataReadyTime() > ready_time_ns_) {
+      ready_time_ns_ = cell->DataReadyTime();
+    }
+  }
+  wakeups_++;
+  return 1;
+}
+
+int SimulatedHx711Array::SetClock(uint8_t value) {
+  for (auto &cell : cells_) {
+    cell->SetClock(value);
+  }
+  return 0;
+}
+
+int SimulatedHx711Array::ReadDataLines(uint8_t *values) {
+  for (size_t i = 0; i < cells_.size(); ++i) {
+    values[i] = cells_[i]->ReadData();
+  }
+  return 0;
+}
@@ -0,0 +1,64 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "hx711_lines.h"
+
+// An in-memory HX711, so the RawScale read path can be exercised without
+// hardware.  Conversions are queued with PushConversion, and are shifted out
+// MSB first on the rising edges of the clock, just like the real chip.
+// After the 24 data bits, the data line stays high until the next conversion.
+class SimulatedHx711 : public Hx711Lines {
+ public:
+  int Init() override { return 0; }
+  int WaitForDataReady(int timeout_ms) override;
+  int SetClock(uint8_t value) override;
+  int ReadData() override;
+
+  // Queue a 24 bit conversion result.  The data line will go low
+  // (data ready) once any previous conversion has been clocked out.
+  void PushConversion(uint32_t value);
+
+  // The number of clock pulses used to read the last finished conversion.
+  int LastPulseCount();
+
+ private:
+  std::mutex lock_;
+  std::condition_variable conversion_cv_;
+  std::deque<uint32_t> pending_;
+  uint32_t current_ = 0;
+  bool loaded_ = false;  // true while a conversion is waiting to be read
+  int pulses_ = 0, last_pulse_count_ = 0;
+  uint8_t clock_ = 0, data_ = 1;
+  int64_t loaded_time_ = 0;  // when data_ went low
+
+  // Moves the next pending conversion into the output register.
+  // Must hold lock_.
+  bool LoadNext();
+};
+
+// Several simulated HX711s on one clock line, like the load cells at the
+// corners of a platform.  Conversions are queued on each cell separately.
+class SimulatedHx711Array : public Hx711Lines {
+ public:
+  explicit SimulatedHx711Array(int num_cells);
+
+  SimulatedHx711 *cell(int i) { return cells_[i].get(); }
+
+  int Init() override { return 0; }
+  int WaitForDataReady(int timeout_ms) override;
+  int SetClock(uint8_t value) override;
+  int ReadData() override { return cells_[0]->ReadData(); }
+  int NumDataLines() override { return cells_.size(); }
+  int ReadDataLines(uint8_t *values) override;
+
+ private:
+  std::vector<std::unique_ptr<SimulatedHx711>> cells_;
+};
@@ -0,0 +1,124 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "slope_batch.h"
+
+#include <math.h>
+#include <algorithm>
+#include "monotonic_clock.h"
+#include "window_stats.h"
+
+// The prefix sums start again from a new origin every this many windows,
+// like WindowStats recomputes its sums, so t * t doesn't get big enough to
+// lose precision over a long log.
+static constexpr size_t kBlockSize = 1024;
+
+// Running sums of t, w, t*t, t*w and w*w.  Entry k is the sum of the first
+// k samples of the block.
+struct PrefixSums {
+  std::vector<double> t, w, tt, tw, ww;
+
+  void Resize(size_t n) {
+    t.resize(n);
+    w.resize(n);
+    tt.resize(n);
+    tw.resize(n);
+    ww.resize(n);
+  }
+};
+
+// The same fit as WindowStats::Slope(), for each window of |window| of
+// the samples summed in |sums|.  The first output is for the window of
+// the first |window| samples.  None of the outputs overlap the sums or
+// each other.
+static void FitWindows(const PrefixSums &sums, size_t window, double w0,
+                       double *__restrict mean, double *__restrict slope,
+                       double *__restrict ave_diff) {
+  const double *st = sums.t.data(), *sw = sums.w.data(), *stt = sums.tt.data();
+  const double *stw = sums.tw.data(), *sww = sums.ww.data();
+  double n = window;
+  size_t windows = sums.t.size() - window;
+  for (size_t i = 0; i < windows; ++i) {
+    size_t j = i + window;
+    double s_t = st[j] - st[i], s_w = sw[j] - sw[i];
+    double tmean = s_t / n, wmean = s_w / n;
+    double c_tt = (stt[j] - stt[i]) - s_t * tmean;  // sum((t - tmean)^2)
+    double c_tw = (stw[j] - stw[i]) - s_t * wmean;  // sum((t - tmean) * (w - wmean))
+    double c_ww = (sww[j] - sww[i]) - s_w * wmean;  // sum((w - wmean)^2)
+    // Divides even when it's thrown away, so there's nothing to branch on.
+    double s = std::min(std::max(c_ww / c_tw, -kMaxDrainSlope), kMaxDrainSlope);
+    s = fabs(c_ww) < 1e-6 ? 0 : s;
+    double sq_err = c_ww - 2 * s * c_tw + s * s * c_tt;
+    mean[i] = w0 + wmean;
+    slope[i] = s * 1000;  // convert from ms to seconds
+    ave_diff[i] = sqrt(std::max(sq_err, 0.0) / n);
+  }
+}
+
+// The windows ending at samples [first + window - 1, end), with the times
+// in ms from times[first] and the weights less weights[first].
+static void FitBlock(const std::vector<double> &weights, const std::vector<int64_t> &times,
+                     size_t window, size_t first, size_t end, PrefixSums *sums,
+                     SlopeSeries *series) {
+  size_t m = end - first;
+  sums->Resize(m + 1);
+  int64_t t0 = times[first];
+  double w0 = weights[first];
+  double st = 0, sw = 0, stt = 0, stw = 0, sww = 0;
+  sums->t[0] = sums->w[0] = sums->tt[0] = sums->tw[0] = sums->ww[0] = 0;
+  for (size_t k = 0; k < m; ++k) {
+    double t = (times[first + k] - t0) / (double)kNsPerMs;
+    double w = weights[first + k] - w0;
+    sums->t[k + 1] = st += t;
+    sums->w[k + 1] = sw += w;
+    sums->tt[k + 1] = stt += t * t;
+    sums->tw[k + 1] = stw += t * w;
+    sums->ww[k + 1] = sww += w * w;
+  }
+  size_t out = first + window - 1;
+  FitWindows(*sums, window, w0, series->mean.data() + out, series->slope.data() + out,
+             series->ave_diff.data() + out);
+}
+
+// The biggest change can't be done with sums, so it gets monotonic
+// queues of sample numbers, like WindowStats.
+static void FitBiggestChanges(const std::vector<double> &weights, size_t window,
+                              SlopeSeries *series) {
+  size_t n = weights.size();
+  std::vector<size_t> min_ids(n), max_ids(n);
+  size_t min_head = 0, min_tail = 0, max_head = 0, max_tail = 0;
+  for (size_t i = 0; i < n; ++i) {
+    if (i >= window) {
+      if (min_ids[min_head] == i - window) min_head++;
+      if (max_ids[max_head] == i - window) max_head++;
+    }
+    // Ties keep the earlier sample, so the fronts are the first occurrences.
+    while (min_tail > min_head && weights[min_ids[min_tail - 1]] > weights[i]) min_tail--;
+    min_ids[min_tail++] = i;
+    while (max_tail > max_head && weights[max_ids[max_tail - 1]] < weights[i]) max_tail--;
+    max_ids[max_tail++] = i;
+    if (i + 1 < window) continue;
+    double wmin = weights[min_ids[min_head]], wmax = weights[max_ids[max_head]];
+    // if lowest value comes after highest value
+    bool slope_down = min_ids[min_head] > max_ids[max_head];
+    series->biggest_change[i] = slope_down ? wmin - wmax : wmax - wmin;
+  }
+}
+
+void FitSlopes(const std::vector<double> &weights, const std::vector<int64_t> &times,
+               size_t window, SlopeSeries *series) {
+  size_t n = weights.size();
+  series->window = window;
+  series->mean.assign(n, 0);
+  series->slope.assign(n, 0);
+  series->ave_diff.assign(n, 0);
+  series->biggest_change.assign(n, 0);
+  if (window == 0 || n < window) return;
+  PrefixSums sums;
+  for (size_t first = 0; first + window <= n; first += kBlockSize) {
+    size_t end = std::min(n, first + kBlockSize + window - 1);
+    FitBlock(weights, times, window, first, end, &sums, series);
+  }
+  FitBiggestChanges(weights, window, series);
+}
@@ -0,0 +1,28 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// The SlopeInfo of every window in a log, one array per statistic.
+// Entry i is for the window that ends with sample i.  The first
+// window - 1 entries are for windows that aren't full yet, and are 0.
+struct SlopeSeries {
+  size_t window = 0;
+  std::vector<double> mean, slope, ave_diff, biggest_change;
+
+  size_t size() const { return slope.size(); }
+  bool Full(size_t i) const { return window > 0 && i + 1 >= window; }
+};
+
+// WindowStats::Slope() for every window of |window| samples in a whole
+// log at once, for tuning the draining thresholds offline.  |times| are
+// MonotonicNs.  The sums over each window are differences of prefix sums,
+// so each window costs the same whatever its size, and the loop over the
+// windows has no branches, so the compiler can vectorize it.
+void FitSlopes(const std::vector<double> &weights, const std::vector<int64_t> &times,
+               size_t window, SlopeSeries *series);
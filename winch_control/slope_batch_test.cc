@@ -0,0 +1,69 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "slope_batch.h"
+#include "monotonic_clock.h"
+#include "window_stats.h"
+#include "gtest/gtest.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+namespace {
+
+// Large, realistic timestamps and weights, to check we don't lose precision.
+constexpr int64_t kStartTime = 123456 * kNsPerSec;
+constexpr int64_t kPeriod = 100 * kNsPerMs;
+
+TEST(FitSlopes, MatchesWindowStats) {
+  std::vector<double> weights;
+  std::vector<int64_t> times;
+  srand(1);
+  double weight = 12000;
+  // Longer than a block, so the sums start again a few times.
+  for (int i = 0; i < 20000; ++i) {
+    // Steady, then draining, then steady again, with some noise.
+    if (i > 3000 && i < 6000) weight -= 2;
+    weights.push_back(weight + (rand() % 100) / 10.0);
+    times.push_back(kStartTime + i * kPeriod + rand() % kNsPerMs);
+  }
+  for (size_t window : {12, 30}) {
+    SlopeSeries series;
+    FitSlopes(weights, times, window, &series);
+    ASSERT_EQ(series.size(), weights.size());
+    WindowStats stats(window);
+    for (size_t i = 0; i < weights.size(); ++i) {
+      stats.Add(times[i], weights[i]);
+      ASSERT_EQ(series.Full(i), stats.Full());
+      if (!series.Full(i)) {
+        EXPECT_EQ(series.slope[i], 0);
+        continue;
+      }
+      SlopeInfo expected = stats.Slope();
+      ASSERT_NEAR(series.mean[i], expected.mean, 1e-6);
+      // Near 0 when the weight is flat, sum((t - tmean) * (w - wmean)) is
+      // only as good as the rounding, and the slope divides by it.  The
+      // running sums in WindowStats round more than these, so check against
+      // FitSlope.
+      SlopeInfo fit = FitSlope({weights.begin() + i + 1 - window, weights.begin() + i + 1},
+                               {times.begin() + i + 1 - window, times.begin() + i + 1});
+      if (fabs(fit.slope) < kMaxDrainSlope * 1000) {
+        ASSERT_NEAR(series.slope[i], fit.slope, 1e-6 * fabs(fit.slope) + 1e-6);
+        // WindowStats fits it with its own slope, so it's only as close.
+        ASSERT_NEAR(series.ave_diff[i], expected.ave_diff, 1e-4 * expected.ave_diff + 1e-4);
+      }
+      ASSERT_EQ(series.biggest_change[i], expected.biggest_change);
+    }
+  }
+}
+
+TEST(FitSlopes, ShortLog) {
+  SlopeSeries series;
+  FitSlopes({1, 2, 3}, {0, kPeriod, 2 * kPeriod}, 30, &series);
+  ASSERT_EQ(series.size(), 3u);
+  EXPECT_FALSE(series.Full(2));
+  EXPECT_EQ(series.slope[2], 0);
+}
+
+}  // namespace
@@ -0,0 +1,71 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// A fixed size ring buffer for passing items from exactly one producer
+// thread to exactly one consumer thread.  Neither side ever takes a lock or
+// waits: if the ring is full, Push drops the new item and counts an overflow.
+// |N| must be a power of 2.
+template <typename T, size_t N>
+class SpscRing {
+  static_assert(N && (N & (N - 1)) == 0, "SpscRing size must be a power of 2");
+
+ public:
+  // Producer only.  Returns false if the ring was full.
+  bool Push(const T &item) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    size_t tail = tail_.load(std::memory_order_acquire);
+    if (head - tail >= N) {
+      overflows_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    items_[head & (N - 1)] = item;
+    head_.store(head + 1, std::memory_order_release);
+    size_t depth = head + 1 - tail;
+    if (depth > max_depth_.load(std::memory_order_relaxed)) {
+      max_depth_.store(depth, std::memory_order_relaxed);
+    }
+    return true;
+  }
+
+  // Consumer only.  Returns false if the ring was empty.
+  bool Pop(T *item) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    *item = items_[tail & (N - 1)];
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // These can be called from any thread.
+  size_t Size() const {
+    // tail_ first: it never passes head_, so a later head_ can't be behind
+    // it.  But the consumer may pop, and the producer push again, between
+    // the loads, so the difference can be more than N.
+    size_t tail = tail_.load(std::memory_order_acquire);
+    size_t head = head_.load(std::memory_order_acquire);
+    return head - tail < N ? head - tail : N;
+  }
+  static constexpr size_t Capacity() { return N; }
+  // Number of items dropped because the ring was full.
+  int64_t Overflows() const { return overflows_.load(std::memory_order_relaxed); }
+  // The most items that have been waiting in the ring at once.
+  size_t MaxDepth() const { return max_depth_.load(std::memory_order_relaxed); }
+
+ private:
+  // head_ is only written by the producer, tail_ only by the consumer.
+  // Keep them on separate cache lines so the two sides don't fight over one.
+  alignas(64) std::atomic<size_t> head_{0};
+  alignas(64) std::atomic<size_t> tail_{0};
+  alignas(64) std::atomic<int64_t> overflows_{0};
+  std::atomic<size_t> max_depth_{0};
+  T items_[N];
+};
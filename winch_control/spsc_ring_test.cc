@@ -0,0 +1,65 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "spsc_ring.h"
+#include "gtest/gtest.h"
+
+#include <thread>
+
+namespace {
+
+TEST(SpscRing, PushPopInOrder) {
+  SpscRing<int, 4> ring;
+  int out;
+  EXPECT_FALSE(ring.Pop(&out));
+  EXPECT_TRUE(ring.Push(1));
+  EXPECT_TRUE(ring.Push(2));
+  EXPECT_EQ(ring.Size(), 2u);
+  ASSERT_TRUE(ring.Pop(&out));
+  EXPECT_EQ(out, 1);
+  ASSERT_TRUE(ring.Pop(&out));
+  EXPECT_EQ(out, 2);
+  EXPECT_FALSE(ring.Pop(&out));
+  EXPECT_EQ(ring.Overflows(), 0);
+}
+
+TEST(SpscRing, DropsWhenFull) {
+  SpscRing<int, 4> ring;
+  for (int i = 0; i < 6; ++i) {
+    ring.Push(i);
+  }
+  EXPECT_EQ(ring.Overflows(), 2);
+  EXPECT_EQ(ring.MaxDepth(), 4u);
+  // The oldest items are kept:
+  int out;
+  for (int i = 0; i < 4; ++i) {
+    ASSERT_TRUE(ring.Pop(&out));
+    EXPECT_EQ(out, i);
+  }
+  // Room again after popping:
+  EXPECT_TRUE(ring.Push(10));
+}
+
+TEST(SpscRing, ProducerAndConsumerThreads) {
+  static constexpr int kItems = 100000;
+  SpscRing<int, 64> ring;
+  std::thread producer([&ring]() {
+    for (int i = 0; i < kItems; ++i) {
+      while (!ring.Push(i)) {
+        std::this_thread::yield();
+      }
+    }
+  });
+  int expected = 0, out;
+  while (expected < kItems) {
+    if (ring.Pop(&out)) {
+      ASSERT_EQ(out, expected);
+      expected++;
+    }
+  }
+  producer.join();
+  EXPECT_LE(ring.MaxDepth(), 64u);
+}
+
+}  // namespace
@@ -0,0 +1,73 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "step_detector.h"
+
+#include <math.h>
+
+void StepDetector::Reset() {
+  plateau_ = Plateau();
+  had_plateau_ = false;
+  m2_ = 0;
+  high_sum_ = low_sum_ = 0;
+  window_.Clear();
+  last_step_ = WeightStep();
+}
+
+bool StepDetector::Add(int64_t time, double grams) {
+  if (plateau_.settled) {
+    double slack = config_.min_step_grams / 2;
+    double threshold = config_.threshold_sigmas * config_.reading_sigma;
+    double diff = grams - plateau_.grams;
+    if (high_sum_ == 0) high_start_ = time;
+    if (low_sum_ == 0) low_start_ = time;
+    high_sum_ = fmax(0, high_sum_ + diff - slack);
+    low_sum_ = fmax(0, low_sum_ - diff - slack);
+    if (high_sum_ <= threshold && low_sum_ <= threshold) {
+      // Still on the plateau.
+      plateau_.num_points++;
+      plateau_.grams += diff / plateau_.num_points;
+      m2_ += diff * (grams - plateau_.grams);
+      plateau_.variance = m2_ / (plateau_.num_points - 1);
+      plateau_.last_time = time;
+      return false;
+    }
+    // Off the plateau.
+    change_start_ = high_sum_ > threshold ? high_start_ : low_start_;
+    before_grams_ = plateau_.grams;
+    had_plateau_ = true;
+    plateau_.settled = false;
+    window_.Clear();
+  }
+  window_.Add(time, grams);
+  if (!window_.Full() ||
+      fabs(window_.LeastSquaresSlope()) > config_.settle_grams_per_sec ||
+      window_.Variance() > 9 * config_.reading_sigma * config_.reading_sigma) {
+    return false;
+  }
+  Settle();
+  if (!had_plateau_ || fabs(plateau_.grams - before_grams_) < config_.min_step_grams) {
+    // Drifted, but not enough to call it a step.
+    return false;
+  }
+  last_step_.start_time = change_start_;
+  last_step_.settle_time = time;
+  last_step_.before_grams = before_grams_;
+  last_step_.after_grams = plateau_.grams;
+  last_step_.variance = plateau_.variance;
+  return true;
+}
+
+void StepDetector::Settle() {
+  plateau_.settled = true;
+  plateau_.start_time = window_.OldestTime();
+  plateau_.last_time = window_.NewestTime();
+  plateau_.num_points = window_.size();
+  plateau_.grams = window_.Mean();
+  // Welford keeps the sum of squares about the mean, which the window's
+  // variance gives us.
+  m2_ = window_.Variance() * plateau_.num_points;
+  plateau_.variance = m2_ / (plateau_.num_points - 1);
+  high_sum_ = low_sum_ = 0;
+}
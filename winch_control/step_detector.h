@@ -0,0 +1,77 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "window_stats.h"
+
+// A stretch of time where the weight held steady.  Times are MonotonicNs.
+struct Plateau {
+  bool settled = false;  // false while the weight is changing
+  int64_t start_time = 0, last_time = 0;
+  size_t num_points = 0;
+  double grams = 0, variance = 0;  // of the readings on the plateau
+};
+
+// The weight stepped from one plateau to another.
+struct WeightStep {
+  int64_t start_time = 0;   // when the weight started to change
+  int64_t settle_time = 0;  // when it settled on the new plateau
+  double before_grams = 0, after_grams = 0;
+  double variance = 0;      // of the readings on the new plateau
+  double Change() const { return after_grams - before_grams; }
+};
+
+// Finds steps in the weight (adding grain, lifting the mash out) and the
+// plateaus after them.  While the weight is on a plateau, two CUSUMs add up
+// how far the readings are above and below the plateau mean (less some
+// slack, so noise doesn't add up).  When either passes the threshold, the
+// weight is changing.  Then we wait until a window of readings is flat and
+// quiet, which is the new plateau.  Everything is O(1) per reading.
+// Not thread safe.
+class StepDetector {
+ public:
+  struct Config {
+    double reading_sigma = 5.0;     // grams of noise on each reading
+    double min_step_grams = 30.0;   // smaller changes are not steps
+    // The CUSUM threshold, in reading sigmas.
+    double threshold_sigmas = 10.0;
+    // A new plateau needs this many readings, flatter than
+    // |settle_grams_per_sec|, with a spread of under 3 reading sigmas.
+    size_t settle_points = 20;
+    double settle_grams_per_sec = 3.0;
+  };
+
+  StepDetector() : StepDetector(Config()) {}
+  explicit StepDetector(const Config &config)
+    : config_(config), window_(config.settle_points) {}
+
+  // |time| is MonotonicNs.  Returns true if this reading finished a step,
+  // which is then in LastStep().
+  bool Add(int64_t time, double grams);
+  void Reset();
+
+  const Plateau &Current() const { return plateau_; }
+  const WeightStep &LastStep() const { return last_step_; }
+
+ private:
+  // Starts a plateau from the readings in window_.
+  void Settle();
+
+  Config config_;
+  Plateau plateau_;
+  bool had_plateau_ = false;
+  // Welford's running sum of squared differences from plateau_.grams
+  double m2_ = 0;
+  // The CUSUMs, and when each started adding up.
+  double high_sum_ = 0, low_sum_ = 0;
+  int64_t high_start_ = 0, low_start_ = 0;
+  // While changing, the last few readings, to see when they flatten out.
+  WindowStats window_;
+  double before_grams_ = 0;
+  int64_t change_start_ = 0;
+  WeightStep last_step_;
+};
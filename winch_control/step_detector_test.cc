@@ -0,0 +1,97 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "step_detector.h"
+#include "monotonic_clock.h"
+#include "gtest/gtest.h"
+
+#include <stdlib.h>
+#include <vector>
+
+namespace {
+
+constexpr int64_t kStartTime = 1000 * kNsPerSec;
+constexpr int64_t kPeriod = 100 * kNsPerMs;  // 10 SPS
+
+double Noise() { return (rand() % 1000) / 100.0 - 5.0; }
+
+// Feeds |count| readings around |grams| starting at reading |*i|,
+// and collects any steps.
+void Feed(StepDetector *detector, int *i, int count, double grams,
+          std::vector<WeightStep> *steps) {
+  for (int end = *i + count; *i < end; ++*i) {
+    if (detector->Add(kStartTime + *i * kPeriod, grams + Noise())) {
+      steps->push_back(detector->LastStep());
+    }
+  }
+}
+
+TEST(StepDetector, FindsPlateausAndSteps) {
+  srand(7);
+  StepDetector detector;
+  std::vector<WeightStep> steps;
+  int i = 0;
+  Feed(&detector, &i, 100, 20000, &steps);
+  EXPECT_TRUE(detector.Current().settled);
+  EXPECT_NEAR(detector.Current().grams, 20000, 1);
+  EXPECT_EQ(detector.Current().start_time, kStartTime);
+  EXPECT_TRUE(steps.empty());  // the first plateau isn't a step
+  // Add 5 kg of grain
+  Feed(&detector, &i, 100, 25000, &steps);
+  ASSERT_EQ(steps.size(), 1u);
+  EXPECT_NEAR(steps[0].Change(), 5000, 2);
+  EXPECT_EQ(steps[0].start_time, kStartTime + 100 * kPeriod);
+  // Settles as soon as there are enough readings on the new plateau.
+  EXPECT_EQ(steps[0].settle_time, kStartTime + 119 * kPeriod);
+  EXPECT_GT(steps[0].variance, 0);
+  EXPECT_LT(steps[0].variance, 25);
+  EXPECT_NEAR(detector.Current().grams, 25000, 1);
+  EXPECT_EQ(detector.Current().num_points, 100u - 20u + 20u);
+}
+
+TEST(StepDetector, FindsSmallLoss) {
+  srand(8);
+  StepDetector detector;
+  std::vector<WeightStep> steps;
+  int i = 0;
+  Feed(&detector, &i, 100, 20000, &steps);
+  Feed(&detector, &i, 100, 19950, &steps);
+  ASSERT_EQ(steps.size(), 1u);
+  EXPECT_NEAR(steps[0].Change(), -50, 2);
+  // It takes a few readings for the CUSUM to notice.
+  EXPECT_LT(steps[0].settle_time, kStartTime + 130 * kPeriod);
+}
+
+TEST(StepDetector, IgnoresNoiseAndSlowDrift) {
+  srand(9);
+  StepDetector detector;
+  std::vector<WeightStep> steps;
+  int i = 0;
+  Feed(&detector, &i, 10000, 20000, &steps);
+  EXPECT_TRUE(steps.empty());
+  EXPECT_EQ(detector.Current().num_points, 10000u);
+  // Boiling off 1 gram a second never makes a step.  The plateau has to
+  // catch up every so often, but it is settled most of the time.
+  int settled = 0;
+  for (int end = i + 10000; i < end; ++i) {
+    if (detector.Add(kStartTime + i * kPeriod, 20000 - (i - 10000) / 10.0 + Noise())) {
+      steps.push_back(detector.LastStep());
+    }
+    settled += detector.Current().settled;
+  }
+  EXPECT_TRUE(steps.empty());
+  EXPECT_GT(settled, 8000);
+}
+
+TEST(StepDetector, NoPlateauWhileDraining) {
+  StepDetector detector;
+  for (int i = 0; i < 200; ++i) {
+    detector.Add(kStartTime + i * kPeriod, 20000 - 2.0 * i);  // 20 g/s
+  }
+  EXPECT_FALSE(detector.Current().settled);
+  detector.Reset();
+  EXPECT_EQ(detector.Current().num_points, 0u);
+}
+
+}  // namespace
@@ -0,0 +1,86 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "trend_pyramid.h"
+
+TrendPyramid::TrendPyramid(const std::vector<LevelConfig> &levels) {
+  for (const LevelConfig &config : levels) {
+    levels_.emplace_back(config);
+  }
+}
+
+void TrendPyramid::Clear() {
+  for (Level &level : levels_) {
+    level.current = TrendBucket();
+    level.num_finished = 0;
+    level.stats.Clear();
+    level.draining = false;
+  }
+}
+
+void TrendPyramid::Add(int64_t time, double grams) {
+  if (levels_.empty()) return;
+  TrendBucket sample;
+  sample.start = time;
+  sample.count = 1;
+  sample.sum = sample.min = sample.max = grams;
+  AddToLevel(0, sample);
+}
+
+void TrendPyramid::AddToLevel(size_t index, const TrendBucket &bucket) {
+  Level &level = levels_[index];
+  // Buckets line up on multiples of their size, so each bucket of a level
+  // is made of whole buckets of the level below.
+  int64_t start = bucket.start - bucket.start % level.config.bucket_ns;
+  if (level.current.count && start != level.current.start) {
+    FinishBucket(index);
+  }
+  TrendBucket &current = levels_[index].current;
+  if (current.count == 0) {
+    current.start = start;
+    current.min = bucket.min;
+    current.max = bucket.max;
+  }
+  current.count += bucket.count;
+  current.sum += bucket.sum;
+  current.min = bucket.min < current.min ? bucket.min : current.min;
+  current.max = bucket.max > current.max ? bucket.max : current.max;
+}
+
+void TrendPyramid::FinishBucket(size_t index) {
+  Level &level = levels_[index];
+  const LevelConfig &config = level.config;
+  TrendBucket done = level.current;
+  level.current = TrendBucket();
+  level.buckets[level.num_finished % config.num_buckets] = done;
+  level.num_finished++;
+  level.stats.Add(done.start + config.bucket_ns / 2, done.Mean());
+  if (level.stats.Full()) {
+    SlopeInfo info = level.stats.Slope();
+    level.draining = info.slope < config.drain_grams_per_sec &&
+                     info.ave_diff < config.confidence &&
+                     info.biggest_change < -config.total_loss;
+  }
+  if (index + 1 < levels_.size()) {
+    AddToLevel(index + 1, done);
+  }
+}
+
+std::vector<TrendBucket> TrendPyramid::Buckets(size_t index) const {
+  const Level &level = levels_[index];
+  size_t n = level.num_finished < level.config.num_buckets ?
+             level.num_finished : level.config.num_buckets;
+  std::vector<TrendBucket> ret;
+  for (uint64_t i = level.num_finished - n; i < level.num_finished; ++i) {
+    ret.push_back(level.buckets[i % level.config.num_buckets]);
+  }
+  return ret;
+}
+
+int TrendPyramid::DrainingLevel() const {
+  for (size_t i = 0; i < levels_.size(); ++i) {
+    if (levels_[i].draining) return i;
+  }
+  return -1;
+}
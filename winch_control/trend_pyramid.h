@@ -0,0 +1,73 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include "window_stats.h"
+
+// The samples that fell in one bucket of time.
+struct TrendBucket {
+  int64_t start = 0;  // MonotonicNs
+  int64_t count = 0;
+  double sum = 0, min = 0, max = 0;
+  double Mean() const { return count ? sum / count : 0; }
+};
+
+// Keeps the weight history downsampled into levels of coarser and coarser
+// buckets (say 1 second, 10 seconds and 1 minute), with a fixed number of
+// buckets at each level.  A slope is fit to the bucket means at each level,
+// so slow trends over minutes to an hour can be checked in bounded memory.
+// Samples are added in O(1), and each level is checked only when one of its
+// buckets fills.  Not thread safe.
+class TrendPyramid {
+ public:
+  struct LevelConfig {
+    int64_t bucket_ns;        // each must be a multiple of the one before
+    size_t num_buckets;       // buckets the slope is fit over
+    // A level shows draining if, like ScaleFilter::CheckDraining, the slope
+    // is below |drain_grams_per_sec|, the fit is good to |confidence| grams,
+    // and we have lost more than |total_loss| grams across the buckets.
+    double drain_grams_per_sec;
+    double confidence;
+    double total_loss;
+  };
+
+  explicit TrendPyramid(const std::vector<LevelConfig> &levels);
+
+  // |time| is MonotonicNs.
+  void Add(int64_t time, double grams);
+  // Forgets all the history.
+  void Clear();
+
+  size_t NumLevels() const { return levels_.size(); }
+  // The finished buckets of |level|, oldest first.
+  std::vector<TrendBucket> Buckets(size_t level) const;
+  // The fit over the finished buckets of |level|.
+  SlopeInfo Slope(size_t level) const { return levels_[level].stats.Slope(); }
+  // The finest level that shows draining, as of its last full bucket,
+  // or -1 if none do.
+  int DrainingLevel() const;
+
+ private:
+  struct Level {
+    LevelConfig config;
+    TrendBucket current;          // still filling
+    std::vector<TrendBucket> buckets;  // ring of the finished ones
+    uint64_t num_finished = 0;
+    WindowStats stats;            // of the bucket means, at their midpoints
+    bool draining = false;
+    explicit Level(const LevelConfig &c)
+      : config(c), buckets(c.num_buckets), stats(c.num_buckets) {}
+  };
+
+  // Adds |bucket| (a sample, or a finished bucket from the level below)
+  // to |level|, finishing the current bucket there if |bucket| is past it.
+  void AddToLevel(size_t level, const TrendBucket &bucket);
+  void FinishBucket(size_t level);
+
+  std::vector<Level> levels_;
+};
@@ -0,0 +1,92 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "trend_pyramid.h"
+#include "monotonic_clock.h"
+#include "gtest/gtest.h"
+
+#include <stdlib.h>
+
+namespace {
+
+constexpr int64_t kStartTime = 1000 * kNsPerSec;
+constexpr int64_t kPeriod = 100 * kNsPerMs;  // 10 SPS
+
+std::vector<TrendPyramid::LevelConfig> TestLevels() {
+  return {
+    {kNsPerSec, 30, -15.0, 12.5, 200.0},
+    {10 * kNsPerSec, 18, -4.0, 12.5, 300.0},
+    {60 * kNsPerSec, 30, -2.0, 12.5, 1000.0},
+  };
+}
+
+// Feeds |seconds| of samples losing |grams_per_sec|, with some noise.
+// Returns the first level to show draining, and the time it took.
+int RunLeak(TrendPyramid *trends, double grams_per_sec, int seconds,
+            double *detect_seconds) {
+  srand(2);
+  for (int i = 0; i < seconds * 10; ++i) {
+    double grams = 20000 - grams_per_sec * i / 10.0 + (rand() % 100) / 10.0;
+    trends->Add(kStartTime + i * kPeriod, grams);
+    if (trends->DrainingLevel() >= 0) {
+      *detect_seconds = i / 10.0;
+      return trends->DrainingLevel();
+    }
+  }
+  return -1;
+}
+
+TEST(TrendPyramid, BucketsNest) {
+  TrendPyramid trends(TestLevels());
+  // 25 seconds at one gram per sample
+  for (int i = 0; i < 250; ++i) {
+    trends.Add(kStartTime + i * kPeriod, i);
+  }
+  std::vector<TrendBucket> seconds = trends.Buckets(0);
+  ASSERT_EQ(seconds.size(), 24u);  // the 25th is still filling
+  EXPECT_EQ(seconds[0].start, kStartTime);
+  EXPECT_EQ(seconds[0].count, 10);
+  EXPECT_EQ(seconds[0].min, 0);
+  EXPECT_EQ(seconds[0].max, 9);
+  EXPECT_EQ(seconds[0].Mean(), 4.5);
+  std::vector<TrendBucket> tens = trends.Buckets(1);
+  ASSERT_EQ(tens.size(), 2u);  // the third has seconds 20-23 so far
+  EXPECT_EQ(tens[0].start, kStartTime);
+  EXPECT_EQ(tens[0].count, 100);
+  EXPECT_EQ(tens[0].max, 99);
+  EXPECT_EQ(tens[1].min, 100);
+  EXPECT_EQ(trends.Buckets(2).size(), 0u);
+  trends.Clear();
+  EXPECT_EQ(trends.Buckets(0).size(), 0u);
+}
+
+TEST(TrendPyramid, FastDrainShowsInSeconds) {
+  TrendPyramid trends(TestLevels());
+  double seconds = 0;
+  EXPECT_EQ(RunLeak(&trends, 30, 600, &seconds), 0);
+  EXPECT_LT(seconds, 35);
+}
+
+TEST(TrendPyramid, SlowLeakShowsInMinutes) {
+  TrendPyramid trends(TestLevels());
+  double seconds = 0;
+  // Too slow for the 1 second buckets to see through the noise.
+  EXPECT_EQ(RunLeak(&trends, 5, 3600, &seconds), 1);
+  EXPECT_LT(seconds, 200);
+}
+
+TEST(TrendPyramid, DripShowsInHalfAnHour) {
+  TrendPyramid trends(TestLevels());
+  double seconds = 0;
+  EXPECT_EQ(RunLeak(&trends, 2.5, 3600, &seconds), 2);
+  EXPECT_LT(seconds, 1900);
+}
+
+TEST(TrendPyramid, SteadyWeightNeverDrains) {
+  TrendPyramid trends(TestLevels());
+  double seconds = 0;
+  EXPECT_EQ(RunLeak(&trends, 0, 3600, &seconds), -1);
+}
+
+}  // namespace
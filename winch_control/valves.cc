@@ -3,30 +3,57 @@
 // found in the LICENSE file.
 
 #include "valves.h"
+#include "gpio_bank.h"
 
 
+// The valve and chiller pump relays are active low, so they start at 1 (off).
+// Everything goes through one output group so each change is one operation.
+static GpioOutputGroup &RelayOutputs(int *status = nullptr) {
+  static GpioOutputGroup outputs({KETTLE_VALVE, CARBOY_VALVE, CHILLER_VALVE,
+                                  VALVE_ENABLE, CHILLER_PUMP}, 1);
+  static int open_status = outputs.Open();
+  if (open_status) {
+    printf("Failed to open relay outputs\n");
+  }
+  if (status) *status = open_status;
+  return outputs;
+}
+
+int InitValves() {
+  int status;
+  RelayOutputs(&status);
+  return status;
+}
+
 int SetFlow(FlowPath path) {
-  // Set up the valve config.  The output is active low
-  SetOutput(KETTLE_VALVE, (path != KETTLE));
-  SetOutput(CARBOY_VALVE, (path != CARBOY));
-  SetOutput(CHILLER_VALVE, (path != CHILLER));
-  SetOutput(VALVE_ENABLE, 0);
+  GpioOutputGroup &relays = RelayOutputs();
+  // Set up the valve config and enable movement.  The output is active low
+  if (relays.Begin()
+      .Set(KETTLE_VALVE, (path != KETTLE))
+      .Set(CARBOY_VALVE, (path != CARBOY))
+      .Set(CHILLER_VALVE, (path != CHILLER))
+      .Set(VALVE_ENABLE, 0).Commit()) {
+    printf("SetFlow: Failed to set valves\n");
+  }
   // The valve is guarenteed to finish in 5 seconds
   sleep(5);
   // disallow movement, then reset the relays:
-  SetOutput(VALVE_ENABLE, 1);
-  SetOutput(KETTLE_VALVE, 1);
-  SetOutput(CARBOY_VALVE, 1);
-  SetOutput(CHILLER_VALVE, 1);
+  if (relays.Begin()
+      .Set(VALVE_ENABLE, 1)
+      .Set(KETTLE_VALVE, 1)
+      .Set(CARBOY_VALVE, 1)
+      .Set(CHILLER_VALVE, 1).Commit()) {
+    printf("SetFlow: Failed to reset valves\n");
+  }
   return 0;
 }
 
 
 int ActivateChillerPump() {
-  return SetOutput(CHILLER_PUMP, 0);
+  return RelayOutputs().Begin().Set(CHILLER_PUMP, 0).Commit();
 }
 int DeactivateChillerPump() {
-  return SetOutput(CHILLER_PUMP, 1);
+  return RelayOutputs().Begin().Set(CHILLER_PUMP, 1).Commit();
 }
 
 
@@ -9,6 +9,10 @@
 
 enum FlowPath {NO_PATH, KETTLE, CHILLER, CARBOY};
 
+// Opens the valve and chiller pump relays, all off.  Returns -1 if they
+// can't be opened.  The other functions open them if this wasn't called.
+int InitValves();
+
 int SetFlow(FlowPath path);
 
 
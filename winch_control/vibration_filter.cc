@@ -0,0 +1,201 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "vibration_filter.h"
+
+#include <math.h>
+#include <algorithm>
+#include <complex>
+#include "monotonic_clock.h"
+
+// In place radix 2 FFT.  data.size() must be a power of 2.
+static void Fft(std::vector<std::complex<double>> *data) {
+  std::vector<std::complex<double>> &x = *data;
+  size_t n = x.size();
+  for (size_t i = 1, j = 0; i < n; ++i) {
+    size_t bit = n >> 1;
+    for (; j & bit; bit >>= 1) j ^= bit;
+    j ^= bit;
+    if (i < j) std::swap(x[i], x[j]);
+  }
+  for (size_t len = 2; len <= n; len <<= 1) {
+    std::complex<double> step = std::polar(1.0, -2 * M_PI / len);
+    for (size_t i = 0; i < n; i += len) {
+      std::complex<double> w(1.0);
+      for (size_t k = 0; k < len / 2; ++k) {
+        std::complex<double> even = x[i + k], odd = x[i + k + len / 2] * w;
+        x[i + k] = even + odd;
+        x[i + k + len / 2] = even - odd;
+        w *= step;
+      }
+    }
+  }
+}
+
+void VibrationFilter::Notch::Settle(double x) {
+  // With y == x: z2 = (b2 - a2) x, and z1 = (b1 - a1) x + z2.
+  z2 = (b2 - a2) * x;
+  z1 = (b1 - a1) * x + z2;
+}
+
+double VibrationFilter::Notch::Filter(double x) {
+  double y = b0 * x + z1;
+  z1 = b1 * x - a1 * y + z2;
+  z2 = b2 * x - a2 * y;
+  return y;
+}
+
+VibrationFilter::VibrationFilter(const Config &config)
+  : config_(config), hann_(config.fft_size), bins_(config.fft_size) {
+  for (size_t i = 0; i < config_.fft_size; ++i) {
+    hann_[i] = 0.5 - 0.5 * cos(2 * M_PI * i / (config_.fft_size - 1));
+  }
+  window_.reserve(config_.fft_size);
+  window_times_.reserve(config_.fft_size);
+}
+
+void VibrationFilter::Reset() {
+  window_.clear();
+  window_times_.clear();
+  spectrum_.clear();
+  baseline_.clear();
+  num_spectra_ = num_baselines_ = 0;
+  notches_.clear();
+  active_ = false;
+}
+
+double VibrationFilter::Add(int64_t time, double grams, bool pump_on) {
+  if (pump_on != window_pump_on_) {
+    window_.clear();
+    window_times_.clear();
+    window_pump_on_ = pump_on;
+  }
+  window_.push_back(grams);
+  window_times_.push_back(time);
+  if (window_.size() == config_.fft_size) {
+    if (Transform()) {
+      if (pump_on) {
+        Average(&spectrum_, &num_spectra_);
+        if (FindNotches()) active_ = false;  // start the new notches from here
+      } else {
+        Average(&baseline_, &num_baselines_);
+      }
+    }
+    // Keep the newer half, so the next FFT comes half a window later.
+    size_t half = config_.fft_size / 2;
+    window_.erase(window_.begin(), window_.begin() + half);
+    window_times_.erase(window_times_.begin(), window_times_.begin() + half);
+  }
+  if (!pump_on || notches_.empty()) {
+    active_ = false;
+    return grams;
+  }
+  if (!active_) {
+    // The pump just started.
+    for (Notch &notch : notches_) notch.Settle(grams);
+    active_ = true;
+  }
+  double filtered = grams;
+  for (Notch &notch : notches_) {
+    filtered = notch.Filter(filtered);
+  }
+  return filtered;
+}
+
+bool VibrationFilter::Transform() {
+  size_t n = window_.size();
+  if (window_times_.back() <= window_times_.front()) return false;
+  double rate = (n - 1) * (double)kNsPerSec / (window_times_.back() - window_times_.front());
+  sample_rate_ += (sample_rate_ == 0 ? 1.0 : config_.spectrum_gain) * (rate - sample_rate_);
+  // Take out the line through the window, so a draining weight doesn't
+  // leak into the low bins.
+  double tmean = (n - 1) / 2.0, wmean = 0;
+  for (double w : window_) wmean += w;
+  wmean /= n;
+  double stt = 0, stw = 0;
+  for (size_t i = 0; i < n; ++i) {
+    stt += (i - tmean) * (i - tmean);
+    stw += (i - tmean) * (window_[i] - wmean);
+  }
+  double slope = stw / stt;
+  for (size_t i = 0; i < n; ++i) {
+    bins_[i] = (window_[i] - wmean - slope * (i - tmean)) * hann_[i];
+  }
+  Fft(&bins_);
+  power_.resize(n / 2 + 1);
+  for (size_t k = 0; k < power_.size(); ++k) {
+    power_[k] = std::norm(bins_[k]);
+  }
+  return true;
+}
+
+void VibrationFilter::Average(std::vector<double> *spectrum, int *num_spectra) {
+  if (spectrum->size() != power_.size()) {
+    spectrum->assign(power_.size(), 0);
+    *num_spectra = 0;
+  }
+  double gain = *num_spectra == 0 ? 1.0 : config_.spectrum_gain;
+  for (size_t k = 0; k < power_.size(); ++k) {
+    (*spectrum)[k] += gain * (power_[k] - (*spectrum)[k]);
+  }
+  (*num_spectra)++;
+}
+
+bool VibrationFilter::FindNotches() {
+  if (num_spectra_ < config_.min_spectra || num_baselines_ == 0) return false;
+  size_t n = config_.fft_size, half = spectrum_.size();
+  // Find the peaks that stand out from the median, and from the baseline.
+  // A weight step raises the whole spectrum for a window or two, so the
+  // notches we have stay as long as they stand out from the baseline.
+  std::vector<double> sorted(spectrum_.begin() + config_.min_bin, spectrum_.end());
+  std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+  double threshold = config_.peak_ratio * sorted[sorted.size() / 2];
+  std::vector<size_t> peaks;
+  size_t next_notch = 0;
+  for (size_t k = config_.min_bin; k < half - 1; ++k) {
+    bool notched = next_notch < notches_.size() && notches_[next_notch].bin == k;
+    if (notched) next_notch++;
+    double baseline = std::max(baseline_[k], std::max(baseline_[k - 1], baseline_[k + 1]));
+    if (spectrum_[k] <= config_.baseline_ratio * baseline) continue;
+    if (notched || (spectrum_[k] > threshold && spectrum_[k] >= spectrum_[k - 1] &&
+                    spectrum_[k] >= spectrum_[k + 1])) {
+      peaks.push_back(k);
+    }
+  }
+  std::sort(peaks.begin(), peaks.end(), [this](size_t a, size_t b) {
+      return spectrum_[a] > spectrum_[b];
+    });
+  if (peaks.size() > config_.max_notches) peaks.resize(config_.max_notches);
+  std::sort(peaks.begin(), peaks.end());
+  bool same = peaks.size() == notches_.size();
+  for (size_t i = 0; same && i < peaks.size(); ++i) {
+    same = peaks[i] == notches_[i].bin;
+  }
+  if (same) return false;
+
+  notches_.clear();
+  for (size_t k : peaks) {
+    // The window spreads a peak over a few bins, so make the notch 2 bins wide.
+    double q = std::max(1.0, k / 2.0);
+    double w0 = 2 * M_PI * k / n;
+    double alpha = sin(w0) / (2 * q);
+    double a0 = 1 + alpha;
+    Notch notch;
+    notch.bin = k;
+    notch.frequency = k * sample_rate_ / n;
+    notch.b0 = 1 / a0;
+    notch.b1 = -2 * cos(w0) / a0;
+    notch.b2 = 1 / a0;
+    notch.a1 = -2 * cos(w0) / a0;
+    notch.a2 = (1 - alpha) / a0;
+    notches_.push_back(notch);
+  }
+  return true;
+}
+
+std::vector<double> VibrationFilter::NotchFrequencies() const {
+  std::vector<double> frequencies;
+  for (const Notch &notch : notches_) frequencies.push_back(notch.frequency);
+  return frequencies;
+}
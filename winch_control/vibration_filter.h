@@ -0,0 +1,90 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <complex>
+#include <vector>
+
+// Takes the pump's vibration out of the weight readings.  The readings go
+// through an FFT, a window at a time (each overlapping the last by half),
+// and the power spectra are averaged: one for while the pump runs, and a
+// baseline for while it doesn't.  The bins that stand well above the rest,
+// and well above the baseline, are the pump (aliased down by the slow
+// sample rate), and each gets a notch filter.  Anything that is there
+// without the pump, like ripple from the liquid draining, is left alone.
+// Until there is a baseline, nothing is notched.
+// The notches only apply while the pump is on, and pass the weight itself
+// (DC) through untouched.  The spectra are kept when the pump stops, so
+// the notches are ready the next time it starts.
+// Not thread safe.
+class VibrationFilter {
+ public:
+  struct Config {
+    size_t fft_size = 256;       // samples per FFT.  Must be a power of 2.
+    size_t max_notches = 4;
+    // A bin is vibration if it has this many times the median power.
+    double peak_ratio = 10.0;    //TODO: check value
+    // And this many times the power of it and its neighbours without the pump.
+    double baseline_ratio = 10.0;  //TODO: check value
+    // Bins below this are the weight changing, not vibration.
+    size_t min_bin = 4;
+    // Pump-on spectra averaged before the notches are used.
+    int min_spectra = 2;
+    // How much each new spectrum counts in the average.
+    double spectrum_gain = 0.25;
+  };
+
+  VibrationFilter() : VibrationFilter(Config()) {}
+  explicit VibrationFilter(const Config &config);
+
+  // |time| is MonotonicNs.  Returns the reading with the vibration taken out
+  // if the pump is on and we know what it looks like, otherwise |grams|.
+  double Add(int64_t time, double grams, bool pump_on);
+  void Reset();
+
+  // True if the last reading went through the notches.
+  bool Active() const { return active_; }
+  // The notch frequencies, in Hz, lowest first.
+  std::vector<double> NotchFrequencies() const;
+
+ private:
+  // A second order notch, in transposed direct form II.
+  struct Notch {
+    size_t bin;
+    double frequency;
+    double b0, b1, b2, a1, a2;
+    double z1 = 0, z2 = 0;
+    // Sets the state as if |x| had been going in for ever.
+    void Settle(double x);
+    double Filter(double x);
+  };
+
+  // Sets power_ to the spectrum of window_.  Returns false if the times
+  // are no good.
+  bool Transform();
+  // Averages power_ into |spectrum|.
+  void Average(std::vector<double> *spectrum, int *num_spectra);
+  // Finds the peaks of spectrum_ against baseline_.  Returns true if that
+  // moved the notches.
+  bool FindNotches();
+
+  Config config_;
+  std::vector<double> hann_;
+  // The readings waiting for an FFT, all with the pump on or all off.
+  std::vector<double> window_;
+  std::vector<int64_t> window_times_;
+  bool window_pump_on_ = false;
+  // The last FFT, and its power in each bin up to the Nyquist frequency.
+  std::vector<std::complex<double>> bins_;
+  std::vector<double> power_;
+  // Averaged power of each bin, with the pump on and off.
+  std::vector<double> spectrum_, baseline_;
+  int num_spectra_ = 0, num_baselines_ = 0;
+  double sample_rate_ = 0;
+  std::vector<Notch> notches_;
+  bool active_ = false;
+};
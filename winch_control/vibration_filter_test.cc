@@ -0,0 +1,132 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "vibration_filter.h"
+#include "monotonic_clock.h"
+#include "gtest/gtest.h"
+
+#include <math.h>
+#include <random>
+
+namespace {
+
+constexpr int64_t kPeriod = 12500 * kNsPerUs;  // 80 SPS
+
+// The pump shakes the scale at 50 Hz and 100 Hz, which show up at 30 Hz and
+// 20 Hz at 80 SPS.
+double Vibration(int i) {
+  double t = i * kPeriod / (double)kNsPerSec;
+  return 40 * sin(2 * M_PI * 50 * t + 0.3) + 15 * sin(2 * M_PI * 100 * t + 1.1);
+}
+
+// The RMS difference between the output and the weight, over |count|
+// readings from |start|.
+double RmsError(VibrationFilter *filter, int start, int count, bool pump_on,
+                std::mt19937 *gen) {
+  std::normal_distribution<double> noise(0, 2.0);
+  double sum = 0;
+  for (int i = start; i < start + count; ++i) {
+    double weight = 20000 - i * 0.1;  // slowly draining
+    double reading = weight + (pump_on ? Vibration(i) : 0) + noise(*gen);
+    double out = filter->Add(i * kPeriod, reading, pump_on);
+    sum += (out - weight) * (out - weight);
+  }
+  return sqrt(sum / count);
+}
+
+// Readings with the pump off before |start|, for the baseline.
+void LearnBaseline(VibrationFilter *filter, int start, std::mt19937 *gen) {
+  RmsError(filter, start - 512, 512, false, gen);
+}
+
+TEST(VibrationFilter, LearnsAndRemovesPumpVibration) {
+  std::mt19937 gen(7);
+  VibrationFilter filter;
+  LearnBaseline(&filter, 0, &gen);
+  // While it learns, the readings go straight through.  The windows
+  // overlap, so the second spectrum is in after one and a half.
+  EXPECT_GT(RmsError(&filter, 0, 384, true, &gen), 25);
+  ASSERT_TRUE(filter.Active());
+  std::vector<double> notches = filter.NotchFrequencies();
+  ASSERT_GE(notches.size(), 2u);
+  EXPECT_NEAR(notches[0], 20, 0.5);
+  EXPECT_NEAR(notches[1], 30, 0.5);
+  // Leave some time for the notches to ring down.
+  RmsError(&filter, 384, 80, true, &gen);
+  EXPECT_LT(RmsError(&filter, 464, 2000, true, &gen), 4);
+}
+
+TEST(VibrationFilter, OnlyFiltersWhilePumpIsOn) {
+  std::mt19937 gen(7);
+  VibrationFilter filter;
+  LearnBaseline(&filter, 0, &gen);
+  RmsError(&filter, 0, 2000, true, &gen);
+  ASSERT_TRUE(filter.Active());
+  // Pump off: untouched.
+  for (int i = 2000; i < 2100; ++i) {
+    EXPECT_EQ(filter.Add(i * kPeriod, 1000 + i, false), 1000 + i);
+  }
+  EXPECT_FALSE(filter.Active());
+  // Back on: the notches are ready, and start without a jump.
+  EXPECT_NEAR(filter.Add(2100 * kPeriod, 5000, true), 5000, 1e-6);
+  EXPECT_TRUE(filter.Active());
+}
+
+TEST(VibrationFilter, NoNotchesForPlainNoise) {
+  std::mt19937 gen(7);
+  std::normal_distribution<double> noise(0, 5.0);
+  VibrationFilter filter;
+  LearnBaseline(&filter, 0, &gen);
+  for (int i = 0; i < 5000; ++i) {
+    double reading = 1000 + noise(gen);
+    EXPECT_EQ(filter.Add(i * kPeriod, reading, true), reading);
+  }
+  EXPECT_TRUE(filter.NotchFrequencies().empty());
+}
+
+// The weight itself goes through: after a step, the output settles on the
+// new weight.
+TEST(VibrationFilter, PassesWeightSteps) {
+  std::mt19937 gen(7);
+  VibrationFilter filter;
+  LearnBaseline(&filter, 0, &gen);
+  RmsError(&filter, 0, 1000, true, &gen);
+  ASSERT_TRUE(filter.Active());
+  double out = 0;
+  for (int i = 1000; i < 1400; ++i) {
+    out = filter.Add(i * kPeriod, 15000 + Vibration(i), true);
+  }
+  EXPECT_NEAR(out, 15000, 5);
+}
+
+// Without the pump off to compare against, there's no telling vibration
+// from the weight, so nothing is notched.
+TEST(VibrationFilter, NeedsBaseline) {
+  std::mt19937 gen(7);
+  VibrationFilter filter;
+  RmsError(&filter, 0, 2000, true, &gen);
+  EXPECT_FALSE(filter.Active());
+  EXPECT_TRUE(filter.NotchFrequencies().empty());
+}
+
+// A ripple that is there with the pump off too isn't the pump.
+TEST(VibrationFilter, IgnoresRippleWithoutPump) {
+  std::mt19937 gen(7);
+  std::normal_distribution<double> noise(0, 2.0);
+  VibrationFilter filter;
+  auto ripple = [](int i) { return 10 * sin(2 * M_PI * 5 * i * kPeriod / (double)kNsPerSec); };
+  for (int i = 0; i < 512; ++i) {
+    filter.Add(i * kPeriod, 20000 + ripple(i) + noise(gen), false);
+  }
+  for (int i = 512; i < 2000; ++i) {
+    filter.Add(i * kPeriod, 20000 + ripple(i) + Vibration(i) + noise(gen), true);
+  }
+  ASSERT_TRUE(filter.Active());
+  std::vector<double> notches = filter.NotchFrequencies();
+  ASSERT_EQ(notches.size(), 2u);
+  EXPECT_NEAR(notches[0], 20, 0.5);
+  EXPECT_NEAR(notches[1], 30, 0.5);
+}
+
+}  // namespace
@@ -3,6 +3,8 @@
 // found in the LICENSE file.
 
 #include "winch.h"
+#include "gpio_bank.h"
+#include "monotonic_clock.h"
 
 #include <iostream>
 
@@ -11,83 +13,68 @@
 // Left slide switch: stops left winch from going up
 // Zero point: go left until LSS, then Right Up until RTS
 
-class Winch {
-  int enable_, dir_;
-  const char *side_;
+// When destructing, shut off both winches :)
+class WinchStopper {
+  GpioOutputGroup *outputs_;
   public:
-  Winch(const char* side) : side_(side) {
-    if (strcmp(side,"left") == 0) {
-      enable_ = LEFT_WINCH_ENABLE;
-      dir_ = LEFT_WINCH_DIRECTION;
-    } else {
-      enable_ = RIGHT_WINCH_ENABLE;
-      dir_ = RIGHT_WINCH_DIRECTION;
-    }
-  }
-
-  // When destructing, shut off winch :)
-  ~Winch() {
-    if (SetOutput(enable_, 0)) {
-      printf("Failed to disable %s winch!\n", side_);
-    }
-    if (SetOutput(dir_, 0)) {
-      printf("Failed to set '0' direction for %s winch!\n", side_);
+  explicit WinchStopper(GpioOutputGroup *outputs) : outputs_(outputs) {}
+  ~WinchStopper() {
+    if (outputs_->Begin()
+        .Set(LEFT_WINCH_ENABLE, 0).Set(RIGHT_WINCH_ENABLE, 0)
+        .Set(LEFT_WINCH_DIRECTION, 0).Set(RIGHT_WINCH_DIRECTION, 0).Commit()) {
+      printf("Failed to stop winches!\n");
     }
   }
+};
 
-  int Enable(int direction) {
-    if (direction == 0) {
-      return 0;
-    }
-    // translate up: -1 -> 1,  down: 1 -> 0
-    if(SetOutput(dir_, direction < 0 ? 1 : 0)) {
-      printf("Failed to set %s direction\n", side_);
-      return -1;
-    }
-    if(SetOutput(enable_, 1)) {
-      printf("Failed to set %s enable\n", side_);
-      return -1;
-    }
-    return 0;
+// Adds the direction and enable for one winch to |transaction|.
+// translate up: -1 -> 1,  down: 1 -> 0
+static void EnableWinch(GpioOutputGroup::Transaction *transaction,
+                        uint8_t dir_pin, uint8_t enable_pin, int direction) {
+  if (direction == 0) {
+    return;
   }
-};
+  transaction->Set(dir_pin, direction < 0 ? 1 : 0).Set(enable_pin, 1);
+}
 
-bool WinchController::IsRightSlideAtLimit() {
-  int val = ReadInput(RIGHT_SLIDE_SWITCH);
+// The limit switches are active low.
+static bool IsSwitchClosed(uint8_t pin) {
+  int val = GpioBank::Instance().Line(pin)->Get();
   if (val < 0) return val;
   if (val == 0) return 1;
   return 0;
 }
 
+bool WinchController::IsRightSlideAtLimit() {
+  return IsSwitchClosed(RIGHT_SLIDE_SWITCH);
+}
+
 bool WinchController::IsLeftSlideAtLimit() {
-  int val = ReadInput(LEFT_SLIDE_SWITCH);
-  if (val < 0) return val;
-  if (val == 0) return 1;
-  return 0;
+  return IsSwitchClosed(LEFT_SLIDE_SWITCH);
 }
 
 bool WinchController::IsTopAtLimit() {
-  int val = ReadInput(TOP_SWITCH);
-  if (val < 0) return val;
-  if (val == 0) return 1;
-  return 0;
+  return IsSwitchClosed(TOP_SWITCH);
 }
 
 // TODO: may need to add delay after I set the direction
 int WinchController::RunWinches(uint32_t run_time, int left_dir, int right_dir) {
-  Winch left("left"), right("right");
-  // Set outputs.
-  // If anything fails, the destructors will turn off the winch.
-  if (left.Enable(left_dir) || right.Enable(right_dir)) {
+  WinchStopper stopper(&winch_outputs_);
+  // Set outputs, both winches in one go.
+  // If anything fails, the stopper will turn off the winches.
+  GpioOutputGroup::Transaction start = winch_outputs_.Begin();
+  EnableWinch(&start, LEFT_WINCH_DIRECTION, LEFT_WINCH_ENABLE, left_dir);
+  EnableWinch(&start, RIGHT_WINCH_DIRECTION, RIGHT_WINCH_ENABLE, right_dir);
+  if (start.Commit()) {
     printf("Error: Failed to activate winches.\n");
     return -1;
   }
   // Wait until time expires or limits hit
   // Check upfront if we are hitting limits:
-  int64_t start_time = GetTimeMsec();
-  int64_t tnow = GetTimeMsec();
+  int64_t start_time = MonotonicNs();
+  int64_t tnow = start_time;
   // While loop checks all of our stopping conditions every ms:
-  while ((tnow - start_time < run_time) &&
+  while ((tnow - start_time < run_time * kNsPerMs) &&
       // Left slide switch: stops left winch from going up
       !(left_dir == -1 && IsLeftSlideAtLimit()) &&
       // Right top switch: Stops both winches from going up
@@ -98,19 +85,19 @@ int WinchController::RunWinches(uint32_t run_time, int left_dir, int right_dir)
       // If we lifted up the kettle, shut it down!
       !(abort_func_ && abort_func_())) {
     usleep(1000);
-    tnow = GetTimeMsec();
+    tnow = MonotonicNs();
   }
   // In case it gives us any better reaction time,
   // stop the winches ASAP! Don't worry about the result here...
-  SetOutput(RIGHT_WINCH_ENABLE, 0);
-  SetOutput(LEFT_WINCH_ENABLE, 0);
+  winch_outputs_.Begin().Set(RIGHT_WINCH_ENABLE, 0).Set(LEFT_WINCH_ENABLE, 0).Commit();
   // now, lets update the positions:
-  tnow = GetTimeMsec();
-  // multiply by direction to get how to modify position
-  left_position += left_dir * (tnow - start_time);
-  right_position += right_dir * (tnow - start_time);
+  tnow = MonotonicNs();
+  // multiply by direction to get how to modify position (in ms of travel)
+  int64_t ran_ms = (tnow - start_time) / kNsPerMs;
+  left_position += left_dir * ran_ms;
+  right_position += right_dir * ran_ms;
 
-  // Now just exit, Winch destructor will make sure everything is cleaned up.
+  // Now just exit, WinchStopper will make sure everything is cleaned up.
   if (abort_func_) {
     return abort_func_() ? -1 : 0;
   }
@@ -118,27 +105,17 @@ int WinchController::RunWinches(uint32_t run_time, int left_dir, int right_dir)
 }
 
 
-WinchController::WinchController() {
-  if (SetDirection(LEFT_WINCH_ENABLE, 1, 0))  {
-    printf("WinchController: Failed to set GPIO direction\n");
-  }
-  if (SetDirection(RIGHT_WINCH_ENABLE, 1, 0))  {
-    printf("WinchController: Failed to set GPIO direction\n");
-  }
-  if (SetDirection(LEFT_WINCH_DIRECTION, 1, 0))  {
+WinchController::WinchController()
+  : winch_outputs_({LEFT_WINCH_ENABLE, RIGHT_WINCH_ENABLE,
+                    LEFT_WINCH_DIRECTION, RIGHT_WINCH_DIRECTION}, 0) {
+  if (winch_outputs_.Open())  {
     printf("WinchController: Failed to set GPIO direction\n");
   }
-  if (SetDirection(RIGHT_WINCH_DIRECTION, 1, 0))  {
-    printf("WinchController: Failed to set GPIO direction\n");
-  }
-  if (SetDirection(RIGHT_SLIDE_SWITCH, 0))  {
-    printf("WinchController: Failed to set GPIO direction\n");
-  }
-  if (SetDirection(LEFT_SLIDE_SWITCH, 0))  {
-    printf("WinchController: Failed to set GPIO direction\n");
-  }
-  if (SetDirection(TOP_SWITCH, 0))  {
-    printf("WinchController: Failed to set GPIO direction\n");
+  GpioBank &bank = GpioBank::Instance();
+  for (uint8_t pin : {RIGHT_SLIDE_SWITCH, LEFT_SLIDE_SWITCH, TOP_SWITCH}) {
+    if (bank.Line(pin)->SetDirection(0))  {
+      printf("WinchController: Failed to set GPIO direction\n");
+    }
   }
 }
 
@@ -5,6 +5,7 @@
 #pragma once
 
 #include "gpio.h"
+#include "gpio_bank.h"
 
 #include <functional>
 
@@ -27,6 +28,8 @@ class WinchController {
 
   int left_position = 0, right_position = 0;
   bool enabled = true;
+  // Direction and enable for both winches, so they can be changed together.
+  GpioOutputGroup winch_outputs_;
   // TODO: use this function!
   std::function<bool()> abort_func_ = nullptr;
 
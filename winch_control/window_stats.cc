@@ -0,0 +1,191 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "window_stats.h"
+
+#include <math.h>
+#include <stdio.h>
+#include "monotonic_clock.h"
+
+constexpr uint64_t WindowStats::kRecomputeInterval;
+
+SlopeInfo FitSlope(const std::vector<double> &weights,
+                   const std::vector<int64_t> &times) {
+  // run = (numpy.array(range(window))-numpy.mean(range(window))) / 100.0
+  // ...:     s0 = run * (r1 - m1)
+  // ...:     s1 = (r1-m1)*(r1-m1)
+  // ...:     slope = min(max(sum(s1)/sum(s0),-3000),3000)
+  // ...:     # how accurate was the slope:
+  // ...:     est=m1 + run*slope
+  // ...:     diff = sum(abs(r1-est))
+  double wsum = 0 ;
+  for (double w : weights) { wsum+=w; }
+  double wmean = wsum/weights.size();
+  double tsum = 0 ;
+  for (auto t : times) { tsum+=t; }
+  double tmean = tsum/weights.size();
+  double slope_num = 0, slope_denom = 0;
+  for (unsigned i = 0; i < weights.size(); ++i) {
+    slope_denom += (times[i] - tmean) * (weights[i] - wmean);
+    slope_num += (weights[i] - wmean)  * (weights[i] - wmean);
+  }
+  double slope;
+  if (slope_num < 1e-6 && slope_num > -1e-6) {
+    slope = 0;
+  } else {
+    slope = slope_num / slope_denom;
+  }
+  // Times are in ns, the limits below are in ms.
+  slope *= kNsPerMs;
+  // some losses are to large to be believed.  If we are truly losing at this rate,
+  // it won't matter anyway...
+  // slope is in grams(approx ml)/millisecond, so 1L/sec is crazy high
+  slope = slope > kMaxDrainSlope ? kMaxDrainSlope : slope;
+  slope = slope < -1*kMaxDrainSlope ? -1*kMaxDrainSlope : slope;
+  double diff = 0;
+  for (unsigned i = 0; i < weights.size(); ++i) {
+    // error = reading  - estimate from slope
+    double err = weights[i] - (wmean + (times[i] - tmean) / kNsPerMs * slope);
+    diff += err > 0 ? err : -1.0 * err; // abs(err)
+  }
+  diff /= weights.size();
+
+  // calculate max and min:
+  double wmin = weights[0], wmax = weights[0];
+  bool slope_down = false; // if lowest value comes after highest value
+  for (double w : weights) {
+      if (w < wmin) {
+          wmin = w;
+          slope_down = true;
+      }
+      if (w > wmax) {
+          wmax = w;
+          slope_down = false;
+      }
+  }
+
+  SlopeInfo info = {
+    .num_points = weights.size(),
+    .mean = wmean,
+    .slope = slope * 1000, // convert from ms to seconds
+    .ave_diff = diff,
+    .biggest_change = slope_down ? wmin - wmax : wmax - wmin,
+  };
+  return info;
+}
+
+WindowStats::WindowStats(size_t window)
+  : window_(window < 2 ? 2 : window), times_(window_), weights_(window_) {
+  // The ring indexes are modulo the window, and a slope needs two points.
+  if (window < 2) {
+    printf("WindowStats: a window of %zu points is too small, using 2\n", window);
+  }
+  min_.ids.resize(window_);
+  max_.ids.resize(window_);
+}
+
+void WindowStats::Clear() {
+  count_ = 0;
+  st_ = sw_ = stt_ = stw_ = sww_ = 0;
+  min_.head = min_.tail = 0;
+  max_.head = max_.tail = 0;
+}
+
+void WindowStats::AddToSums(int64_t time, double weight, double sign) {
+  double t = (time - t0_) / (double)kNsPerMs;
+  double w = weight - w0_;
+  st_ += sign * t;
+  sw_ += sign * w;
+  stt_ += sign * t * t;
+  stw_ += sign * t * w;
+  sww_ += sign * w * w;
+}
+
+void WindowStats::Add(int64_t time, double weight) {
+  if (count_ == 0) {
+    t0_ = time;
+    w0_ = weight;
+  }
+  uint64_t id = count_;
+  if (id >= window_) {
+    uint64_t oldest = id - window_;
+    AddToSums(times_[oldest % window_], weights_[oldest % window_], -1);
+    if (min_.front() == oldest) min_.pop_front();
+    if (max_.front() == oldest) max_.pop_front();
+  }
+  times_[id % window_] = time;
+  weights_[id % window_] = weight;
+  AddToSums(time, weight, 1);
+  // Ties keep the earlier sample, so the fronts are the first occurrences.
+  while (!min_.empty() && WeightOf(min_.back()) > weight) min_.pop_back();
+  min_.push_back(id);
+  while (!max_.empty() && WeightOf(max_.back()) < weight) max_.pop_back();
+  max_.push_back(id);
+  count_++;
+  if (count_ % kRecomputeInterval == 0) {
+    Recompute();
+  }
+}
+
+void WindowStats::Recompute() {
+  uint64_t oldest = count_ - size();
+  t0_ = times_[oldest % window_];
+  w0_ = weights_[oldest % window_];
+  st_ = sw_ = stt_ = stw_ = sww_ = 0;
+  for (uint64_t id = oldest; id < count_; ++id) {
+    AddToSums(times_[id % window_], weights_[id % window_], 1);
+  }
+}
+
+double WindowStats::Mean() const {
+  size_t n = size();
+  return n ? w0_ + sw_ / n : 0;
+}
+
+double WindowStats::Variance() const {
+  size_t n = size();
+  if (n == 0) return 0;
+  double sww = sww_ - sw_ * sw_ / n;
+  return sww > 0 ? sww / n : 0;
+}
+
+double WindowStats::LeastSquaresSlope() const {
+  size_t n = size();
+  if (n < 2) return 0;
+  double stt = stt_ - st_ * st_ / n;
+  double stw = stw_ - st_ * sw_ / n;
+  if (stt <= 0) return 0;
+  return stw / stt * 1000;  // times are in ms
+}
+
+SlopeInfo WindowStats::Slope() const {
+  SlopeInfo info;
+  size_t n = size();
+  if (n == 0) return info;
+  double tmean = st_ / n, wmean = sw_ / n;
+  double stt = stt_ - st_ * tmean;  // sum((t - tmean)^2)
+  double stw = stw_ - st_ * wmean;  // sum((t - tmean) * (w - wmean))
+  double sww = sww_ - sw_ * wmean;  // sum((w - wmean)^2)
+  // Same fit as FitSlope, but the times are already in ms.
+  double slope;
+  if (sww < 1e-6 && sww > -1e-6) {
+    slope = 0;
+  } else {
+    slope = sww / stw;
+  }
+  slope = slope > kMaxDrainSlope ? kMaxDrainSlope : slope;
+  slope = slope < -1*kMaxDrainSlope ? -1*kMaxDrainSlope : slope;
+  // sum((w - wmean - (t - tmean) * slope)^2), expanded:
+  double sq_err = sww - 2 * slope * stw + slope * slope * stt;
+  double wmin = WeightOf(min_.front()), wmax = WeightOf(max_.front());
+  // if lowest value comes after highest value
+  bool slope_down = min_.front() > max_.front();
+
+  info.num_points = n;
+  info.mean = w0_ + wmean;
+  info.slope = slope * 1000;  // convert from ms to seconds
+  info.ave_diff = sq_err > 0 ? sqrt(sq_err / n) : 0;
+  info.biggest_change = slope_down ? wmin - wmax : wmax - wmin;
+  return info;
+}
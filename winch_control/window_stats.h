@@ -0,0 +1,91 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+struct SlopeInfo {
+  size_t num_points = 0;
+  double mean = 0, slope = 0, ave_diff = 0;
+  double biggest_change = 0;
+};
+
+// Maximum drainage rate we believe.  Anything more is too big.
+static constexpr double kMaxDrainSlope = 500; // ml per second
+
+// |times| are MonotonicNs.  The slope is in grams per second.
+SlopeInfo FitSlope(const std::vector<double> &weights,
+                   const std::vector<int64_t> &times);
+
+// The same statistics as FitSlope, over the last |window| samples, kept up
+// to date as samples come in.  Adding a sample and reading any statistic
+// are both O(1): we keep running sums of t, w, t*t, t*w and w*w, and
+// monotonic queues for the min and max weights.
+// Not thread safe.
+class WindowStats {
+ public:
+  // |window| must be at least 2.  Smaller windows are made 2.
+  explicit WindowStats(size_t window);
+
+  // |time| is MonotonicNs.  Drops the oldest sample once the window is full.
+  void Add(int64_t time, double weight);
+  void Clear();
+
+  size_t size() const { return count_ < window_ ? count_ : window_; }
+  bool Full() const { return count_ >= window_; }
+  // Times of the oldest and newest samples in the window.
+  int64_t OldestTime() const { return times_[(count_ - size()) % window_]; }
+  int64_t NewestTime() const { return times_[(count_ - 1) % window_]; }
+  double Mean() const;
+  // Of the weights about their mean.
+  double Variance() const;
+  // The ordinary least squares slope of weight against time, in g/s.
+  // Unlike Slope(), which fits time against weight, this is well behaved
+  // when the weight is flat, so it is the one to use to see if it is.
+  double LeastSquaresSlope() const;
+
+  // Like FitSlope() on the samples in the window, except ave_diff is the
+  // RMS of the residuals rather than the mean of their absolute values,
+  // since that can be had from the sums.  For normally distributed noise
+  // the RMS is sqrt(pi / 2) (about 1.25) times bigger, so thresholds on
+  // ave_diff need to be that much bigger too.
+  SlopeInfo Slope() const;
+
+ private:
+  // The sums are recomputed from scratch this often, so rounding errors
+  // from adding and removing samples don't build up.
+  static constexpr uint64_t kRecomputeInterval = 4096;
+
+  // A queue of sample numbers, at most |window| long.
+  struct IndexQueue {
+    std::vector<uint64_t> ids;
+    uint64_t head = 0, tail = 0;
+    bool empty() const { return head == tail; }
+    uint64_t front() const { return ids[head % ids.size()]; }
+    uint64_t back() const { return ids[(tail - 1) % ids.size()]; }
+    void push_back(uint64_t id) { ids[tail++ % ids.size()] = id; }
+    void pop_front() { head++; }
+    void pop_back() { tail--; }
+  };
+
+  double WeightOf(uint64_t id) const { return weights_[id % window_]; }
+  // The sums use times in ms from t0_, and weights less w0_, so they
+  // don't lose precision to the size of the timestamps and weights.
+  void AddToSums(int64_t time, double weight, double sign);
+  void Recompute();
+
+  size_t window_;
+  std::vector<int64_t> times_;  // ring of the last window_ samples
+  std::vector<double> weights_;
+  uint64_t count_ = 0;          // samples ever added
+  int64_t t0_ = 0;
+  double w0_ = 0;
+  double st_ = 0, sw_ = 0, stt_ = 0, stw_ = 0, sww_ = 0;
+  // Sample numbers of increasing (min_) and decreasing (max_) weights.
+  // The front of each is the first occurrence of the min or max.
+  IndexQueue min_, max_;
+};
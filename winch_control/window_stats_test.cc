@@ -0,0 +1,114 @@
+// Copyright 2019 Garratt Gallagher. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "window_stats.h"
+#include "monotonic_clock.h"
+#include "gtest/gtest.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <deque>
+
+namespace {
+
+// Large, realistic timestamps and weights, to check we don't lose precision.
+constexpr int64_t kStartTime = 123456 * kNsPerSec;
+constexpr int64_t kPeriod = 100 * kNsPerMs;
+
+TEST(WindowStats, MatchesFitSlope) {
+  WindowStats stats(30);
+  std::deque<double> weights;
+  std::deque<int64_t> times;
+  srand(1);
+  double weight = 12000;
+  for (int i = 0; i < 10000; ++i) {
+    // Steady, then draining, then steady again, with some noise.
+    if (i > 3000 && i < 6000) weight -= 5;
+    double noisy = weight + (rand() % 100) / 10.0;
+    int64_t t = kStartTime + i * kPeriod;
+    stats.Add(t, noisy);
+    weights.push_back(noisy);
+    times.push_back(t);
+    if (weights.size() > 30) {
+      weights.pop_front();
+      times.pop_front();
+    }
+    SlopeInfo expected = FitSlope({weights.begin(), weights.end()},
+                                  {times.begin(), times.end()});
+    SlopeInfo info = stats.Slope();
+    ASSERT_EQ(info.num_points, expected.num_points);
+    EXPECT_NEAR(info.mean, expected.mean, 1e-6);
+    EXPECT_NEAR(stats.Mean(), expected.mean, 1e-6);
+    // The fit divides by sum((t - tmean) * (w - wmean)), which is near 0
+    // when the weight is flat, so the slope is only as good as that sum.
+    // When it comes out at the clamp, either sign is as good as the other.
+    if (fabs(expected.slope) < kMaxDrainSlope * 1000) {
+      EXPECT_NEAR(info.slope, expected.slope, 1e-5 * fabs(expected.slope) + 1e-6);
+    }
+    EXPECT_EQ(info.biggest_change, expected.biggest_change);
+    // RMS residual, which is at least the mean absolute residual.
+    EXPECT_GE(info.ave_diff, expected.ave_diff - 1e-6);
+    EXPECT_LT(info.ave_diff, 2 * expected.ave_diff + 1e-6);
+  }
+}
+
+TEST(WindowStats, PartialWindow) {
+  WindowStats stats(30);
+  EXPECT_EQ(stats.size(), 0u);
+  EXPECT_EQ(stats.Mean(), 0);
+  for (int i = 0; i < 10; ++i) {
+    stats.Add(kStartTime + i * kPeriod, 1000 - i);
+  }
+  EXPECT_EQ(stats.size(), 10u);
+  EXPECT_FALSE(stats.Full());
+  SlopeInfo info = stats.Slope();
+  EXPECT_NEAR(info.mean, 995.5, 1e-9);
+  EXPECT_NEAR(info.slope, -10, 1e-6);  // 1 gram every 100 ms
+  EXPECT_NEAR(info.ave_diff, 0, 1e-6);
+  EXPECT_EQ(info.biggest_change, -9);
+  stats.Clear();
+  EXPECT_EQ(stats.size(), 0u);
+}
+
+TEST(WindowStats, LeastSquaresSlope) {
+  WindowStats stats(20);
+  srand(2);
+  for (int i = 0; i < 100; ++i) {
+    // Flat, with +/- 5 grams of noise.
+    stats.Add(kStartTime + i * kPeriod, 9000 + (rand() % 1000) / 100.0 - 5);
+  }
+  EXPECT_LT(fabs(stats.LeastSquaresSlope()), 5.0);
+  EXPECT_NEAR(sqrt(stats.Variance()), 2.9, 1.0);
+  EXPECT_EQ(stats.OldestTime(), kStartTime + 80 * kPeriod);
+  EXPECT_EQ(stats.NewestTime(), kStartTime + 99 * kPeriod);
+  for (int i = 100; i < 120; ++i) {
+    stats.Add(kStartTime + i * kPeriod, 9000 - 3.0 * i);
+  }
+  EXPECT_NEAR(stats.LeastSquaresSlope(), -30.0, 1e-6);
+}
+
+TEST(WindowStats, FlatDataHasNoSlope) {
+  WindowStats stats(5);
+  for (int i = 0; i < 20; ++i) {
+    stats.Add(kStartTime + i * kPeriod, 8000);
+  }
+  EXPECT_TRUE(stats.Full());
+  SlopeInfo info = stats.Slope();
+  EXPECT_EQ(info.slope, 0);
+  EXPECT_EQ(info.mean, 8000);
+  EXPECT_EQ(info.biggest_change, 0);
+}
+
+// A slope needs two points, so that is the smallest window.
+TEST(WindowStats, TooSmallWindowIsMadeTwo) {
+  WindowStats stats(0);
+  for (int i = 0; i < 5; ++i) {
+    stats.Add(kStartTime + i * kPeriod, 8000 - i);
+  }
+  EXPECT_EQ(stats.size(), 2u);
+  EXPECT_EQ(stats.OldestTime(), kStartTime + 3 * kPeriod);
+  EXPECT_NEAR(stats.Slope().slope, -10, 1e-6);
+}
+
+}  // namespace